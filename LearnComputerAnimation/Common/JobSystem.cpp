@@ -0,0 +1,238 @@
+﻿#include "JobSystem.h"
+#include <algorithm>
+
+struct Job
+{
+    std::function<void()> Work;
+    // 未完成的依赖数量, Schedule在处理依赖期间额外持有1.
+    std::atomic<int> PendingDependencies;
+    std::atomic<bool> Finished;
+
+    // 保护Continuations, 以及Finished与Continuations之间的一致性.
+    std::mutex Mutex;
+    // 依赖于此任务的任务.
+    std::vector<JobHandle> Continuations;
+
+    Job() :PendingDependencies(1), Finished(false) {}
+};
+
+namespace
+{
+    // 当前线程所属的JobSystem及其队列, 工作线程启动时设置.
+    thread_local const JobSystem* tJobSystem = nullptr;
+    thread_local unsigned int tQueueIndex = 0;
+}
+
+JobSystem::JobSystem(unsigned int workerCount)
+    :mQueuedJobs(0)
+{
+    for (unsigned int i = 0; i <= workerCount; ++i)
+    {
+        mQueues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (unsigned int i = 1; i <= workerCount; ++i)
+    {
+        mWorkers.emplace_back(&JobSystem::WorkerMain, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto& worker : mWorkers)
+    {
+        worker.join();
+    }
+}
+
+unsigned int JobSystem::DefaultWorkerCount()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+unsigned int JobSystem::WorkerCount() const
+{
+    return (unsigned int)mWorkers.size();
+}
+
+JobHandle JobSystem::Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies)
+{
+    auto job = std::make_shared<Job>();
+    job->Work = std::move(work);
+
+    for (const auto& dependency : dependencies)
+    {
+        if (dependency == nullptr)
+        {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(dependency->Mutex);
+        if (!dependency->Finished)
+        {
+            ++job->PendingDependencies;
+            dependency->Continuations.push_back(job);
+        }
+    }
+
+    // 放开Schedule持有的计数, 依赖都已完成时立即入队.
+    if (--job->PendingDependencies == 0)
+    {
+        Submit(job);
+    }
+    return job;
+}
+
+JobHandle JobSystem::ScheduleParallelFor(size_t count, size_t grainSize,
+    std::function<void(size_t begin, size_t end)> body,
+    const std::vector<JobHandle>& dependencies)
+{
+    grainSize = (std::max)(grainSize, (size_t)1);
+    // 所有分段共享同一个body.
+    auto sharedBody = std::make_shared<std::function<void(size_t, size_t)>>(std::move(body));
+
+    std::vector<JobHandle> chunks;
+    chunks.reserve((count + grainSize - 1) / grainSize);
+    for (size_t begin = 0; begin < count; begin += grainSize)
+    {
+        size_t end = (std::min)(count, begin + grainSize);
+        chunks.push_back(Schedule([sharedBody, begin, end]() { (*sharedBody)(begin, end); }, dependencies));
+    }
+
+    // 汇合任务.
+    return Schedule(nullptr, chunks);
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body)
+{
+    Wait(ScheduleParallelFor(count, grainSize, body));
+}
+
+void JobSystem::Wait(const JobHandle& job)
+{
+    unsigned int queueIndex = CurrentQueueIndex();
+    while (!job->Finished)
+    {
+        if (!TryRunOne(queueIndex))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::Submit(const JobHandle& job)
+{
+    WorkQueue& queue = *mQueues[CurrentQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        queue.Jobs.push_back(job);
+    }
+    ++mQueuedJobs;
+
+    // 加锁后再通知, 避免工作线程检查完条件、还未休眠时错过通知.
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+    }
+    mWake.notify_one();
+}
+
+void JobSystem::Execute(const JobHandle& job)
+{
+    if (job->Work)
+    {
+        job->Work();
+        // 尽早释放捕获的资源.
+        job->Work = nullptr;
+    }
+
+    std::vector<JobHandle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job->Mutex);
+        job->Finished = true;
+        continuations.swap(job->Continuations);
+    }
+    for (const auto& continuation : continuations)
+    {
+        if (--continuation->PendingDependencies == 0)
+        {
+            Submit(continuation);
+        }
+    }
+}
+
+bool JobSystem::TryRunOne(unsigned int queueIndex)
+{
+    JobHandle job = Pop(queueIndex);
+    if (job == nullptr)
+    {
+        job = Steal(queueIndex);
+    }
+    if (job == nullptr)
+    {
+        return false;
+    }
+    Execute(job);
+    return true;
+}
+
+JobHandle JobSystem::Pop(unsigned int queueIndex)
+{
+    WorkQueue& queue = *mQueues[queueIndex];
+    std::lock_guard<std::mutex> lock(queue.Mutex);
+    if (queue.Jobs.empty())
+    {
+        return nullptr;
+    }
+    JobHandle job = std::move(queue.Jobs.back());
+    queue.Jobs.pop_back();
+    --mQueuedJobs;
+    return job;
+}
+
+JobHandle JobSystem::Steal(unsigned int thiefIndex)
+{
+    unsigned int queueCount = (unsigned int)mQueues.size();
+    for (unsigned int i = 1; i < queueCount; ++i)
+    {
+        WorkQueue& queue = *mQueues[(thiefIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if (!queue.Jobs.empty())
+        {
+            JobHandle job = std::move(queue.Jobs.front());
+            queue.Jobs.pop_front();
+            --mQueuedJobs;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::WorkerMain(unsigned int queueIndex)
+{
+    tJobSystem = this;
+    tQueueIndex = queueIndex;
+
+    for (;;)
+    {
+        if (TryRunOne(queueIndex))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        mWake.wait(lock, [this]() { return mStop || mQueuedJobs > 0; });
+        if (mStop && mQueuedJobs == 0)
+        {
+            return;
+        }
+    }
+}
+
+unsigned int JobSystem::CurrentQueueIndex() const
+{
+    return tJobSystem == this ? tQueueIndex : 0;
+}
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 任务, 由JobSystem创建, 通过JobHandle引用. 任务完成前句柄必须有效.
+struct Job;
+typedef std::shared_ptr<Job> JobHandle;
+
+// 工作窃取(work-stealing)任务调度器.
+// 每个工作线程有自己的任务队列: 从队尾取自己提交的任务(刚提交的数据还在缓存中),
+// 自己的队列为空时从其他队列的队首窃取. 其他线程提交的任务进入共享队列.
+// 任务可以依赖其他任务, 所有依赖完成后才会进入队列.
+// 调用Wait的线程也会执行任务, 所以并行度为WorkerCount()+1.
+class JobSystem
+{
+public:
+    explicit JobSystem(unsigned int workerCount = DefaultWorkerCount());
+    ~JobSystem();
+    // 禁止拷贝和赋值
+    JobSystem(const JobSystem& rhs) = delete;
+    JobSystem& operator=(const JobSystem& rhs) = delete;
+
+    // 核心数-1, 主线程占用一个核心.
+    static unsigned int DefaultWorkerCount();
+    unsigned int WorkerCount() const;
+
+    // 提交任务, dependencies全部完成后执行. work可以为空, 用于汇合多个任务.
+    JobHandle Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies = {});
+
+    // 把[0,count)分成每段grainSize个元素, 每段一个任务, 调用body(begin,end).
+    // 返回的任务在所有分段完成后完成.
+    JobHandle ScheduleParallelFor(size_t count, size_t grainSize,
+        std::function<void(size_t begin, size_t end)> body,
+        const std::vector<JobHandle>& dependencies = {});
+    // 同上, 但是等待所有分段完成后才返回.
+    void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)>& body);
+
+    // 等待任务完成, 等待期间执行其他任务.
+    void Wait(const JobHandle& job);
+
+private:
+    struct WorkQueue
+    {
+        std::mutex Mutex;
+        std::deque<JobHandle> Jobs;
+    };
+
+    void Submit(const JobHandle& job);
+    void Execute(const JobHandle& job);
+    // 执行一个任务, 没有任务时返回false.
+    bool TryRunOne(unsigned int queueIndex);
+    JobHandle Pop(unsigned int queueIndex);
+    JobHandle Steal(unsigned int thiefIndex);
+    void WorkerMain(unsigned int queueIndex);
+    unsigned int CurrentQueueIndex() const;
+
+    std::vector<std::thread> mWorkers;
+    // 0号是其他线程共享的队列, 1到WorkerCount()是工作线程各自的队列.
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    // 所有队列中的任务总数, 为0时工作线程休眠.
+    std::atomic<size_t> mQueuedJobs;
+
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    bool mStop = false;
+};
@@ -80,6 +80,18 @@ public:
     {
         memcpy(&mMappedData[elementIndex*mElementByteSize],&data,sizeof(T));
     }
+    // 上传连续的多个元素.元素之间没有填充，所以只能用于非常量缓冲区.
+    void CopyData(int elementIndex,const T* data,UINT elementCount)
+    {
+        assert(!mIsConstantBuffer);
+        memcpy(&mMappedData[elementIndex*mElementByteSize],data,sizeof(T)*elementCount);
+    }
+    // 映射内存中的元素，可以直接在上面写入数据而不用先准备一份再CopyData.
+    // 上传堆是write-combined内存，只能写，读取会非常慢.
+    T* MappedData(int elementIndex)
+    {
+        return reinterpret_cast<T*>(&mMappedData[elementIndex*mElementByteSize]);
+    }
     
     
 
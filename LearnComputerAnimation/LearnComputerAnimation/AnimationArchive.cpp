@@ -0,0 +1,511 @@
+#include "AnimationArchive.h"
+
+using namespace DirectX;
+
+// File layout, little endian:
+//
+//   char   Magic[4]            "M3DA"
+//   UINT   Version, BoneCount, ClipCount
+//   per clip, in name order (the table of contents):
+//     UINT   NameLength, char Name[NameLength]
+//     float  StartTime, EndTime
+//     UINT64 Offset, Size      range of the tracks in the file
+//     BoneTransform FallbackPose[BoneCount]
+//   per clip, at its Offset:
+//     per bone: UINT KeyCount, UINT Classes (translation | rotation << 8 | scale << 16),
+//               BoneTransform ConstantTransform, Keyframe Keys[KeyCount]
+//
+// A BoneTransform is stored as its rotation, translation and scale, and a
+// Keyframe as its time, translation, scale and rotation, all as floats.
+
+namespace
+{
+	const char ArchiveMagic[4] = { 'M', '3', 'D', 'A' };
+	const UINT ArchiveVersion = 1;
+
+	const UINT64 BoneTransformBytes = 10 * sizeof(float);
+	const UINT64 KeyframeBytes = 11 * sizeof(float);
+
+	template<typename T>
+	void WriteValue(std::ofstream& fout, const T& value)
+	{
+		fout.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	bool ReadValue(std::ifstream& fin, T& value)
+	{
+		return (bool)fin.read(reinterpret_cast<char*>(&value), sizeof(T));
+	}
+
+	void WriteBoneTransform(std::ofstream& fout, const BoneTransform& transform)
+	{
+		WriteValue(fout, transform.Rotation);
+		WriteValue(fout, transform.Translation);
+		WriteValue(fout, transform.Scale);
+	}
+
+	bool ReadBoneTransform(std::ifstream& fin, BoneTransform& transform)
+	{
+		return ReadValue(fin, transform.Rotation) && ReadValue(fin, transform.Translation) &&
+			ReadValue(fin, transform.Scale);
+	}
+
+	// Bytes of the tracks of clip in the file.
+	UINT64 GetTracksSize(const AnimationClip& clip)
+	{
+		UINT64 size = 0;
+		for (const BoneAnimation& track : clip.BoneAnimations)
+		{
+			size += 2 * sizeof(UINT) + BoneTransformBytes + track.Keyframes.size() * KeyframeBytes;
+		}
+		return size;
+	}
+
+	size_t GetResidentSize(UINT boneCount, UINT64 tracksSize)
+	{
+		// The keys dominate; count the containers once per track.
+		UINT64 keyBytes = tracksSize - boneCount * (2 * sizeof(UINT) + BoneTransformBytes);
+		return sizeof(AnimationClip) + boneCount * sizeof(BoneAnimation) +
+			(size_t)(keyBytes / KeyframeBytes) * sizeof(Keyframe);
+	}
+}
+
+AnimationArchive::~AnimationArchive()
+{
+	Close();
+}
+
+bool AnimationArchive::Write(const std::string& filename, const Model& model)
+{
+	UINT boneCount = model.BoneCount();
+	UINT clipCount = model.ClipCount();
+	for (ClipId clip = 0; clip < clipCount; ++clip)
+	{
+		if (model.GetClip(clip).BoneAnimations.size() != boneCount)
+		{
+			return false;
+		}
+	}
+
+	std::ofstream fout(filename, std::ios::binary);
+	if (!fout)
+	{
+		return false;
+	}
+
+	// The tracks follow the table of contents, whose size is known up front.
+	UINT64 offset = sizeof(ArchiveMagic) + 3 * sizeof(UINT);
+	for (ClipId clip = 0; clip < clipCount; ++clip)
+	{
+		offset += sizeof(UINT) + model.GetClipName(clip).size() + 2 * sizeof(float) + 2 * sizeof(UINT64) +
+			boneCount * BoneTransformBytes;
+	}
+
+	fout.write(ArchiveMagic, sizeof(ArchiveMagic));
+	WriteValue(fout, ArchiveVersion);
+	WriteValue(fout, boneCount);
+	WriteValue(fout, clipCount);
+
+	std::vector<BoneTransform> pose(boneCount);
+	for (ClipId clip = 0; clip < clipCount; ++clip)
+	{
+		const std::string& name = model.GetClipName(clip);
+		const AnimationClip& animation = model.GetClip(clip);
+		UINT64 size = GetTracksSize(animation);
+
+		WriteValue(fout, (UINT)name.size());
+		fout.write(name.data(), name.size());
+		WriteValue(fout, model.GetClipStartTime(clip));
+		WriteValue(fout, model.GetClipEndTime(clip));
+		WriteValue(fout, offset);
+		WriteValue(fout, size);
+
+		animation.Interpolate(model.GetClipStartTime(clip), pose);
+		for (const BoneTransform& transform : pose)
+		{
+			WriteBoneTransform(fout, transform);
+		}
+		offset += size;
+	}
+
+	for (ClipId clip = 0; clip < clipCount; ++clip)
+	{
+		for (const BoneAnimation& track : model.GetClip(clip).BoneAnimations)
+		{
+			WriteValue(fout, (UINT)track.Keyframes.size());
+			WriteValue(fout, (UINT)(track.TranslationClass | track.RotationClass << 8 | track.ScaleClass << 16));
+			WriteBoneTransform(fout, track.ConstantTransform);
+			for (const Keyframe& key : track.Keyframes)
+			{
+				WriteValue(fout, key.Time);
+				WriteValue(fout, key.Translation);
+				WriteValue(fout, key.Scale);
+				WriteValue(fout, key.RotationQuat);
+			}
+		}
+	}
+
+	return (bool)fout;
+}
+
+bool AnimationArchive::Open(const std::string& filename, const Model& model)
+{
+	Close();
+
+	mFile.open(filename, std::ios::binary);
+	char magic[sizeof(ArchiveMagic)];
+	UINT version = 0;
+	UINT clipCount = 0;
+	if (!mFile || !mFile.read(magic, sizeof(magic)) || memcmp(magic, ArchiveMagic, sizeof(magic)) != 0 ||
+		!ReadValue(mFile, version) || version != ArchiveVersion ||
+		!ReadValue(mFile, mBoneCount) || mBoneCount != model.BoneCount() ||
+		!ReadValue(mFile, clipCount))
+	{
+		Close();
+		return false;
+	}
+
+	mEntries.resize(clipCount);
+	for (ClipId clip = 0; clip < clipCount; ++clip)
+	{
+		Entry& entry = mEntries[clip];
+		UINT nameLength = 0;
+		bool valid = ReadValue(mFile, nameLength);
+		if (valid)
+		{
+			entry.Name.resize(nameLength);
+			valid = nameLength == 0 || mFile.read(&entry.Name[0], nameLength);
+		}
+		valid = valid && ReadValue(mFile, entry.StartTime) && ReadValue(mFile, entry.EndTime) &&
+			ReadValue(mFile, entry.Offset) && ReadValue(mFile, entry.Size);
+
+		entry.FallbackPose.resize(mBoneCount);
+		for (UINT i = 0; valid && i < mBoneCount; ++i)
+		{
+			valid = ReadBoneTransform(mFile, entry.FallbackPose[i]);
+		}
+		if (!valid)
+		{
+			Close();
+			return false;
+		}
+
+		entry.SizeInBytes = GetResidentSize(mBoneCount, entry.Size);
+		mClipIds[entry.Name] = clip;
+	}
+
+	mModel = &model;
+	mStop = false;
+	mLoader = std::thread(&AnimationArchive::LoaderMain, this);
+	return true;
+}
+
+void AnimationArchive::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	if (mLoader.joinable())
+	{
+		mLoader.join();
+	}
+
+	mFile.close();
+	mFile.clear();
+	mModel = nullptr;
+	mBoneCount = 0;
+	mEntries.clear();
+	mClipIds.clear();
+	mQueue.clear();
+	mLoading = false;
+	mMostRecent = InvalidEntry;
+	mLeastRecent = InvalidEntry;
+	mResidentBytes = 0;
+	mLoaded.notify_all();
+}
+
+ClipId AnimationArchive::FindClip(const std::string& clipName)const
+{
+	auto it = mClipIds.find(clipName);
+	return it != mClipIds.end() ? it->second : InvalidClipId;
+}
+
+UINT AnimationArchive::ClipCount()const
+{
+	return (UINT)mEntries.size();
+}
+
+const std::string& AnimationArchive::GetClipName(ClipId clip)const
+{
+	return mEntries[clip].Name;
+}
+
+float AnimationArchive::GetClipStartTime(ClipId clip)const
+{
+	return mEntries[clip].StartTime;
+}
+
+float AnimationArchive::GetClipEndTime(ClipId clip)const
+{
+	return mEntries[clip].EndTime;
+}
+
+const std::vector<BoneTransform>& AnimationArchive::GetFallbackPose(ClipId clip)const
+{
+	return mEntries[clip].FallbackPose;
+}
+
+size_t AnimationArchive::GetClipSizeInBytes(ClipId clip)const
+{
+	return mEntries[clip].SizeInBytes;
+}
+
+std::shared_ptr<const AnimationClip> AnimationArchive::RequestClip(ClipId clip)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	Entry& entry = mEntries[clip];
+	if (entry.State == ClipResident)
+	{
+		Unlink(clip);
+		PushFront(clip);
+		return entry.Clip;
+	}
+
+	if (entry.State == ClipUnloaded)
+	{
+		entry.State = ClipQueued;
+		mQueue.push_back(clip);
+		mWake.notify_one();
+	}
+	return nullptr;
+}
+
+bool AnimationArchive::IsResident(ClipId clip)const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEntries[clip].State == ClipResident;
+}
+
+void AnimationArchive::WaitForLoads()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mLoaded.wait(lock, [this]() { return (mQueue.empty() && !mLoading) || mStop; });
+}
+
+bool AnimationArchive::GetFinalTransforms(ClipId clip, float timePos, XMFLOAT3X4* finalTransforms,
+	AnimationSampler& sampler)
+{
+	std::shared_ptr<const AnimationClip> animation = RequestClip(clip);
+	if (animation != nullptr)
+	{
+		mModel->GetFinalTransforms(*animation, timePos, finalTransforms, sampler);
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mFallbackEvaluations;
+	}
+	mModel->GetFinalTransforms(mEntries[clip].FallbackPose, finalTransforms, sampler);
+	return false;
+}
+
+void AnimationArchive::SetMemoryBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMemoryBudget = bytes;
+	EvictOverBudget(InvalidEntry);
+}
+
+size_t AnimationArchive::MemoryBudget()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMemoryBudget;
+}
+
+size_t AnimationArchive::ResidentBytes()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mResidentBytes;
+}
+
+UINT64 AnimationArchive::Loads()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mLoads;
+}
+
+UINT64 AnimationArchive::Evictions()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEvictions;
+}
+
+UINT64 AnimationArchive::FallbackEvaluations()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mFallbackEvaluations;
+}
+
+void AnimationArchive::ResetCounters()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mLoads = 0;
+	mEvictions = 0;
+	mFallbackEvaluations = 0;
+}
+
+void AnimationArchive::LoaderMain()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		mWake.wait(lock, [this]() { return !mQueue.empty() || mStop; });
+		if (mStop)
+		{
+			return;
+		}
+
+		// Oldest request first.
+		ClipId clip = mQueue.front();
+		mQueue.erase(mQueue.begin());
+		mLoading = true;
+
+		// Read outside the lock so requests and evaluations go on meanwhile.
+		// The table of contents does not change while the thread runs.
+		lock.unlock();
+		std::shared_ptr<AnimationClip> animation = ReadClip(mEntries[clip]);
+		lock.lock();
+
+		Entry& entry = mEntries[clip];
+		mLoading = false;
+		if (animation == nullptr)
+		{
+			// Leave it unloaded; the next request tries again.
+			entry.State = ClipUnloaded;
+		}
+		else
+		{
+			entry.Clip = animation;
+			entry.State = ClipResident;
+			mResidentBytes += entry.SizeInBytes;
+			++mLoads;
+			PushFront(clip);
+			EvictOverBudget(clip);
+		}
+		mLoaded.notify_all();
+	}
+}
+
+std::shared_ptr<AnimationClip> AnimationArchive::ReadClip(const Entry& entry)
+{
+	mFile.clear();
+	if (!mFile.seekg(entry.Offset))
+	{
+		return nullptr;
+	}
+
+	auto clip = std::make_shared<AnimationClip>();
+	clip->BoneAnimations.resize(mBoneCount);
+	for (BoneAnimation& track : clip->BoneAnimations)
+	{
+		UINT keyCount = 0;
+		UINT classes = 0;
+		if (!ReadValue(mFile, keyCount) || !ReadValue(mFile, classes) ||
+			!ReadBoneTransform(mFile, track.ConstantTransform))
+		{
+			return nullptr;
+		}
+		track.TranslationClass = (AnimationChannelClass)(classes & 0xff);
+		track.RotationClass = (AnimationChannelClass)(classes >> 8 & 0xff);
+		track.ScaleClass = (AnimationChannelClass)(classes >> 16 & 0xff);
+
+		track.Keyframes.resize(keyCount);
+		for (Keyframe& key : track.Keyframes)
+		{
+			if (!ReadValue(mFile, key.Time) || !ReadValue(mFile, key.Translation) ||
+				!ReadValue(mFile, key.Scale) || !ReadValue(mFile, key.RotationQuat))
+			{
+				return nullptr;
+			}
+		}
+
+		AnimationChannelReport& report = clip->Channels;
+		AnimationChannelClass channels[3] = { track.TranslationClass, track.RotationClass, track.ScaleClass };
+		for (AnimationChannelClass channel : channels)
+		{
+			report.AnimatedChannels += channel == AnimationChannelAnimated;
+			report.ConstantChannels += channel == AnimationChannelConstant;
+			report.IdentityChannels += channel == AnimationChannelIdentity;
+		}
+		report.ConstantTracks += track.TranslationClass != AnimationChannelAnimated &&
+			track.RotationClass != AnimationChannelAnimated && track.ScaleClass != AnimationChannelAnimated;
+	}
+	return clip;
+}
+
+void AnimationArchive::EvictOverBudget(ClipId keep)
+{
+	if (mMemoryBudget == 0)
+	{
+		return;
+	}
+
+	UINT entry = mLeastRecent;
+	while (mResidentBytes > mMemoryBudget && entry != InvalidEntry)
+	{
+		UINT previous = mEntries[entry].Previous;
+		if (entry != keep)
+		{
+			Entry& e = mEntries[entry];
+			Unlink(entry);
+			e.Clip = nullptr;
+			e.State = ClipUnloaded;
+			mResidentBytes -= e.SizeInBytes;
+			++mEvictions;
+		}
+		entry = previous;
+	}
+}
+
+void AnimationArchive::Unlink(UINT entry)
+{
+	Entry& e = mEntries[entry];
+	if (e.Previous != InvalidEntry)
+	{
+		mEntries[e.Previous].Next = e.Next;
+	}
+	else
+	{
+		mMostRecent = e.Next;
+	}
+	if (e.Next != InvalidEntry)
+	{
+		mEntries[e.Next].Previous = e.Previous;
+	}
+	else
+	{
+		mLeastRecent = e.Previous;
+	}
+	e.Previous = InvalidEntry;
+	e.Next = InvalidEntry;
+}
+
+void AnimationArchive::PushFront(UINT entry)
+{
+	Entry& e = mEntries[entry];
+	e.Previous = InvalidEntry;
+	e.Next = mMostRecent;
+	if (mMostRecent != InvalidEntry)
+	{
+		mEntries[mMostRecent].Previous = entry;
+	}
+	else
+	{
+		mLeastRecent = entry;
+	}
+	mMostRecent = entry;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include "Model.h"
+
+///<summary>
+/// The animation clips of a Model packed into one binary file (see Write)
+/// and loaded on demand, so large animation libraries need not be resident.
+/// Open reads only the table of contents: the name, times, file range and
+/// fallback pose of every clip. RequestClip returns a resident clip, or
+/// queues it for the loader thread and returns null; until it arrives,
+/// GetFinalTransforms evaluates the fallback pose, the first frame of the
+/// clip, which costs no sampling. When the resident clips exceed the memory
+/// budget the least recently requested ones are evicted. Evicted clips stay
+/// alive while a caller still holds them. Safe to use from several threads.
+///
+/// Clip ids are indices into the archive, in name order like Model clip ids,
+/// and only refer to the archive.
+///</summary>
+class AnimationArchive
+{
+public:
+	AnimationArchive() = default;
+	~AnimationArchive();
+	AnimationArchive(const AnimationArchive& rhs) = delete;
+	AnimationArchive& operator=(const AnimationArchive& rhs) = delete;
+
+	// Writes the keyframe tracks of every clip of model, which must not have
+	// been packed, resampled or compressed at load time.
+	static bool Write(const std::string& filename, const Model& model);
+
+	// Reads the table of contents and starts the loader thread. model must
+	// have the skeleton the archive was written for.
+	bool Open(const std::string& filename, const Model& model);
+	// Stops the loader thread and drops every resident clip.
+	void Close();
+
+	// Returns InvalidClipId if the archive has no clip with that name.
+	ClipId FindClip(const std::string& clipName)const;
+	UINT ClipCount()const;
+	const std::string& GetClipName(ClipId clip)const;
+	float GetClipStartTime(ClipId clip)const;
+	float GetClipEndTime(ClipId clip)const;
+	// Bone-to-parent transforms of the first frame of the clip.
+	const std::vector<BoneTransform>& GetFallbackPose(ClipId clip)const;
+	// Memory the clip takes once resident.
+	size_t GetClipSizeInBytes(ClipId clip)const;
+
+	// Marks clip as the most recently used. Returns it if resident,
+	// otherwise queues it for loading and returns null.
+	std::shared_ptr<const AnimationClip> RequestClip(ClipId clip);
+	bool IsResident(ClipId clip)const;
+	// Blocks until the queue of the loader thread is empty.
+	void WaitForLoads();
+
+	// Same as Model::GetFinalTransforms for a clip of the archive. Uses the
+	// fallback pose while the clip is not resident; returns whether the clip
+	// itself was evaluated.
+	bool GetFinalTransforms(ClipId clip, float timePos, DirectX::XMFLOAT3X4* finalTransforms,
+		AnimationSampler& sampler);
+
+	// 0 keeps every loaded clip. A clip larger than the budget is still
+	// loaded, and evicted as soon as another one arrives.
+	void SetMemoryBudget(size_t bytes);
+	size_t MemoryBudget()const;
+	size_t ResidentBytes()const;
+
+	UINT64 Loads()const;
+	UINT64 Evictions()const;
+	// GetFinalTransforms calls that used the fallback pose.
+	UINT64 FallbackEvaluations()const;
+	void ResetCounters();
+
+private:
+	static const UINT InvalidEntry = 0xffffffff;
+
+	enum ClipState
+	{
+		ClipUnloaded = 0,
+		ClipQueued,
+		ClipResident
+	};
+
+	struct Entry
+	{
+		std::string Name;
+		float StartTime = 0.0f;
+		float EndTime = 0.0f;
+		// Range of the tracks in the file.
+		UINT64 Offset = 0;
+		UINT64 Size = 0;
+		size_t SizeInBytes = 0;
+		std::vector<BoneTransform> FallbackPose;
+
+		ClipState State = ClipUnloaded;
+		std::shared_ptr<const AnimationClip> Clip;
+		// Neighbours in the LRU list of resident clips, most recent first.
+		UINT Previous = InvalidEntry;
+		UINT Next = InvalidEntry;
+	};
+
+	void LoaderMain();
+	std::shared_ptr<AnimationClip> ReadClip(const Entry& entry);
+	void EvictOverBudget(ClipId keep);
+	void Unlink(UINT entry);
+	void PushFront(UINT entry);
+
+	const Model* mModel = nullptr;
+	UINT mBoneCount = 0;
+	std::vector<Entry> mEntries;
+	std::unordered_map<std::string, ClipId> mClipIds;
+
+	// Only read by the loader thread once Open returns.
+	std::ifstream mFile;
+	std::thread mLoader;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mLoaded;
+	std::vector<ClipId> mQueue;
+	bool mLoading = false;
+	bool mStop = false;
+
+	UINT mMostRecent = InvalidEntry;
+	UINT mLeastRecent = InvalidEntry;
+	size_t mMemoryBudget = 0;
+	size_t mResidentBytes = 0;
+	UINT64 mLoads = 0;
+	UINT64 mEvictions = 0;
+	UINT64 mFallbackEvaluations = 0;
+};
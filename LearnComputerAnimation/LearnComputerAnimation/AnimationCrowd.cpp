@@ -0,0 +1,139 @@
+#include "AnimationCrowd.h"
+
+AnimationCrowd::AnimationCrowd(const Model& model)
+	: mModel(&model)
+{
+}
+
+void AnimationCrowd::Add(ClipId clip, float timePos)
+{
+	assert(clip < mModel->ClipCount());
+
+	// Append only; inserting in clip order would move the later instances on
+	// every call.
+	InstanceState instance;
+	instance.Clip = clip;
+	instance.TimePos = timePos;
+	instance.PaletteOffset = mPalette.Allocate(mModel->BoneCount());
+	mUnsorted = mUnsorted || (!mInstances.empty() && clip < mInstances.back().Clip);
+	mInstances.push_back(std::move(instance));
+}
+
+void AnimationCrowd::Clear()
+{
+	mInstances.clear();
+	mPalette.Clear();
+	mUnsorted = false;
+}
+
+void AnimationCrowd::SortInstances()
+{
+	if (!mUnsorted)
+	{
+		return;
+	}
+
+	std::stable_sort(mInstances.begin(), mInstances.end(),
+		[](const InstanceState& a, const InstanceState& b) { return a.Clip < b.Clip; });
+	// Palette offsets follow the instance order.
+	for (UINT i = 0; i < mInstances.size(); ++i)
+	{
+		mInstances[i].PaletteOffset = i * mModel->BoneCount();
+	}
+	mUnsorted = false;
+}
+
+void AnimationCrowd::SetBakedClip(const BakedClip* bakedClip, bool interpolate)
+{
+	assert(bakedClip->GetClip() < mModel->ClipCount());
+	assert(bakedClip->BoneCount() == mModel->BoneCount());
+
+	if (mBakedClips.size() < mModel->ClipCount())
+	{
+		mBakedClips.resize(mModel->ClipCount());
+	}
+	BakedClipBinding& binding = mBakedClips[bakedClip->GetClip()];
+	binding.Frames = bakedClip;
+	binding.Interpolate = interpolate;
+}
+
+void AnimationCrowd::ClearBakedClips()
+{
+	mBakedClips.clear();
+}
+
+void AnimationCrowd::Update(float dt)
+{
+	SortInstances();
+	UpdateRange(0, (UINT)mInstances.size(), dt);
+}
+
+void AnimationCrowd::Update(float dt, JobSystem& jobSystem)
+{
+	// Instances per job: enough to amortize scheduling, small enough to balance.
+	const size_t grainSize = 32;
+
+	SortInstances();
+	// Every instance only touches its own state and palette entries.
+	jobSystem.ParallelFor(mInstances.size(), grainSize, [this, dt](size_t begin, size_t end)
+	{
+		UpdateRange((UINT)begin, (UINT)end, dt);
+	});
+}
+
+void AnimationCrowd::UpdateRange(UINT begin, UINT end, float dt)
+{
+	for (UINT i = begin; i < end; ++i)
+	{
+		InstanceState& instance = mInstances[i];
+		instance.TimePos += dt;
+		// Loop
+		if (instance.TimePos > mModel->GetClipEndTime(instance.Clip))
+		{
+			instance.TimePos = 0.0f;
+		}
+	}
+
+	// Instances are grouped by clip, so each run of one clip is either
+	// sampled from its baked table or evaluated in one batch.
+	UINT runBegin = begin;
+	while (runBegin < end)
+	{
+		ClipId clip = mInstances[runBegin].Clip;
+		UINT runEnd = runBegin + 1;
+		while (runEnd < end && mInstances[runEnd].Clip == clip)
+		{
+			++runEnd;
+		}
+
+		if (clip < mBakedClips.size() && mBakedClips[clip].Frames != nullptr)
+		{
+			const BakedClipBinding& binding = mBakedClips[clip];
+			for (UINT i = runBegin; i < runEnd; ++i)
+			{
+				const InstanceState& instance = mInstances[i];
+				binding.Frames->Sample(instance.TimePos, &mPalette.Bones[instance.PaletteOffset], binding.Interpolate);
+			}
+		}
+		else
+		{
+			mModel->EvaluateMany(&mInstances[runBegin], runEnd - runBegin, mPalette.Bones);
+		}
+		runBegin = runEnd;
+	}
+}
+
+UINT AnimationCrowd::InstanceCount()const
+{
+	return (UINT)mInstances.size();
+}
+
+const InstanceState& AnimationCrowd::GetInstance(UINT index)const
+{
+	return mInstances[index];
+}
+
+const BonePalette& AnimationCrowd::GetPalette()const
+{
+	return mPalette;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "Model.h"
+#include "BonePalette.h"
+#include "BakedClip.h"
+#include "../Common/JobSystem.h"
+
+///<summary>
+/// A pool of animated instances sharing one Model. The instances are plain
+/// InstanceState entries in one array, updated together by
+/// Model::EvaluateMany, and their final transforms land back to back in one
+/// BonePalette, ready for the structured-buffer skinning path. Instances of
+/// a clip with a BakedClip sample the baked table instead.
+///</summary>
+class AnimationCrowd
+{
+public:
+	explicit AnimationCrowd(const Model& model);
+
+	// Adds an instance playing clip from timePos. The instances are grouped
+	// by clip once, on the next Update, keeping the order in which instances
+	// of the same clip were added; indices and palette offsets follow that order.
+	void Add(ClipId clip, float timePos);
+	void Clear();
+
+	// Instances playing bakedClip->GetClip() sample bakedClip from now on,
+	// interpolating between its frames or copying the nearest one. bakedClip
+	// must outlive the crowd or ClearBakedClips.
+	void SetBakedClip(const BakedClip* bakedClip, bool interpolate);
+	void ClearBakedClips();
+
+	// Advances every instance by dt, looping at the end of its clip, and
+	// writes all the final transforms to the palette.
+	void Update(float dt);
+	// Same, with the instances split into batches across the job system.
+	void Update(float dt, JobSystem& jobSystem);
+
+	UINT InstanceCount()const;
+	const InstanceState& GetInstance(UINT index)const;
+	const BonePalette& GetPalette()const;
+
+private:
+	struct BakedClipBinding
+	{
+		const BakedClip* Frames = nullptr;
+		bool Interpolate = true;
+	};
+
+	void SortInstances();
+	void UpdateRange(UINT begin, UINT end, float dt);
+
+	const Model* mModel = nullptr;
+	std::vector<InstanceState> mInstances;
+	// Instances were added since the last Update and may not be grouped by clip.
+	bool mUnsorted = false;
+	BonePalette mPalette;
+	// Indexed by ClipId; Frames is null, or the clip past the end, for clips
+	// that are evaluated.
+	std::vector<BakedClipBinding> mBakedClips;
+};
@@ -0,0 +1,25 @@
+#include "AnimationLod.h"
+
+AnimationLod SelectAnimationLod(const AnimationLodSettings& settings, float distance, float importance, bool visible)
+{
+	if (!visible)
+	{
+		return AnimationLodQuarter;
+	}
+
+	float scaledDistance = distance / max(importance, 0.01f);
+	if (scaledDistance < settings.HalfRateDistance)
+	{
+		return AnimationLodFull;
+	}
+	if (scaledDistance < settings.QuarterRateDistance)
+	{
+		return AnimationLodHalf;
+	}
+	return AnimationLodQuarter;
+}
+
+UINT GetAnimationLodInterval(AnimationLod lod)
+{
+	return 1u << (UINT)lod;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+
+// How often an instance samples its clip. Between updates the instance holds
+// or interpolates its last palette, see ModelInstance::UpdateSkinnedAnimation.
+enum AnimationLod
+{
+	AnimationLodFull = 0,	// every frame
+	AnimationLodHalf,		// every 2nd frame
+	AnimationLodQuarter,	// every 4th frame
+	AnimationLodCount
+};
+
+struct AnimationLodSettings
+{
+	// Instances closer than HalfRateDistance update at full rate, closer than
+	// QuarterRateDistance at half rate, and the others at quarter rate.
+	float HalfRateDistance = 20.0f;
+	float QuarterRateDistance = 50.0f;
+};
+
+// Per-frame counters of the LOD updates, reset by the caller every frame.
+struct AnimationLodStats
+{
+	UINT Evaluations = 0;
+	// Updates that reused a palette instead of sampling the clip.
+	UINT SavedEvaluations = 0;
+};
+
+// importance in (0, 1] shrinks the distance of characters that matter more
+// (1 for the player); off-screen instances always get the quarter rate.
+AnimationLod SelectAnimationLod(const AnimationLodSettings& settings, float distance, float importance, bool visible);
+
+// Frames between two evaluations: 1, 2 or 4.
+UINT GetAnimationLodInterval(AnimationLod lod);
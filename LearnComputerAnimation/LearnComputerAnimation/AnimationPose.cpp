@@ -0,0 +1,141 @@
+#include "AnimationPose.h"
+
+using namespace DirectX;
+
+void BoneTransform::Set(FXMVECTOR S, FXMVECTOR Q, FXMVECTOR P)
+{
+	XMStoreFloat3(&Scale, S);
+	XMStoreFloat4(&Rotation, XMQuaternionNormalize(Q));
+	XMStoreFloat3(&Translation, P);
+}
+
+XMMATRIX BoneTransform::ToMatrix()const
+{
+	// Row vectors: scaling the rows of the rotation applies the scale first.
+	XMVECTOR S = XMLoadFloat3(&Scale);
+	XMMATRIX M = XMMatrixRotationQuaternion(XMLoadFloat4(&Rotation));
+	M.r[0] = XMVectorMultiply(M.r[0], XMVectorSplatX(S));
+	M.r[1] = XMVectorMultiply(M.r[1], XMVectorSplatY(S));
+	M.r[2] = XMVectorMultiply(M.r[2], XMVectorSplatZ(S));
+	M.r[3] = XMVectorSetW(XMLoadFloat3(&Translation), 1.0f);
+	return M;
+}
+
+BoneTransform BoneTransform::Concatenate(const BoneTransform& parentToRoot)const
+{
+	XMVECTOR parentS = XMLoadFloat3(&parentToRoot.Scale);
+	XMVECTOR parentQ = XMLoadFloat4(&parentToRoot.Rotation);
+	XMVECTOR parentP = XMLoadFloat3(&parentToRoot.Translation);
+
+	XMVECTOR S = XMVectorMultiply(XMLoadFloat3(&Scale), parentS);
+	// Rotation by this transform first, then by the parent.
+	XMVECTOR Q = XMQuaternionMultiply(XMLoadFloat4(&Rotation), parentQ);
+	XMVECTOR P = XMVectorAdd(XMVector3Rotate(XMVectorMultiply(XMLoadFloat3(&Translation), parentS), parentQ), parentP);
+
+	BoneTransform result;
+	result.Set(S, Q, P);
+	return result;
+}
+
+void BoneTransform::ToDualQuaternion(XMFLOAT4& real, XMFLOAT4& dual)const
+{
+	XMVECTOR Q = XMLoadFloat4(&Rotation);
+	// Pure quaternion (t, 0); XMQuaternionMultiply(Q, T) is the product T * Q.
+	XMVECTOR T = XMVectorSetW(XMLoadFloat3(&Translation), 0.0f);
+
+	XMStoreFloat4(&real, Q);
+	XMStoreFloat4(&dual, XMVectorScale(XMQuaternionMultiply(Q, T), 0.5f));
+}
+
+bool BoneSet::Contains(UINT bone)const
+{
+	return bone / 64 < Bits.size() && (Bits[bone / 64] >> (bone % 64) & 1) != 0;
+}
+
+bool BoneSet::ContainsAny(UINT firstBone, UINT count)const
+{
+	for (UINT bone = firstBone; bone < firstBone + count; ++bone)
+	{
+		if (Contains(bone))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void BoneSet::Insert(UINT bone)
+{
+	if (Contains(bone))
+	{
+		return;
+	}
+	if (bone / 64 >= Bits.size())
+	{
+		Bits.resize(bone / 64 + 1, 0);
+	}
+	Bits[bone / 64] |= (UINT64)1 << (bone % 64);
+	Bones.insert(std::upper_bound(Bones.begin(), Bones.end(), bone), bone);
+}
+
+void BlendPoses(const std::vector<BoneTransform>* const* poses, const float* weights, UINT poseCount,
+	std::vector<BoneTransform>& result)
+{
+	assert(poseCount > 0);
+
+	XMVECTOR zero = XMVectorZero();
+	for (size_t i = 0; i < result.size(); ++i)
+	{
+		const BoneTransform& first = (*poses[0])[i];
+		XMVECTOR W = XMVectorReplicate(weights[0]);
+		XMVECTOR firstQ = XMLoadFloat4(&first.Rotation);
+		XMVECTOR Q = XMVectorMultiply(firstQ, W);
+		XMVECTOR P = XMVectorMultiply(XMLoadFloat3(&first.Translation), W);
+		XMVECTOR S = XMVectorMultiply(XMLoadFloat3(&first.Scale), W);
+
+		for (UINT n = 1; n < poseCount; ++n)
+		{
+			const BoneTransform& transform = (*poses[n])[i];
+			W = XMVectorReplicate(weights[n]);
+			XMVECTOR q = XMLoadFloat4(&transform.Rotation);
+			XMVECTOR opposite = XMVectorLess(XMVector4Dot(firstQ, q), zero);
+			q = XMVectorSelect(q, XMVectorNegate(q), opposite);
+
+			Q = XMVectorMultiplyAdd(q, W, Q);
+			P = XMVectorMultiplyAdd(XMLoadFloat3(&transform.Translation), W, P);
+			S = XMVectorMultiplyAdd(XMLoadFloat3(&transform.Scale), W, S);
+		}
+
+		XMStoreFloat4(&result[i].Rotation, Q);
+		XMStoreFloat3(&result[i].Translation, P);
+		XMStoreFloat3(&result[i].Scale, S);
+	}
+}
+
+void NormalizePose(std::vector<BoneTransform>& pose)
+{
+	for (size_t i = 0; i < pose.size(); ++i)
+	{
+		XMStoreFloat4(&pose[i].Rotation, XMQuaternionNormalize(XMLoadFloat4(&pose[i].Rotation)));
+	}
+}
+
+void OverlayPose(const std::vector<BoneTransform>& pose, float weight, const BoneSet& bones,
+	std::vector<BoneTransform>& result)
+{
+	XMVECTOR W = XMVectorReplicate(weight);
+	XMVECTOR zero = XMVectorZero();
+	for (UINT i : bones.Bones)
+	{
+		XMVECTOR baseQ = XMLoadFloat4(&result[i].Rotation);
+		XMVECTOR q = XMLoadFloat4(&pose[i].Rotation);
+		XMVECTOR opposite = XMVectorLess(XMVector4Dot(baseQ, q), zero);
+		q = XMVectorSelect(q, XMVectorNegate(q), opposite);
+
+		XMStoreFloat4(&result[i].Rotation, XMVectorLerpV(baseQ, q, W));
+		XMStoreFloat3(&result[i].Translation,
+			XMVectorLerpV(XMLoadFloat3(&result[i].Translation), XMLoadFloat3(&pose[i].Translation), W));
+		XMStoreFloat3(&result[i].Scale,
+			XMVectorLerpV(XMLoadFloat3(&result[i].Scale), XMLoadFloat3(&pose[i].Scale), W));
+	}
+}
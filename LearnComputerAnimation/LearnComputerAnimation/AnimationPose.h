@@ -0,0 +1,76 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+
+///<summary>
+/// Transform of one bone kept as scale, rotation and translation rather than
+/// as a matrix, which makes poses cheap to blend and to concatenate. Applied
+/// to a point in that order, like
+/// XMMatrixAffineTransformation(Scale, zero, Rotation, Translation).
+///</summary>
+struct BoneTransform
+{
+	// Q is normalized: slerp falls back to lerp for close keys, and a quaternion
+	// that is not unit length would scale every child translation it rotates.
+	void Set(DirectX::FXMVECTOR S, DirectX::FXMVECTOR Q, DirectX::FXMVECTOR P);
+
+	DirectX::XMMATRIX ToMatrix()const;
+
+	// Returns this transform followed by parentToRoot, the TRS counterpart of
+	// toParent * parentToRoot. Scale is combined per axis, which is exact as
+	// long as the parent is scaled uniformly.
+	BoneTransform Concatenate(const BoneTransform& parentToRoot)const;
+
+	// Unit dual quaternion of the rigid part of the transform: real is the
+	// rotation, dual is 0.5 * translation * rotation. Scale is dropped.
+	void ToDualQuaternion(DirectX::XMFLOAT4& real, DirectX::XMFLOAT4& dual)const;
+
+	DirectX::XMFLOAT4 Rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+	DirectX::XMFLOAT3 Translation = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 Scale = { 1.0f, 1.0f, 1.0f };
+};
+
+///<summary>
+/// A set of bones of one skeleton, as a bitset for membership tests and as
+/// a sorted list for iterating; since parents have lower indices than their
+/// children, the list visits parents first.
+///</summary>
+struct BoneSet
+{
+	bool Contains(UINT bone)const;
+	// Any bone of [firstBone, firstBone + count) is in the set.
+	bool ContainsAny(UINT firstBone, UINT count)const;
+	void Insert(UINT bone);
+
+	std::vector<UINT64> Bits;
+	std::vector<UINT> Bones;
+};
+
+///<summary>
+/// Bone mask for partial evaluation and layering, such as the upper body or
+/// the arms only, built once per Model by Model::CreateBoneMask. A layer
+/// with a mask samples and blends only Bones; evaluating a pose through a
+/// mask also needs the ancestors of the masked bones to reach the root.
+///</summary>
+struct BoneMask
+{
+	// The masked bones.
+	BoneSet Bones;
+	// The masked bones and all their ancestors.
+	BoneSet Evaluated;
+};
+
+// Weighted sum of poseCount bone-to-parent poses, in one pass over the
+// bones with the sums kept in registers; the weights should add up to 1.
+// Translation and scale blend linearly. Rotations are summed after flipping
+// each into the hemisphere of the first pose, since q and -q are the same
+// rotation and the blend has to take the short way around, but are not
+// renormalized: BoneTransform::Concatenate does it when the hierarchy is
+// walked, so only a pose used as is needs NormalizePose (nlerp).
+void BlendPoses(const std::vector<BoneTransform>* const* poses, const float* weights, UINT poseCount,
+	std::vector<BoneTransform>& result);
+void NormalizePose(std::vector<BoneTransform>& pose);
+// Blends the bones of a masked layer over result by weight, with the same
+// hemisphere check; the rotations are not renormalized either.
+void OverlayPose(const std::vector<BoneTransform>& pose, float weight, const BoneSet& bones,
+	std::vector<BoneTransform>& result);
@@ -0,0 +1,92 @@
+#include "BakedClip.h"
+
+using namespace DirectX;
+
+size_t BakedClip::EstimateSizeInBytes(const Model& model, ClipId clip, float frameRate)
+{
+	float duration = model.GetClipEndTime(clip) - model.GetClipStartTime(clip);
+	return (size_t)GetFrameCount(duration, frameRate) * model.BoneCount() * sizeof(XMFLOAT3X4);
+}
+
+UINT BakedClip::GetFrameCount(float duration, float frameRate)
+{
+	assert(frameRate > 0.0f);
+	return (UINT)ceilf(max(duration, 0.0f) * frameRate) + 1;
+}
+
+void BakedClip::Bake(const Model& model, ClipId clip, float frameRate)
+{
+	mClip = clip;
+	mBoneCount = model.BoneCount();
+	mStartTime = model.GetClipStartTime(clip);
+	float duration = model.GetClipEndTime(clip) - mStartTime;
+	mFrameCount = GetFrameCount(duration, frameRate);
+	mFrameRate = mFrameCount > 1 ? (mFrameCount - 1) / duration : frameRate;
+
+	mFrames.resize((size_t)mFrameCount * mBoneCount);
+	std::vector<XMFLOAT3X4> finalTransforms(mBoneCount);
+	AnimationSampler sampler;
+	for (UINT frame = 0; frame < mFrameCount; ++frame)
+	{
+		// The last frame lands exactly on the end time.
+		float timePos = frame + 1 < mFrameCount ? mStartTime + frame / mFrameRate : mStartTime + duration;
+		model.GetFinalTransforms(clip, timePos, finalTransforms, sampler);
+		std::copy(finalTransforms.begin(), finalTransforms.end(), mFrames.begin() + (size_t)frame * mBoneCount);
+	}
+}
+
+void BakedClip::Sample(float timePos, XMFLOAT3X4* finalTransforms, bool interpolate)const
+{
+	assert(mFrameCount > 0);
+
+	float position = MathHelper::Clamp((timePos - mStartTime) * mFrameRate, 0.0f, (float)(mFrameCount - 1));
+	if (!interpolate)
+	{
+		const XMFLOAT3X4* row = &mFrames[(size_t)(position + 0.5f) * mBoneCount];
+		memcpy(finalTransforms, row, mBoneCount * sizeof(XMFLOAT3X4));
+		return;
+	}
+
+	UINT frame = min((UINT)position, mFrameCount - 1);
+	UINT nextFrame = min(frame + 1, mFrameCount - 1);
+	float lerpPercent = position - frame;
+	const XMFLOAT3X4* row0 = &mFrames[(size_t)frame * mBoneCount];
+	const XMFLOAT3X4* row1 = &mFrames[(size_t)nextFrame * mBoneCount];
+	for (UINT i = 0; i < mBoneCount; ++i)
+	{
+		// Linear blend of the matrices, as for the interpolated animation LOD;
+		// the frames are close enough that rotations barely shrink. The blend
+		// is per element, so the stored rows are blended without transposing.
+		for (UINT r = 0; r < 3; ++r)
+		{
+			XMVECTOR v0 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row0[i].m[r]));
+			XMVECTOR v1 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row1[i].m[r]));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(finalTransforms[i].m[r]), XMVectorLerp(v0, v1, lerpPercent));
+		}
+	}
+}
+
+ClipId BakedClip::GetClip()const
+{
+	return mClip;
+}
+
+UINT BakedClip::BoneCount()const
+{
+	return mBoneCount;
+}
+
+UINT BakedClip::FrameCount()const
+{
+	return mFrameCount;
+}
+
+float BakedClip::FrameRate()const
+{
+	return mFrameRate;
+}
+
+size_t BakedClip::SizeInBytes()const
+{
+	return mFrames.size() * sizeof(XMFLOAT3X4);
+}
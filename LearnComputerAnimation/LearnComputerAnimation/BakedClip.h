@@ -0,0 +1,44 @@
+#pragma once
+#include "Model.h"
+
+///<summary>
+/// A clip baked into a table of final transforms, one row of BoneCount()
+/// entries per frame, evaluated once through Model::GetFinalTransforms.
+/// Sampling is then a copy of the nearest row, or a lerp between the two
+/// rows around the time, with no keyframe lookup or hierarchy walk. Meant
+/// for background crowds, where memory is cheaper than CPU time; use
+/// EstimateSizeInBytes to decide which clips are worth baking.
+///</summary>
+class BakedClip
+{
+public:
+	// Size of the table Bake would build for clip at frameRate.
+	static size_t EstimateSizeInBytes(const Model& model, ClipId clip, float frameRate);
+
+	// The frames are spread evenly over the clip, so the first one is at its
+	// start time, the last one at its end time, and the actual rate is at
+	// least frameRate.
+	void Bake(const Model& model, ClipId clip, float frameRate);
+
+	// finalTransforms must hold BoneCount() entries, laid out as in
+	// Model::GetFinalTransforms. timePos is clamped to the clip.
+	void Sample(float timePos, DirectX::XMFLOAT3X4* finalTransforms, bool interpolate)const;
+
+	ClipId GetClip()const;
+	UINT BoneCount()const;
+	UINT FrameCount()const;
+	float FrameRate()const;
+	size_t SizeInBytes()const;
+
+private:
+	static UINT GetFrameCount(float duration, float frameRate);
+
+	ClipId mClip = InvalidClipId;
+	UINT mBoneCount = 0;
+	UINT mFrameCount = 0;
+	float mStartTime = 0.0f;
+	float mFrameRate = 0.0f;
+
+	// mFrameCount rows of mBoneCount final transforms.
+	std::vector<DirectX::XMFLOAT3X4> mFrames;
+};
@@ -0,0 +1,31 @@
+#include "BonePalette.h"
+
+using namespace DirectX;
+
+UINT BonePalette::Allocate(UINT boneCount)
+{
+	UINT offset = (UINT)Bones.size();
+	Bones.resize(offset + boneCount);
+	return offset;
+}
+
+void BonePalette::Clear()
+{
+	Bones.clear();
+}
+
+void BonePalette::Write(UINT offset, const std::vector<XMFLOAT3X4>& finalTransforms)
+{
+	assert(offset + finalTransforms.size() <= Bones.size());
+	std::copy(finalTransforms.begin(), finalTransforms.end(), Bones.begin() + offset);
+}
+
+UINT BonePalette::BoneCount()const
+{
+	return (UINT)Bones.size();
+}
+
+size_t BonePalette::SizeInBytes()const
+{
+	return Bones.size() * sizeof(XMFLOAT3X4);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+
+///<summary>
+/// The 3x4 final transforms (see Model::GetFinalTransforms) of every skinned
+/// instance packed into one array, uploaded once per frame as the structured
+/// buffer gBonePalette of Shaders/color.hlsl. Each instance owns BoneCount
+/// consecutive entries starting at the offset returned by Allocate, and the
+/// shader adds that offset to the bone indices of the vertices. Unlike
+/// SkinnedConstants there is no limit of 96 bones per skeleton.
+///</summary>
+struct BonePalette
+{
+	// Reserves boneCount consecutive entries and returns the offset of the
+	// first one. Allocations are never moved, so offsets stay valid until Clear.
+	UINT Allocate(UINT boneCount);
+	void Clear();
+
+	// Copies the final transforms of one instance to the entries allocated at
+	// offset; finalTransforms must fit in that allocation.
+	void Write(UINT offset, const std::vector<DirectX::XMFLOAT3X4>& finalTransforms);
+
+	UINT BoneCount()const;
+	size_t SizeInBytes()const;
+
+	std::vector<DirectX::XMFLOAT3X4> Bones;
+};
@@ -0,0 +1,600 @@
+#include "CompressedAnimationClip.h"
+#include "Model.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Bit rates tried by the encoder for a quantized component.
+	const UINT MaxBits = 16;
+	const UINT MinBits = 4;
+
+	// Range of the three smallest components of a unit quaternion.
+	const float SmallestThreeRange = 0.70710678f;
+
+	UINT KeyBits(CompressedAnimationClip::ChannelType type, UINT bits)
+	{
+		return type == CompressedAnimationClip::Rotation ? 2 + 3 * bits : 3 * bits;
+	}
+
+	UINT Quantize(float v, float minValue, float extent, UINT bits)
+	{
+		if (extent <= 0.0f)
+		{
+			return 0;
+		}
+
+		float unit = MathHelper::Clamp((v - minValue) / extent, 0.0f, 1.0f);
+		return (UINT)(unit * (float)((1u << bits) - 1) + 0.5f);
+	}
+
+	float Dequantize(UINT q, float minValue, float extent, UINT bits)
+	{
+		return minValue + extent * ((float)q / (float)((1u << bits) - 1));
+	}
+
+	void WriteBits(std::vector<uint32_t>& stream, UINT offset, UINT value, UINT bits)
+	{
+		for (UINT i = 0; i < bits; ++i, ++offset)
+		{
+			if (value & (1u << i))
+			{
+				stream[offset / 32] |= 1u << (offset % 32);
+			}
+		}
+	}
+
+	UINT ReadBits(const std::vector<uint32_t>& stream, UINT offset, UINT bits)
+	{
+		// The stream carries one padding word, so the second word always exists.
+		uint64_t window = (uint64_t)stream[offset / 32] | ((uint64_t)stream[offset / 32 + 1] << 32);
+		return (UINT)((window >> (offset % 32)) & ((1ull << bits) - 1));
+	}
+
+	void EncodeRotation(const XMFLOAT4& quat, UINT bits, UINT& largest, UINT q[3])
+	{
+		float c[4] = { quat.x, quat.y, quat.z, quat.w };
+
+		largest = 0;
+		for (UINT i = 1; i < 4; ++i)
+		{
+			if (fabsf(c[i]) > fabsf(c[largest]))
+			{
+				largest = i;
+			}
+		}
+
+		// q and -q are the same rotation; keep the dropped component positive.
+		float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+		for (UINT i = 0, j = 0; i < 4; ++i)
+		{
+			if (i != largest)
+			{
+				q[j++] = Quantize(sign * c[i], -SmallestThreeRange, 2.0f * SmallestThreeRange, bits);
+			}
+		}
+	}
+
+	XMFLOAT4 DecodeRotation(UINT largest, const UINT q[3], UINT bits)
+	{
+		float c[4];
+		float sumSq = 0.0f;
+		for (UINT i = 0, j = 0; i < 4; ++i)
+		{
+			if (i != largest)
+			{
+				c[i] = Dequantize(q[j++], -SmallestThreeRange, 2.0f * SmallestThreeRange, bits);
+				sumSq += c[i] * c[i];
+			}
+		}
+		c[largest] = sqrtf(max(0.0f, 1.0f - sumSq));
+
+		return XMFLOAT4(c[0], c[1], c[2], c[3]);
+	}
+
+	XMFLOAT4 GetChannel(const Keyframe& key, CompressedAnimationClip::ChannelType type)
+	{
+		switch (type)
+		{
+		case CompressedAnimationClip::Translation:
+			return XMFLOAT4(key.Translation.x, key.Translation.y, key.Translation.z, 0.0f);
+		case CompressedAnimationClip::Rotation:
+			return key.RotationQuat;
+		default:
+			return XMFLOAT4(key.Scale.x, key.Scale.y, key.Scale.z, 0.0f);
+		}
+	}
+
+	void SetChannel(Keyframe& key, CompressedAnimationClip::ChannelType type, const XMFLOAT4& v)
+	{
+		switch (type)
+		{
+		case CompressedAnimationClip::Translation:
+			key.Translation = XMFLOAT3(v.x, v.y, v.z);
+			break;
+		case CompressedAnimationClip::Rotation:
+			key.RotationQuat = v;
+			break;
+		default:
+			key.Scale = XMFLOAT3(v.x, v.y, v.z);
+			break;
+		}
+	}
+
+	// Computes the quantization range of a channel. Rotations always use the smallest-three range.
+	void ChannelRange(const BoneAnimation& track, CompressedAnimationClip::ChannelType type, XMFLOAT4& minValue, XMFLOAT4& extent)
+	{
+		XMFLOAT4 first = GetChannel(track.Keyframes[0], type);
+		XMVECTOR lo = XMLoadFloat4(&first);
+		XMVECTOR hi = lo;
+		for (const auto& key : track.Keyframes)
+		{
+			XMFLOAT4 value = GetChannel(key, type);
+			XMVECTOR v = XMLoadFloat4(&value);
+			lo = XMVectorMin(lo, v);
+			hi = XMVectorMax(hi, v);
+		}
+		XMStoreFloat4(&minValue, lo);
+		XMStoreFloat4(&extent, XMVectorSubtract(hi, lo));
+	}
+
+	bool IsConstant(const XMFLOAT4& extent)
+	{
+		return extent.x == 0.0f && extent.y == 0.0f && extent.z == 0.0f && extent.w == 0.0f;
+	}
+
+	// What the decoder returns for a key of a channel stored with the given bit rate.
+	XMFLOAT4 RoundTrip(const XMFLOAT4& v, CompressedAnimationClip::ChannelType type, UINT bits,
+		const XMFLOAT4& minValue, const XMFLOAT4& extent)
+	{
+		if (type == CompressedAnimationClip::Rotation)
+		{
+			UINT largest;
+			UINT q[3];
+			EncodeRotation(v, bits, largest, q);
+			return DecodeRotation(largest, q, bits);
+		}
+
+		return XMFLOAT4(
+			Dequantize(Quantize(v.x, minValue.x, extent.x, bits), minValue.x, extent.x, bits),
+			Dequantize(Quantize(v.y, minValue.y, extent.y, bits), minValue.y, extent.y, bits),
+			Dequantize(Quantize(v.z, minValue.z, extent.z, bits), minValue.z, extent.z, bits),
+			0.0f);
+	}
+
+	// Value a constant channel is stored with.
+	XMFLOAT4 ConstantValue(const BoneAnimation& track, CompressedAnimationClip::ChannelType type,
+		const XMFLOAT4& minValue, const XMFLOAT4& extent)
+	{
+		if (type == CompressedAnimationClip::Rotation)
+		{
+			XMFLOAT4 q;
+			XMStoreFloat4(&q, XMQuaternionNormalize(XMLoadFloat4(&track.Keyframes[0].RotationQuat)));
+			return q;
+		}
+
+		// The middle of the range halves the worst case error.
+		XMFLOAT4 v;
+		XMStoreFloat4(&v, XMVectorMultiplyAdd(XMLoadFloat4(&extent), XMVectorReplicate(0.5f), XMLoadFloat4(&minValue)));
+		return v;
+	}
+
+	void ApplyBits(const BoneAnimation& source, BoneAnimation& lossy, CompressedAnimationClip::ChannelType type, UINT bits,
+		const XMFLOAT4& minValue, const XMFLOAT4& extent)
+	{
+		XMFLOAT4 constant = ConstantValue(source, type, minValue, extent);
+		for (size_t k = 0; k < source.Keyframes.size(); ++k)
+		{
+			XMFLOAT4 v = bits == 0 ? constant : RoundTrip(GetChannel(source.Keyframes[k], type), type, bits, minValue, extent);
+			SetChannel(lossy.Keyframes[k], type, v);
+		}
+	}
+
+	///<summary>
+	/// Measures bone tip errors of a lossy copy of a clip against the source.
+	/// The tips of a bone are its origin and a point one bone length along
+	/// each of its local axes, so rotation errors on leaf bones count too.
+	///</summary>
+	class TipErrorMeter
+	{
+	public:
+		TipErrorMeter(const AnimationClip& clip, const std::vector<int>& boneHierarchy)
+			: mHierarchy(boneHierarchy)
+		{
+			mBoneCount = (UINT)clip.BoneAnimations.size();
+
+			for (const auto& track : clip.BoneAnimations)
+			{
+				for (const auto& key : track.Keyframes)
+				{
+					mTimes.push_back(key.Time);
+				}
+			}
+			std::sort(mTimes.begin(), mTimes.end());
+			mTimes.erase(std::unique(mTimes.begin(), mTimes.end()), mTimes.end());
+
+			// Also check halfway between keys, where interpolation error peaks.
+			size_t keyTimeCount = mTimes.size();
+			for (size_t i = 0; i + 1 < keyTimeCount; ++i)
+			{
+				mTimes.push_back(0.5f * (mTimes[i] + mTimes[i + 1]));
+			}
+
+			// Bone length: distance to the farthest child. Leaves borrow their parent's.
+			mTipLength.assign(mBoneCount, 0.0f);
+			for (UINT i = 1; i < mBoneCount; ++i)
+			{
+				const XMFLOAT3& p = clip.BoneAnimations[i].Keyframes[0].Translation;
+				float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+				mTipLength[mHierarchy[i]] = max(mTipLength[mHierarchy[i]], length);
+			}
+			for (UINT i = 1; i < mBoneCount; ++i)
+			{
+				if (mTipLength[i] == 0.0f)
+				{
+					mTipLength[i] = mTipLength[mHierarchy[i]];
+				}
+			}
+
+			// Bones are sorted so that parents come before their children.
+			mSubtrees.resize(mBoneCount);
+			std::vector<bool> inSubtree(mBoneCount);
+			for (UINT b = 0; b < mBoneCount; ++b)
+			{
+				std::fill(inSubtree.begin(), inSubtree.end(), false);
+				inSubtree[b] = true;
+				mSubtrees[b].push_back(b);
+				for (UINT i = b + 1; i < mBoneCount; ++i)
+				{
+					if (inSubtree[mHierarchy[i]])
+					{
+						inSubtree[i] = true;
+						mSubtrees[b].push_back(i);
+					}
+				}
+			}
+
+			mReference.resize(mTimes.size() * mBoneCount);
+			mCurrent.resize(mTimes.size() * mBoneCount);
+			mTrial.resize(mBoneCount);
+			EvaluateAll(clip.BoneAnimations, mReference);
+		}
+
+		void SetCurrent(const std::vector<BoneAnimation>& tracks)
+		{
+			EvaluateAll(tracks, mCurrent);
+		}
+
+		// Largest tip error in the subtree of bone when its track is replaced by
+		// trial. Stops early once the error exceeds budget.
+		float SubtreeError(const std::vector<BoneAnimation>& tracks, UINT bone, const BoneAnimation& trial, float budget)
+		{
+			float maxError = 0.0f;
+			for (size_t s = 0; s < mTimes.size() && maxError <= budget; ++s)
+			{
+				for (UINT i : mSubtrees[bone])
+				{
+					XMFLOAT4X4 local;
+					(i == bone ? trial : tracks[i]).Interpolate(mTimes[s], local);
+
+					XMMATRIX toRoot = XMLoadFloat4x4(&local);
+					if (i != 0)
+					{
+						int parent = mHierarchy[i];
+						const XMFLOAT4X4& parentToRoot = i == bone ? mCurrent[s * mBoneCount + parent] : mTrial[parent];
+						toRoot = XMMatrixMultiply(toRoot, XMLoadFloat4x4(&parentToRoot));
+					}
+					XMStoreFloat4x4(&mTrial[i], toRoot);
+
+					maxError = max(maxError, TipError(i, toRoot, XMLoadFloat4x4(&mReference[s * mBoneCount + i])));
+				}
+			}
+			return maxError;
+		}
+
+		// Largest tip error of a fully decoded pose sequence.
+		float Error(const CompressedAnimationClip& compressed)
+		{
+			std::vector<BoneTransform> local(mBoneCount);
+			float maxError = 0.0f;
+			for (size_t s = 0; s < mTimes.size(); ++s)
+			{
+				compressed.Interpolate(mTimes[s], local, nullptr);
+				for (UINT i = 0; i < mBoneCount; ++i)
+				{
+					XMMATRIX toRoot = local[i].ToMatrix();
+					if (i != 0)
+					{
+						toRoot = XMMatrixMultiply(toRoot, XMLoadFloat4x4(&mTrial[mHierarchy[i]]));
+					}
+					XMStoreFloat4x4(&mTrial[i], toRoot);
+
+					maxError = max(maxError, TipError(i, toRoot, XMLoadFloat4x4(&mReference[s * mBoneCount + i])));
+				}
+			}
+			return maxError;
+		}
+
+	private:
+		void EvaluateAll(const std::vector<BoneAnimation>& tracks, std::vector<XMFLOAT4X4>& toRoot)
+		{
+			for (size_t s = 0; s < mTimes.size(); ++s)
+			{
+				XMFLOAT4X4* pose = &toRoot[s * mBoneCount];
+				for (UINT i = 0; i < mBoneCount; ++i)
+				{
+					tracks[i].Interpolate(mTimes[s], pose[i]);
+					if (i != 0)
+					{
+						XMMATRIX m = XMMatrixMultiply(XMLoadFloat4x4(&pose[i]), XMLoadFloat4x4(&pose[mHierarchy[i]]));
+						XMStoreFloat4x4(&pose[i], m);
+					}
+				}
+			}
+		}
+
+		float TipError(UINT bone, CXMMATRIX lossy, CXMMATRIX reference)const
+		{
+			float length = mTipLength[bone];
+			XMVECTOR tips[4] =
+			{
+				XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+				XMVectorSet(length, 0.0f, 0.0f, 1.0f),
+				XMVectorSet(0.0f, length, 0.0f, 1.0f),
+				XMVectorSet(0.0f, 0.0f, length, 1.0f),
+			};
+
+			float maxError = 0.0f;
+			for (const XMVECTOR& tip : tips)
+			{
+				XMVECTOR d = XMVectorSubtract(XMVector3Transform(tip, lossy), XMVector3Transform(tip, reference));
+				maxError = max(maxError, XMVectorGetX(XMVector3Length(d)));
+			}
+			return maxError;
+		}
+
+		const std::vector<int>& mHierarchy;
+		UINT mBoneCount = 0;
+		std::vector<float> mTimes;
+		std::vector<float> mTipLength;
+		std::vector<std::vector<UINT>> mSubtrees;
+
+		// Root space transforms per sample and bone.
+		std::vector<XMFLOAT4X4> mReference;
+		std::vector<XMFLOAT4X4> mCurrent;
+		std::vector<XMFLOAT4X4> mTrial;
+	};
+}
+
+AnimationCompressionReport CompressedAnimationClip::Build(const AnimationClip& clip, const std::vector<int>& boneHierarchy,
+	float maxPositionError)
+{
+	const ChannelType channelOrder[ChannelCount] = { Rotation, Translation, Scale };
+
+	UINT boneCount = (UINT)clip.BoneAnimations.size();
+	StartTime = clip.GetClipStartTime();
+	EndTime = clip.GetClipEndTime();
+
+	Tracks.assign(boneCount, Track());
+	Times.clear();
+	Stream.clear();
+
+	TipErrorMeter meter(clip, boneHierarchy);
+
+	// Start from the highest bit rate, then lower each channel root first while
+	// the error of its subtree stays in budget.
+	std::vector<BoneAnimation> lossy = clip.BoneAnimations;
+	for (UINT i = 0; i < boneCount; ++i)
+	{
+		for (ChannelType type : channelOrder)
+		{
+			Channel& channel = Tracks[i].Channels[type];
+			ChannelRange(clip.BoneAnimations[i], type, channel.Min, channel.Extent);
+			channel.Bits = type != Rotation && IsConstant(channel.Extent) ? 0 : MaxBits;
+			ApplyBits(clip.BoneAnimations[i], lossy[i], type, channel.Bits, channel.Min, channel.Extent);
+		}
+	}
+	meter.SetCurrent(lossy);
+
+	for (UINT i = 0; i < boneCount; ++i)
+	{
+		for (ChannelType type : channelOrder)
+		{
+			Channel& channel = Tracks[i].Channels[type];
+			if (channel.Bits == 0)
+			{
+				continue;
+			}
+
+			BoneAnimation trial = lossy[i];
+
+			// A constant channel is the biggest win, so try it first.
+			ApplyBits(clip.BoneAnimations[i], trial, type, 0, channel.Min, channel.Extent);
+			if (meter.SubtreeError(lossy, i, trial, maxPositionError) <= maxPositionError)
+			{
+				channel.Bits = 0;
+				lossy[i] = trial;
+				continue;
+			}
+
+			for (UINT bits = channel.Bits - 1; bits >= MinBits; --bits)
+			{
+				ApplyBits(clip.BoneAnimations[i], trial, type, bits, channel.Min, channel.Extent);
+				if (meter.SubtreeError(lossy, i, trial, maxPositionError) > maxPositionError)
+				{
+					break;
+				}
+				channel.Bits = bits;
+			}
+			ApplyBits(clip.BoneAnimations[i], lossy[i], type, channel.Bits, channel.Min, channel.Extent);
+		}
+		meter.SetCurrent(lossy);
+	}
+
+	// Write the tracks out.
+	AnimationCompressionReport report;
+	UINT bitCount = 0;
+	for (UINT i = 0; i < boneCount; ++i)
+	{
+		const auto& keys = clip.BoneAnimations[i].Keyframes;
+		Track& track = Tracks[i];
+		track.KeyCount = (UINT)keys.size();
+		report.OriginalBytes += keys.size() * sizeof(Keyframe);
+
+		// Share the key times with an earlier track when they match.
+		track.TimeOffset = (UINT)Times.size();
+		for (UINT j = 0; j < i; ++j)
+		{
+			const auto& other = clip.BoneAnimations[j].Keyframes;
+			bool same = other.size() == keys.size();
+			for (size_t k = 0; same && k < keys.size(); ++k)
+			{
+				same = other[k].Time == keys[k].Time;
+			}
+			if (same)
+			{
+				track.TimeOffset = Tracks[j].TimeOffset;
+				break;
+			}
+		}
+		if (track.TimeOffset == (UINT)Times.size())
+		{
+			for (const auto& key : keys)
+			{
+				Times.push_back(key.Time);
+			}
+		}
+
+		for (UINT c = 0; c < ChannelCount; ++c)
+		{
+			Channel& channel = track.Channels[c];
+			if (channel.Bits == 0)
+			{
+				channel.Min = ConstantValue(clip.BoneAnimations[i], (ChannelType)c, channel.Min, channel.Extent);
+				channel.Extent = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+				report.ConstantChannels++;
+				continue;
+			}
+
+			channel.BitOffset = bitCount;
+			bitCount += track.KeyCount * KeyBits((ChannelType)c, channel.Bits);
+			report.AnimatedChannels++;
+		}
+	}
+
+	// One padding word so ReadBits can always read two words.
+	Stream.assign((bitCount + 31) / 32 + 1, 0);
+
+	for (UINT i = 0; i < boneCount; ++i)
+	{
+		const Track& track = Tracks[i];
+		for (UINT c = 0; c < ChannelCount; ++c)
+		{
+			const Channel& channel = track.Channels[c];
+			if (channel.Bits == 0)
+			{
+				continue;
+			}
+
+			UINT offset = channel.BitOffset;
+			for (const auto& key : clip.BoneAnimations[i].Keyframes)
+			{
+				XMFLOAT4 v = GetChannel(key, (ChannelType)c);
+				UINT q[3];
+				if (c == Rotation)
+				{
+					UINT largest;
+					EncodeRotation(v, channel.Bits, largest, q);
+					WriteBits(Stream, offset, largest, 2);
+					offset += 2;
+				}
+				else
+				{
+					q[0] = Quantize(v.x, channel.Min.x, channel.Extent.x, channel.Bits);
+					q[1] = Quantize(v.y, channel.Min.y, channel.Extent.y, channel.Bits);
+					q[2] = Quantize(v.z, channel.Min.z, channel.Extent.z, channel.Bits);
+				}
+				for (UINT j = 0; j < 3; ++j)
+				{
+					WriteBits(Stream, offset, q[j], channel.Bits);
+					offset += channel.Bits;
+				}
+			}
+		}
+	}
+
+	report.CompressedBytes = SizeInBytes();
+	report.CompressionRatio = (float)report.OriginalBytes / (float)report.CompressedBytes;
+	report.MaxPositionError = meter.Error(*this);
+
+	return report;
+}
+
+XMVECTOR CompressedAnimationClip::DecodeKey(const Channel& channel, ChannelType type, UINT key)const
+{
+	UINT offset = channel.BitOffset + key * KeyBits(type, channel.Bits);
+
+	if (type == Rotation)
+	{
+		UINT largest = ReadBits(Stream, offset, 2);
+		UINT q[3];
+		for (UINT j = 0; j < 3; ++j)
+		{
+			q[j] = ReadBits(Stream, offset + 2 + j * channel.Bits, channel.Bits);
+		}
+		XMFLOAT4 rotation = DecodeRotation(largest, q, channel.Bits);
+		return XMLoadFloat4(&rotation);
+	}
+
+	return XMVectorSet(
+		Dequantize(ReadBits(Stream, offset, channel.Bits), channel.Min.x, channel.Extent.x, channel.Bits),
+		Dequantize(ReadBits(Stream, offset + channel.Bits, channel.Bits), channel.Min.y, channel.Extent.y, channel.Bits),
+		Dequantize(ReadBits(Stream, offset + 2 * channel.Bits, channel.Bits), channel.Min.z, channel.Extent.z, channel.Bits),
+		0.0f);
+}
+
+void CompressedAnimationClip::Interpolate(float t, std::vector<BoneTransform>& pose, UINT* cursors,
+	const BoneSet* bones)const
+{
+	UINT count = bones != nullptr ? (UINT)bones->Bones.size() : (UINT)Tracks.size();
+	for (UINT n = 0; n < count; ++n)
+	{
+		UINT i = bones != nullptr ? bones->Bones[n] : n;
+		const Track& track = Tracks[i];
+
+		UINT k0, k1;
+		float lerpPercent;
+		FindKeyframePair(&Times[track.TimeOffset], 1, track.KeyCount, t,
+			cursors != nullptr ? &cursors[i] : nullptr, k0, k1, lerpPercent);
+
+		XMVECTOR v[ChannelCount];
+		for (UINT c = 0; c < ChannelCount; ++c)
+		{
+			const Channel& channel = track.Channels[c];
+			if (channel.Bits == 0)
+			{
+				v[c] = XMLoadFloat4(&channel.Min);
+				continue;
+			}
+
+			XMVECTOR v0 = DecodeKey(channel, (ChannelType)c, k0);
+			XMVECTOR v1 = DecodeKey(channel, (ChannelType)c, k1);
+			v[c] = c == Rotation ? XMQuaternionSlerp(v0, v1, lerpPercent) : XMVectorLerp(v0, v1, lerpPercent);
+		}
+
+		pose[i].Set(v[Scale], v[Rotation], v[Translation]);
+	}
+}
+
+UINT CompressedAnimationClip::TrackCount()const
+{
+	return (UINT)Tracks.size();
+}
+
+size_t CompressedAnimationClip::SizeInBytes()const
+{
+	return sizeof(CompressedAnimationClip) +
+		Times.size() * sizeof(float) +
+		Tracks.size() * sizeof(Track) +
+		Stream.size() * sizeof(uint32_t);
+}
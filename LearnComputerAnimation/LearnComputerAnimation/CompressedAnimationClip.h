@@ -0,0 +1,80 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+#include "AnimationPose.h"
+
+struct AnimationClip;
+
+struct AnimationCompressionReport
+{
+	// Size of the source keyframes (sizeof(Keyframe) per key) and of the compressed clip.
+	size_t OriginalBytes = 0;
+	size_t CompressedBytes = 0;
+	float CompressionRatio = 1.0f;
+	// Largest bone tip error of the compressed clip over all sampled times.
+	float MaxPositionError = 0.0f;
+	UINT ConstantChannels = 0;
+	UINT AnimatedChannels = 0;
+};
+
+///<summary>
+/// Lossy clip format. Every track has a translation, rotation and scale
+/// channel. A channel that never changes is stored once as floats; the
+/// others are quantized into a shared bit stream:
+///   - translation and scale against the [min, max] range of the track,
+///   - rotation with smallest-three packing: 2 bits for the index of the
+///     largest component, the other three in [-1/sqrt(2), 1/sqrt(2)].
+/// The bit rate of each channel is picked by Build so the error measured at
+/// the bone tips stays under the budget.
+///</summary>
+struct CompressedAnimationClip
+{
+	enum ChannelType
+	{
+		Translation = 0,
+		Rotation,
+		Scale,
+		ChannelCount
+	};
+
+	struct Channel
+	{
+		// Bits per quantized component; 0 means the channel is constant.
+		UINT Bits = 0;
+		// Bit offset of the first key in Stream.
+		UINT BitOffset = 0;
+		// The constant value, or the range minimum when quantized.
+		DirectX::XMFLOAT4 Min = { 0.0f, 0.0f, 0.0f, 0.0f };
+		DirectX::XMFLOAT4 Extent = { 0.0f, 0.0f, 0.0f, 0.0f };
+	};
+
+	struct Track
+	{
+		UINT TimeOffset = 0;
+		UINT KeyCount = 0;
+		Channel Channels[ChannelCount];
+	};
+
+	// boneHierarchy gives the parent of every bone (see Model::GetBoneHierarchy);
+	// maxPositionError is in model units.
+	AnimationCompressionReport Build(const AnimationClip& clip, const std::vector<int>& boneHierarchy,
+		float maxPositionError);
+
+	// With bones, only those tracks are sampled.
+	void Interpolate(float t, std::vector<BoneTransform>& pose, UINT* cursors,
+		const BoneSet* bones = nullptr)const;
+
+	UINT TrackCount()const;
+	size_t SizeInBytes()const;
+
+	float StartTime = 0.0f;
+	float EndTime = 0.0f;
+
+	// Key times, shared by all the tracks that use the same times.
+	std::vector<float> Times;
+	std::vector<Track> Tracks;
+	std::vector<uint32_t> Stream;
+
+private:
+	DirectX::XMVECTOR DecodeKey(const Channel& channel, ChannelType type, UINT key)const;
+};
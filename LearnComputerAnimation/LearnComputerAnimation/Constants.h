@@ -19,10 +19,15 @@ struct MaterialConstants
 	float Roughness;
 	DirectX::XMFLOAT4X4 MaterialTransform;
 };
-// 蒙皮网格缓冲区
+// 蒙皮网格缓冲区, 每个骨骼一个转置后的3x4仿射矩阵(省去恒为(0,0,0,1)的一列)
 struct SkinnedConstants
 {
-	DirectX::XMFLOAT4X4 BoneTransform[96];
+	DirectX::XMFLOAT3X4 BoneTransform[96];
+};
+// 对偶四元数蒙皮缓冲区, 每个骨骼两个float4(旋转, 对偶部分)
+struct SkinnedDualQuaternionConstants
+{
+	DirectX::XMFLOAT4 BoneDualQuaternion[96 * 2];
 };
 
 // 每个Pass的信息
@@ -0,0 +1,346 @@
+#include "CpuSkinning.h"
+
+// The AVX2 kernel is built into every x86 and x64 build and picked at run
+// time, so the projects need no /arch:AVX2 and still run on older CPUs.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SKINNING_AVX2_KERNEL
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles AVX2 intrinsics in any function.
+#define SKINNING_AVX2_TARGET
+#else
+// GCC and Clang only compile them in functions that target AVX2.
+#define SKINNING_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+using namespace DirectX;
+
+namespace
+{
+	void GetWeights(const SkinnedVertex& vertex, float weights[4])
+	{
+		weights[0] = vertex.BoneWeights.x;
+		weights[1] = vertex.BoneWeights.y;
+		weights[2] = vertex.BoneWeights.z;
+		weights[3] = 1.0f - weights[0] - weights[1] - weights[2];
+	}
+
+	// Weighted sum of the first InfluenceCount bones of vertex, the last one
+	// taking the implicit weight, as the three rows of a 3x4 palette entry
+	// (XMFLOAT3X4 stores the transpose of the bone transform).
+	template<UINT InfluenceCount>
+	inline void BlendBones(const SkinnedVertex& vertex, const XMFLOAT3X4* finalTransforms, XMVECTOR rows[3])
+	{
+		const float* storedWeights = &vertex.BoneWeights.x;
+		float weights[InfluenceCount];
+		weights[InfluenceCount - 1] = 1.0f;
+		for (UINT i = 0; i + 1 < InfluenceCount; ++i)
+		{
+			weights[i] = storedWeights[i];
+			weights[InfluenceCount - 1] -= storedWeights[i];
+		}
+
+		rows[0] = XMVectorZero();
+		rows[1] = XMVectorZero();
+		rows[2] = XMVectorZero();
+		for (UINT i = 0; i < InfluenceCount; ++i)
+		{
+			const XMFLOAT4* m = reinterpret_cast<const XMFLOAT4*>(&finalTransforms[vertex.BoneIndices[i]]);
+			XMVECTOR w = XMVectorReplicate(weights[i]);
+			rows[0] = XMVectorMultiplyAdd(w, XMLoadFloat4(&m[0]), rows[0]);
+			rows[1] = XMVectorMultiplyAdd(w, XMLoadFloat4(&m[1]), rows[1]);
+			rows[2] = XMVectorMultiplyAdd(w, XMLoadFloat4(&m[2]), rows[2]);
+		}
+	}
+
+	template<UINT InfluenceCount>
+	void SkinVertexRangeSse(const std::vector<SkinnedVertex>& vertices, const XMFLOAT3X4* finalTransforms,
+		SkinnedVertexStreams& streams, size_t begin, size_t end)
+	{
+		assert(end <= vertices.size() && end <= streams.Positions.size());
+
+		for (size_t v = begin; v < end; ++v)
+		{
+			const SkinnedVertex& vertex = vertices[v];
+
+			XMVECTOR rows[3];
+			BlendBones<InfluenceCount>(vertex, finalTransforms, rows);
+			// The fourth row only feeds the w of the results, which is dropped.
+			XMMATRIX M = XMMatrixTranspose(XMMATRIX(rows[0], rows[1], rows[2], XMVectorZero()));
+
+			XMStoreFloat3(&streams.Positions[v], XMVector3Transform(XMLoadFloat3(&vertex.Pos), M));
+			XMStoreFloat3(&streams.Normals[v], XMVector3TransformNormal(XMLoadFloat3(&vertex.Normal), M));
+			XMStoreFloat3(&streams.Tangents[v], XMVector3TransformNormal(XMLoadFloat3(&vertex.TangentU), M));
+		}
+	}
+
+#if defined(SKINNING_AVX2_KERNEL)
+	bool CpuSupportsAvx2()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+		// FMA3, and the OS saving the YMM registers.
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 12)) == 0 || (info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+	}
+
+	inline __m128 LoadFloat3(const XMFLOAT3& f)
+	{
+		return _mm_set_ps(0.0f, f.z, f.y, f.x);
+	}
+
+	inline void StoreFloat3(XMFLOAT3& f, __m128 v)
+	{
+		_mm_storel_pi(reinterpret_cast<__m64*>(&f.x), v);
+		_mm_store_ss(&f.z, _mm_movehl_ps(v, v));
+	}
+
+	// SkinVertexRangeSse in plain intrinsics: rows 0 and 1 of a palette entry
+	// are eight contiguous floats, blended by one 256-bit FMA. DirectXMath is
+	// not called here, its inline functions are compiled for SSE only.
+	template<UINT InfluenceCount>
+	SKINNING_AVX2_TARGET void SkinVertexRangeAvx2(const std::vector<SkinnedVertex>& vertices,
+		const XMFLOAT3X4* finalTransforms, SkinnedVertexStreams& streams, size_t begin, size_t end)
+	{
+		assert(end <= vertices.size() && end <= streams.Positions.size());
+
+		for (size_t v = begin; v < end; ++v)
+		{
+			const SkinnedVertex& vertex = vertices[v];
+
+			const float* storedWeights = &vertex.BoneWeights.x;
+			float weights[InfluenceCount];
+			weights[InfluenceCount - 1] = 1.0f;
+			for (UINT i = 0; i + 1 < InfluenceCount; ++i)
+			{
+				weights[i] = storedWeights[i];
+				weights[InfluenceCount - 1] -= storedWeights[i];
+			}
+
+			__m256 rows01 = _mm256_setzero_ps();
+			__m128 row2 = _mm_setzero_ps();
+			for (UINT i = 0; i < InfluenceCount; ++i)
+			{
+				const float* m = &finalTransforms[vertex.BoneIndices[i]].m[0][0];
+				__m256 w = _mm256_set1_ps(weights[i]);
+				rows01 = _mm256_fmadd_ps(w, _mm256_loadu_ps(m), rows01);
+				row2 = _mm_fmadd_ps(_mm256_castps256_ps128(w), _mm_loadu_ps(m + 8), row2);
+			}
+
+			// The transpose gives the x, y and z axes and the translation.
+			__m128 x = _mm256_castps256_ps128(rows01);
+			__m128 y = _mm256_extractf128_ps(rows01, 1);
+			__m128 z = row2;
+			__m128 t = _mm_setzero_ps();
+			_MM_TRANSPOSE4_PS(x, y, z, t);
+
+			__m128 pos = LoadFloat3(vertex.Pos);
+			__m128 normal = LoadFloat3(vertex.Normal);
+			__m128 tangent = LoadFloat3(vertex.TangentU);
+			__m128 result = _mm_fmadd_ps(_mm_shuffle_ps(pos, pos, _MM_SHUFFLE(2, 2, 2, 2)), z, t);
+			result = _mm_fmadd_ps(_mm_shuffle_ps(pos, pos, _MM_SHUFFLE(1, 1, 1, 1)), y, result);
+			StoreFloat3(streams.Positions[v], _mm_fmadd_ps(_mm_shuffle_ps(pos, pos, _MM_SHUFFLE(0, 0, 0, 0)), x, result));
+			result = _mm_mul_ps(_mm_shuffle_ps(normal, normal, _MM_SHUFFLE(2, 2, 2, 2)), z);
+			result = _mm_fmadd_ps(_mm_shuffle_ps(normal, normal, _MM_SHUFFLE(1, 1, 1, 1)), y, result);
+			StoreFloat3(streams.Normals[v], _mm_fmadd_ps(_mm_shuffle_ps(normal, normal, _MM_SHUFFLE(0, 0, 0, 0)), x, result));
+			result = _mm_mul_ps(_mm_shuffle_ps(tangent, tangent, _MM_SHUFFLE(2, 2, 2, 2)), z);
+			result = _mm_fmadd_ps(_mm_shuffle_ps(tangent, tangent, _MM_SHUFFLE(1, 1, 1, 1)), y, result);
+			StoreFloat3(streams.Tangents[v], _mm_fmadd_ps(_mm_shuffle_ps(tangent, tangent, _MM_SHUFFLE(0, 0, 0, 0)), x, result));
+		}
+	}
+#endif
+
+	SkinningKernel gSkinningKernel =
+		IsSkinningKernelSupported(SkinningKernelAvx2) ? SkinningKernelAvx2 : SkinningKernelSse;
+
+	template<UINT InfluenceCount>
+	void SkinVertexRange(const std::vector<SkinnedVertex>& vertices, const XMFLOAT3X4* finalTransforms,
+		SkinnedVertexStreams& streams, size_t begin, size_t end)
+	{
+#if defined(SKINNING_AVX2_KERNEL)
+		if (gSkinningKernel == SkinningKernelAvx2)
+		{
+			SkinVertexRangeAvx2<InfluenceCount>(vertices, finalTransforms, streams, begin, end);
+			return;
+		}
+#endif
+		SkinVertexRangeSse<InfluenceCount>(vertices, finalTransforms, streams, begin, end);
+	}
+
+	void SkinVertexRange(const std::vector<SkinnedVertex>& vertices, const XMFLOAT3X4* finalTransforms,
+		SkinnedVertexStreams& streams, UINT influenceCount, size_t begin, size_t end)
+	{
+		switch (influenceCount)
+		{
+		case 1:
+			SkinVertexRange<1>(vertices, finalTransforms, streams, begin, end);
+			break;
+		case 2:
+			SkinVertexRange<2>(vertices, finalTransforms, streams, begin, end);
+			break;
+		case 3:
+			SkinVertexRange<3>(vertices, finalTransforms, streams, begin, end);
+			break;
+		default:
+			SkinVertexRange<4>(vertices, finalTransforms, streams, begin, end);
+			break;
+		}
+	}
+}
+
+void SkinVertexLinear(const SkinnedVertex& vertex, const std::vector<XMFLOAT3X4>& finalTransforms,
+	XMFLOAT3& pos, XMFLOAT3& normal)
+{
+	SkinVertexLinear(vertex, finalTransforms.data(), pos, normal);
+}
+
+void SkinVertexLinear(const SkinnedVertex& vertex, const XMFLOAT3X4* finalTransforms,
+	XMFLOAT3& pos, XMFLOAT3& normal)
+{
+	float weights[4];
+	GetWeights(vertex, weights);
+
+	XMVECTOR posL = XMVectorZero();
+	XMVECTOR normalL = XMVectorZero();
+	for (UINT i = 0; i < 4; ++i)
+	{
+		// XMLoadFloat3x4 undoes the transpose of the palette.
+		XMMATRIX M = XMLoadFloat3x4(&finalTransforms[vertex.BoneIndices[i]]);
+		posL = XMVectorMultiplyAdd(XMVectorReplicate(weights[i]), XMVector3Transform(XMLoadFloat3(&vertex.Pos), M), posL);
+		normalL = XMVectorMultiplyAdd(XMVectorReplicate(weights[i]), XMVector3TransformNormal(XMLoadFloat3(&vertex.Normal), M), normalL);
+	}
+
+	XMStoreFloat3(&pos, posL);
+	XMStoreFloat3(&normal, normalL);
+}
+
+void SkinVertexDualQuaternion(const SkinnedVertex& vertex, const std::vector<XMFLOAT4>& palette,
+	XMFLOAT3& pos, XMFLOAT3& normal)
+{
+	float weights[4];
+	GetWeights(vertex, weights);
+
+	XMVECTOR first = XMLoadFloat4(&palette[2 * vertex.BoneIndices[0]]);
+	XMVECTOR real = XMVectorZero();
+	XMVECTOR dual = XMVectorZero();
+	for (UINT i = 0; i < 4; ++i)
+	{
+		XMVECTOR r = XMLoadFloat4(&palette[2 * vertex.BoneIndices[i]]);
+		XMVECTOR d = XMLoadFloat4(&palette[2 * vertex.BoneIndices[i] + 1]);
+
+		// q and -q are the same rotation; blend them in the same hemisphere.
+		float w = XMVectorGetX(XMVector4Dot(r, first)) < 0.0f ? -weights[i] : weights[i];
+		real = XMVectorMultiplyAdd(XMVectorReplicate(w), r, real);
+		dual = XMVectorMultiplyAdd(XMVectorReplicate(w), d, dual);
+	}
+
+	XMVECTOR invLength = XMVectorReciprocal(XMVector4Length(real));
+	real = XMVectorMultiply(real, invLength);
+	dual = XMVectorMultiply(dual, invLength);
+
+	// t = 2 * dual * conjugate(real), vector part.
+	XMVECTOR realW = XMVectorSplatW(real);
+	XMVECTOR dualW = XMVectorSplatW(dual);
+	XMVECTOR t = XMVectorSubtract(XMVectorMultiply(realW, dual), XMVectorMultiply(dualW, real));
+	t = XMVectorScale(XMVectorAdd(t, XMVector3Cross(real, dual)), 2.0f);
+
+	XMStoreFloat3(&pos, XMVectorAdd(XMVector3Rotate(XMLoadFloat3(&vertex.Pos), real), t));
+	XMStoreFloat3(&normal, XMVector3Rotate(XMLoadFloat3(&vertex.Normal), real));
+}
+
+bool IsSkinningKernelSupported(SkinningKernel kernel)
+{
+	switch (kernel)
+	{
+	case SkinningKernelSse:
+		return true;
+	case SkinningKernelAvx2:
+	{
+#if defined(SKINNING_AVX2_KERNEL)
+		static const bool supported = CpuSupportsAvx2();
+		return supported;
+#else
+		return false;
+#endif
+	}
+	default:
+		return false;
+	}
+}
+
+bool SetSkinningKernel(SkinningKernel kernel)
+{
+	if (!IsSkinningKernelSupported(kernel))
+	{
+		return false;
+	}
+	gSkinningKernel = kernel;
+	return true;
+}
+
+SkinningKernel GetSkinningKernel()
+{
+	return gSkinningKernel;
+}
+
+void SkinnedVertexStreams::Resize(size_t vertexCount)
+{
+	Positions.resize(vertexCount);
+	Normals.resize(vertexCount);
+	Tangents.resize(vertexCount);
+}
+
+void SkinVertices(const std::vector<SkinnedVertex>& vertices, const XMFLOAT3X4* finalTransforms,
+	SkinnedVertexStreams& streams, size_t begin, size_t end)
+{
+	SkinVertexRange(vertices, finalTransforms, streams, 4, begin, end);
+}
+
+void SkinVertices(JobSystem& jobSystem, const std::vector<SkinnedVertex>& vertices,
+	const XMFLOAT3X4* finalTransforms, SkinnedVertexStreams& streams, size_t grainSize)
+{
+	jobSystem.ParallelFor(vertices.size(), grainSize, [&](size_t begin, size_t end)
+	{
+		SkinVertices(vertices, finalTransforms, streams, begin, end);
+	});
+}
+
+void SkinVertices(const std::vector<SkinnedVertex>& vertices, const XMFLOAT3X4* finalTransforms,
+	SkinnedVertexStreams& streams, const InfluenceRange& range)
+{
+	SkinVertexRange(vertices, finalTransforms, streams, range.InfluenceCount,
+		range.VertexStart, range.VertexStart + range.VertexCount);
+}
+
+void SkinVertices(JobSystem& jobSystem, const std::vector<SkinnedVertex>& vertices,
+	const XMFLOAT3X4* finalTransforms, SkinnedVertexStreams& streams,
+	const std::vector<InfluenceRange>& ranges, size_t grainSize)
+{
+	std::vector<JobHandle> rangeJobs;
+	rangeJobs.reserve(ranges.size());
+	for (const auto& range : ranges)
+	{
+		rangeJobs.push_back(jobSystem.ScheduleParallelFor(range.VertexCount, grainSize,
+			[&, range](size_t begin, size_t end)
+		{
+			SkinVertexRange(vertices, finalTransforms, streams, range.InfluenceCount,
+				range.VertexStart + begin, range.VertexStart + end);
+		}));
+	}
+	jobSystem.Wait(jobSystem.Schedule(nullptr, rangeJobs));
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+#include "../Common/JobSystem.h"
+#include "Vertex.h"
+#include "InfluenceBuckets.h"
+
+// CPU versions of the SKINNED vertex shader paths in Shaders/color.hlsl, so
+// the bone palettes can be validated without a GPU.
+
+// Linear blend skinning with the 3x4 palette written by
+// Model::GetFinalTransforms.
+void SkinVertexLinear(const SkinnedVertex& vertex, const std::vector<DirectX::XMFLOAT3X4>& finalTransforms,
+	DirectX::XMFLOAT3& pos, DirectX::XMFLOAT3& normal);
+// Same, reading the bones of one instance from a BonePalette: finalTransforms
+// points at the entry of its offset.
+void SkinVertexLinear(const SkinnedVertex& vertex, const DirectX::XMFLOAT3X4* finalTransforms,
+	DirectX::XMFLOAT3& pos, DirectX::XMFLOAT3& normal);
+
+// Dual quaternion skinning with the palette written by
+// Model::GetFinalDualQuaternions.
+void SkinVertexDualQuaternion(const SkinnedVertex& vertex, const std::vector<DirectX::XMFLOAT4>& palette,
+	DirectX::XMFLOAT3& pos, DirectX::XMFLOAT3& normal);
+
+// Skinned vertices written by SkinVertices, one stream per attribute so a
+// dynamic vertex buffer or a bounds pass can read just what it needs.
+struct SkinnedVertexStreams
+{
+	std::vector<DirectX::XMFLOAT3> Positions;
+	std::vector<DirectX::XMFLOAT3> Normals;
+	std::vector<DirectX::XMFLOAT3> Tangents;
+
+	void Resize(size_t vertexCount);
+};
+
+// Kernels of the SkinVertices functions. The SSE kernel is DirectXMath, the
+// AVX2 kernel blends two palette rows per 256-bit FMA and is only used when
+// the CPU supports AVX2 and FMA3, which is checked once at startup.
+enum SkinningKernel
+{
+	SkinningKernelSse = 0,
+	SkinningKernelAvx2,
+	SkinningKernelCount
+};
+
+bool IsSkinningKernelSupported(SkinningKernel kernel);
+// Kernel used by the following SkinVertices calls, by default the fastest one
+// supported. Set it only while no skinning is running; returns false and
+// keeps the current kernel if kernel is not supported.
+bool SetSkinningKernel(SkinningKernel kernel);
+SkinningKernel GetSkinningKernel();
+
+// Linear blend skinning of a whole mesh, matching SkinVertexLinear. Blends
+// the four bones of each vertex into one 3x4 matrix first, so each vertex
+// takes one matrix transform per attribute instead of four. Skins
+// vertices[begin, end) into the same range of streams, which must have been
+// resized to the vertex count.
+void SkinVertices(const std::vector<SkinnedVertex>& vertices, const DirectX::XMFLOAT3X4* finalTransforms,
+	SkinnedVertexStreams& streams, size_t begin, size_t end);
+// Same for every vertex, split into ranges of grainSize vertices on jobSystem.
+void SkinVertices(JobSystem& jobSystem, const std::vector<SkinnedVertex>& vertices,
+	const DirectX::XMFLOAT3X4* finalTransforms, SkinnedVertexStreams& streams, size_t grainSize = 2048);
+
+// Same for one range of a mesh bucketed by BucketInfluences, with the kernel
+// for its influence count: a 1 bone vertex costs a quarter of the blend.
+void SkinVertices(const std::vector<SkinnedVertex>& vertices, const DirectX::XMFLOAT3X4* finalTransforms,
+	SkinnedVertexStreams& streams, const InfluenceRange& range);
+// Same for every range, each split into grains of grainSize vertices on jobSystem.
+void SkinVertices(JobSystem& jobSystem, const std::vector<SkinnedVertex>& vertices,
+	const DirectX::XMFLOAT3X4* finalTransforms, SkinnedVertexStreams& streams,
+	const std::vector<InfluenceRange>& ranges, size_t grainSize = 2048);
@@ -0,0 +1,132 @@
+#include "InfluenceBuckets.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Prunes and sorts the bones of vertex, returns how many are left.
+	UINT PruneInfluences(SkinnedVertex& vertex, float weightThreshold, UINT& influencesBefore, UINT& prunedWeights)
+	{
+		float weights[4] = { vertex.BoneWeights.x, vertex.BoneWeights.y, vertex.BoneWeights.z,
+			1.0f - vertex.BoneWeights.x - vertex.BoneWeights.y - vertex.BoneWeights.z };
+		UINT order[4] = { 0, 1, 2, 3 };
+		std::stable_sort(order, order + 4, [&](UINT a, UINT b) { return weights[a] > weights[b]; });
+
+		UINT influenceCount = 0;
+		float sum = 0.0f;
+		for (UINT i = 0; i < 4; ++i)
+		{
+			float weight = weights[order[i]];
+			if (weight > 0.0f)
+			{
+				++influencesBefore;
+			}
+			if (i == 0 || (weight > 0.0f && weight >= weightThreshold))
+			{
+				++influenceCount;
+				sum += weight;
+			}
+			else if (weight > 0.0f)
+			{
+				++prunedWeights;
+			}
+		}
+
+		BYTE boneIndices[4];
+		float kept[3] = {};
+		for (UINT i = 0; i < 4; ++i)
+		{
+			boneIndices[i] = vertex.BoneIndices[order[min(i, influenceCount - 1)]];
+			if (i < 3 && i < influenceCount)
+			{
+				kept[i] = sum > 0.0f ? weights[order[i]] / sum : 1.0f;
+			}
+		}
+		// The last bone takes the implicit weight, which a four bone kernel
+		// applies to slot 3, holding the same bone.
+		if (influenceCount < 4)
+		{
+			kept[influenceCount - 1] = 0.0f;
+		}
+
+		vertex.BoneWeights = XMFLOAT3(kept[0], kept[1], kept[2]);
+		std::copy(boneIndices, boneIndices + 4, vertex.BoneIndices);
+		return influenceCount;
+	}
+}
+
+InfluenceBucketReport BucketInfluences(std::vector<SkinnedVertex>& vertices, std::vector<USHORT>& indices,
+	const std::vector<M3DLoader::Subset>& subsets, float weightThreshold, std::vector<InfluenceRange>& ranges)
+{
+	InfluenceBucketReport report;
+	if (vertices.empty())
+	{
+		return report;
+	}
+
+	UINT influencesBefore = 0;
+	UINT influencesAfter = 0;
+	std::vector<BYTE> influenceCounts(vertices.size());
+	for (size_t v = 0; v < vertices.size(); ++v)
+	{
+		influenceCounts[v] = (BYTE)PruneInfluences(vertices[v], weightThreshold, influencesBefore, report.PrunedWeights);
+		influencesAfter += influenceCounts[v];
+		++report.VertexCounts[influenceCounts[v] - 1];
+	}
+	report.AverageInfluencesBefore = (float)influencesBefore / vertices.size();
+	report.AverageInfluencesAfter = (float)influencesAfter / vertices.size();
+
+	std::vector<M3DLoader::Subset> segments = subsets;
+	if (segments.empty())
+	{
+		segments.resize(1);
+		segments[0].VertexCount = (UINT)vertices.size();
+	}
+
+	// Counting sort of each subset, old vertex index -> new one.
+	std::vector<UINT> remap(vertices.size());
+	for (size_t v = 0; v < remap.size(); ++v)
+	{
+		remap[v] = (UINT)v;
+	}
+	std::vector<SkinnedVertex> sorted(vertices);
+	for (const auto& segment : segments)
+	{
+		assert(segment.VertexStart + segment.VertexCount <= vertices.size());
+
+		UINT bucketStarts[4] = {};
+		UINT bucketCounts[4] = {};
+		for (UINT v = segment.VertexStart; v < segment.VertexStart + segment.VertexCount; ++v)
+		{
+			++bucketCounts[influenceCounts[v] - 1];
+		}
+		UINT start = segment.VertexStart;
+		for (UINT b = 0; b < 4; ++b)
+		{
+			bucketStarts[b] = start;
+			if (bucketCounts[b] > 0)
+			{
+				InfluenceRange range;
+				range.InfluenceCount = b + 1;
+				range.VertexStart = start;
+				range.VertexCount = bucketCounts[b];
+				ranges.push_back(range);
+			}
+			start += bucketCounts[b];
+		}
+
+		for (UINT v = segment.VertexStart; v < segment.VertexStart + segment.VertexCount; ++v)
+		{
+			UINT target = bucketStarts[influenceCounts[v] - 1]++;
+			remap[v] = target;
+			sorted[target] = vertices[v];
+		}
+	}
+	vertices.swap(sorted);
+
+	for (auto& index : indices)
+	{
+		index = (USHORT)remap[index];
+	}
+	return report;
+}
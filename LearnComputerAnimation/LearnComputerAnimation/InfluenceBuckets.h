@@ -0,0 +1,40 @@
+#pragma once
+#include "Model.h"
+
+// Vertices [VertexStart, VertexStart + VertexCount) of one subset, which all
+// have InfluenceCount bones, so a skinning kernel for that count can run over
+// them without branching on zero weights.
+struct InfluenceRange
+{
+	UINT InfluenceCount = 4;
+	UINT VertexStart = 0;
+	UINT VertexCount = 0;
+};
+
+struct InfluenceBucketReport
+{
+	// Vertices with 1 to 4 bones, after pruning.
+	UINT VertexCounts[4] = {};
+	UINT PrunedWeights = 0;
+	// Bones with a weight above zero per vertex, before and after pruning.
+	float AverageInfluencesBefore = 0.0f;
+	float AverageInfluencesAfter = 0.0f;
+};
+
+///<summary>
+/// Mesh preprocessing for skinning. Drops the bones of every vertex whose
+/// weight is below weightThreshold (at least the heaviest bone is kept) and
+/// renormalizes the rest, heaviest first. The first InfluenceCount - 1
+/// weights are stored and the last one stays implicit, as every skinning
+/// path expects; the unused slots repeat the last bone, so the four bone
+/// kernels of SkinVertexLinear and Shaders/color.hlsl still give it that weight.
+///
+/// Then partitions the vertices of each subset by influence count, keeping
+/// their order within a bucket, remaps indices to match and appends one
+/// InfluenceRange per non-empty bucket to ranges, subset by subset. Subsets
+/// keep their vertex and face ranges, so draws are unaffected. Vertices
+/// outside every subset stay in place and get no range. A mesh without
+/// subsets is treated as one.
+///</summary>
+InfluenceBucketReport BucketInfluences(std::vector<SkinnedVertex>& vertices, std::vector<USHORT>& indices,
+	const std::vector<M3DLoader::Subset>& subsets, float weightThreshold, std::vector<InfluenceRange>& ranges);
@@ -1,7 +1,24 @@
 #include "Model.h"
+#include "PoseCache.h"
+#include "AnimationArchive.h"
+#include "BakedClip.h"
 
 using namespace DirectX;
 
+namespace
+{
+	// Angle between two rotations, from the chord between the unit
+	// quaternions; acos of their dot product has no precision near 0.
+	float RotationAngle(FXMVECTOR q0, FXMVECTOR q1)
+	{
+		XMVECTOR a = XMQuaternionNormalize(q0);
+		XMVECTOR b = XMQuaternionNormalize(q1);
+		float chord = min(XMVectorGetX(XMVector4Length(XMVectorSubtract(a, b))),
+			XMVectorGetX(XMVector4Length(XMVectorAdd(a, b))));
+		return 4.0f * asinf(min(0.5f * chord, 1.0f));
+	}
+}
+
 Keyframe::Keyframe()
 	: Time(0.0f),
 	Translation(0.0f, 0.0f, 0.0f),
@@ -11,173 +28,1419 @@ Keyframe::Keyframe()
 }
 
 
-float BoneAnimation::GetStartTime()const
+float BoneAnimation::GetStartTime()const
+{
+	// Keyframes are sorted by time, so first keyframe gives start time.
+	return Keyframes.front().Time;
+}
+
+float BoneAnimation::GetEndTime()const
+{
+	// Keyframes are sorted by time, so last keyframe gives end time.
+	float f = Keyframes.back().Time;
+
+	return f;
+}
+
+UINT BoneAnimation::FindKeyframe(float t, UINT& cursor)const
+{
+	// How far the cached pair may be stepped forward before a binary search is cheaper.
+	const UINT maxForwardSteps = 4;
+
+	UINT lastPair = (UINT)Keyframes.size() - 2;
+
+	if (cursor <= lastPair && Keyframes[cursor].Time <= t)
+	{
+		for (UINT step = 0; step < maxForwardSteps && cursor <= lastPair; ++step, ++cursor)
+		{
+			if (t < Keyframes[cursor + 1].Time)
+			{
+				return cursor;
+			}
+		}
+	}
+
+	// Seek or loop: find the first keyframe after t.
+	auto next = std::upper_bound(Keyframes.begin(), Keyframes.end(), t,
+		[](float time, const Keyframe& key) { return time < key.Time; });
+
+	cursor = (UINT)(next - Keyframes.begin());
+	cursor = cursor == 0 ? 0 : min(cursor - 1, lastPair);
+
+	return cursor;
+}
+
+void FindKeyframePair(const float* times, UINT stride, UINT count, float t, UINT* cursor,
+	UINT& k0, UINT& k1, float& lerpPercent)
+{
+	const UINT maxForwardSteps = 4;
+
+	if (count == 1 || t <= times[0])
+	{
+		k0 = k1 = 0;
+		lerpPercent = 0.0f;
+		return;
+	}
+	if (t >= times[(count - 1) * stride])
+	{
+		k0 = k1 = count - 1;
+		lerpPercent = 0.0f;
+		return;
+	}
+
+	UINT lastPair = count - 2;
+	UINT i = cursor != nullptr ? *cursor : count;
+	bool found = false;
+
+	if (i <= lastPair && times[i * stride] <= t)
+	{
+		for (UINT step = 0; step < maxForwardSteps && i <= lastPair; ++step, ++i)
+		{
+			if (t < times[(i + 1) * stride])
+			{
+				found = true;
+				break;
+			}
+		}
+	}
+
+	if (!found)
+	{
+		// Binary search for the last key with time <= t.
+		UINT lo = 0;
+		UINT hi = lastPair;
+		while (lo < hi)
+		{
+			UINT mid = (lo + hi + 1) / 2;
+			if (times[mid * stride] <= t)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid - 1;
+			}
+		}
+		i = lo;
+	}
+
+	if (cursor != nullptr)
+	{
+		*cursor = i;
+	}
+
+	float t0 = times[i * stride];
+	float t1 = times[(i + 1) * stride];
+	k0 = i;
+	k1 = i + 1;
+	lerpPercent = (t - t0) / (t1 - t0);
+}
+
+void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M)const
+{
+	// Without a cached cursor start straight from the binary search.
+	UINT cursor = (UINT)Keyframes.size();
+	Interpolate(t, M, cursor);
+}
+
+void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M, UINT& cursor)const
+{
+	BoneTransform transform;
+	Interpolate(t, transform, cursor);
+	XMStoreFloat4x4(&M, transform.ToMatrix());
+}
+
+void BoneAnimation::Interpolate(float t, BoneTransform& transform, UINT& cursor)const
+{
+	if (TranslationClass != AnimationChannelAnimated && RotationClass != AnimationChannelAnimated &&
+		ScaleClass != AnimationChannelAnimated)
+	{
+		transform = ConstantTransform;
+	}
+	else if (t <= Keyframes.front().Time)
+	{
+		XMVECTOR S = XMLoadFloat3(&Keyframes.front().Scale);
+		XMVECTOR P = XMLoadFloat3(&Keyframes.front().Translation);
+		XMVECTOR Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
+
+		transform.Set(S, Q, P);
+	}
+	else if (t >= Keyframes.back().Time)
+	{
+		XMVECTOR S = XMLoadFloat3(&Keyframes.back().Scale);
+		XMVECTOR P = XMLoadFloat3(&Keyframes.back().Translation);
+		XMVECTOR Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
+
+		transform.Set(S, Q, P);
+	}
+	else
+	{
+		UINT i = FindKeyframe(t, cursor);
+
+		float lerpPercent = (t - Keyframes[i].Time) / (Keyframes[i + 1].Time - Keyframes[i].Time);
+
+		const Keyframe& k0 = Keyframes[i];
+		const Keyframe& k1 = Keyframes[i + 1];
+
+		// Constant channels are not blended; their keys all hold ConstantTransform.
+		XMVECTOR S = ScaleClass == AnimationChannelAnimated ?
+			XMVectorLerp(XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale), lerpPercent) :
+			XMLoadFloat3(&ConstantTransform.Scale);
+		XMVECTOR P = TranslationClass == AnimationChannelAnimated ?
+			XMVectorLerp(XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation), lerpPercent) :
+			XMLoadFloat3(&ConstantTransform.Translation);
+
+		if (RotationClass == AnimationChannelAnimated)
+		{
+			XMVECTOR Q = XMQuaternionSlerp(XMLoadFloat4(&k0.RotationQuat), XMLoadFloat4(&k1.RotationQuat), lerpPercent);
+			transform.Set(S, Q, P);
+		}
+		else
+		{
+			// Already normalized.
+			transform.Rotation = ConstantTransform.Rotation;
+			XMStoreFloat3(&transform.Scale, S);
+			XMStoreFloat3(&transform.Translation, P);
+		}
+	}
+}
+
+void BoneAnimation::ClassifyChannels(const KeyframeReductionSettings& tolerances)
+{
+	if (Keyframes.empty())
+	{
+		return;
+	}
+
+	const Keyframe& first = Keyframes.front();
+	XMVECTOR P = XMLoadFloat3(&first.Translation);
+	XMVECTOR Q = XMQuaternionNormalize(XMLoadFloat4(&first.RotationQuat));
+	XMVECTOR S = XMLoadFloat3(&first.Scale);
+
+	bool constantTranslation = true;
+	bool constantRotation = true;
+	bool constantScale = true;
+	for (const Keyframe& key : Keyframes)
+	{
+		constantTranslation = constantTranslation && XMVectorGetX(XMVector3Length(
+			XMVectorSubtract(XMLoadFloat3(&key.Translation), P))) <= tolerances.TranslationTolerance;
+		constantRotation = constantRotation &&
+			RotationAngle(XMLoadFloat4(&key.RotationQuat), Q) <= tolerances.RotationTolerance;
+		constantScale = constantScale && XMVectorGetX(XMVector3Length(
+			XMVectorSubtract(XMLoadFloat3(&key.Scale), S))) <= tolerances.ScaleTolerance;
+	}
+
+	// Snap the constant channels that are also close to the identity to it.
+	TranslationClass = AnimationChannelAnimated;
+	if (constantTranslation)
+	{
+		bool identity = XMVectorGetX(XMVector3Length(P)) <= tolerances.TranslationTolerance;
+		TranslationClass = identity ? AnimationChannelIdentity : AnimationChannelConstant;
+		P = identity ? XMVectorZero() : P;
+	}
+	RotationClass = AnimationChannelAnimated;
+	if (constantRotation)
+	{
+		bool identity = RotationAngle(Q, XMQuaternionIdentity()) <= tolerances.RotationTolerance;
+		RotationClass = identity ? AnimationChannelIdentity : AnimationChannelConstant;
+		Q = identity ? XMQuaternionIdentity() : Q;
+	}
+	ScaleClass = AnimationChannelAnimated;
+	if (constantScale)
+	{
+		bool identity = XMVectorGetX(XMVector3Length(XMVectorSubtract(S, XMVectorSplatOne()))) <= tolerances.ScaleTolerance;
+		ScaleClass = identity ? AnimationChannelIdentity : AnimationChannelConstant;
+		S = identity ? XMVectorSplatOne() : S;
+	}
+	ConstantTransform.Set(S, Q, P);
+
+	// Keep the keys consistent with the classes, for the other clip formats
+	// built from them and for M3DWriter.
+	for (Keyframe& key : Keyframes)
+	{
+		if (constantTranslation)
+		{
+			key.Translation = ConstantTransform.Translation;
+		}
+		if (constantRotation)
+		{
+			key.RotationQuat = ConstantTransform.Rotation;
+		}
+		if (constantScale)
+		{
+			key.Scale = ConstantTransform.Scale;
+		}
+	}
+
+	if (constantTranslation && constantRotation && constantScale && Keyframes.size() > 2)
+	{
+		Keyframes.erase(Keyframes.begin() + 1, Keyframes.end() - 1);
+	}
+}
+
+void BoneAnimation::ReduceKeyframes(const KeyframeReductionSettings& settings)
+{
+	if (Keyframes.size() <= 2)
+	{
+		return;
+	}
+
+	// Checks that the segment from key a to key b reproduces every key in between.
+	auto segmentFits = [&](size_t a, size_t b)
+	{
+		const Keyframe& k0 = Keyframes[a];
+		const Keyframe& k1 = Keyframes[b];
+
+		for (size_t j = a + 1; j < b; ++j)
+		{
+			const Keyframe& key = Keyframes[j];
+			float lerpPercent = (key.Time - k0.Time) / (k1.Time - k0.Time);
+
+			XMVECTOR p = XMVectorLerp(XMLoadFloat3(&k0.Translation), XMLoadFloat3(&k1.Translation), lerpPercent);
+			XMVECTOR s = XMVectorLerp(XMLoadFloat3(&k0.Scale), XMLoadFloat3(&k1.Scale), lerpPercent);
+			XMVECTOR q = XMQuaternionSlerp(XMLoadFloat4(&k0.RotationQuat), XMLoadFloat4(&k1.RotationQuat), lerpPercent);
+
+			float dp = XMVectorGetX(XMVector3Length(XMVectorSubtract(p, XMLoadFloat3(&key.Translation))));
+			float ds = XMVectorGetX(XMVector3Length(XMVectorSubtract(s, XMLoadFloat3(&key.Scale))));
+
+			float angle = RotationAngle(q, XMLoadFloat4(&key.RotationQuat));
+
+			if (dp > settings.TranslationTolerance || ds > settings.ScaleTolerance || angle > settings.RotationTolerance)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// Greedily extend the segment from the last kept key as far as it fits.
+	std::vector<Keyframe> kept;
+	kept.push_back(Keyframes.front());
+
+	size_t anchor = 0;
+	for (size_t i = 2; i < Keyframes.size(); ++i)
+	{
+		if (!segmentFits(anchor, i))
+		{
+			anchor = i - 1;
+			kept.push_back(Keyframes[anchor]);
+		}
+	}
+	kept.push_back(Keyframes.back());
+
+	Keyframes.swap(kept);
+}
+
+void AnimationBlend::Play(ClipId clip, float timePos)
+{
+	mLayerCount = 1;
+	Layer& layer = mLayers[0];
+	layer.Clip = clip;
+	layer.TimePos = timePos;
+	layer.Weight = 1.0f;
+	layer.FadeRate = 0.0f;
+	layer.Mask = InvalidBoneMaskId;
+}
+
+void AnimationBlend::CrossfadeTo(ClipId clip, float timePos, float duration)
+{
+	if (mLayerCount == 0 || duration <= 0.0f)
+	{
+		Play(clip, timePos);
+		return;
+	}
+
+	if (mLayerCount == MaxLayers)
+	{
+		UINT lightest = MaxLayers;
+		for (UINT n = 0; n < mLayerCount; ++n)
+		{
+			if (mLayers[n].Mask == InvalidBoneMaskId &&
+				(lightest == MaxLayers || mLayers[n].Weight < mLayers[lightest].Weight))
+			{
+				lightest = n;
+			}
+		}
+		RemoveLayer(lightest != MaxLayers ? lightest : 0);
+	}
+
+	// Every unmasked layer reaches 0 when the new one reaches 1.
+	for (UINT n = 0; n < mLayerCount; ++n)
+	{
+		if (mLayers[n].Mask == InvalidBoneMaskId)
+		{
+			mLayers[n].FadeRate = -mLayers[n].Weight / duration;
+		}
+	}
+
+	Layer& layer = mLayers[mLayerCount++];
+	layer.Clip = clip;
+	layer.TimePos = timePos;
+	layer.Weight = 0.0f;
+	layer.FadeRate = 1.0f / duration;
+	layer.Mask = InvalidBoneMaskId;
+}
+
+UINT AnimationBlend::AddLayer(ClipId clip, float timePos, float weight, BoneMaskId mask)
+{
+	if (mLayerCount == MaxLayers)
+	{
+		return MaxLayers;
+	}
+
+	Layer& layer = mLayers[mLayerCount];
+	layer.Clip = clip;
+	layer.TimePos = timePos;
+	layer.Weight = weight;
+	layer.FadeRate = 0.0f;
+	layer.Mask = mask;
+	return mLayerCount++;
+}
+
+void AnimationBlend::SetWeight(UINT layer, float weight)
+{
+	assert(layer < mLayerCount);
+	mLayers[layer].Weight = weight;
+	mLayers[layer].FadeRate = 0.0f;
+}
+
+void AnimationBlend::Clear()
+{
+	mLayerCount = 0;
+}
+
+void AnimationBlend::Update(const Model& model, float dt)
+{
+	bool fadedIn = false;
+	for (UINT n = 0; n < mLayerCount; ++n)
+	{
+		Layer& layer = mLayers[n];
+		layer.TimePos += dt;
+		// Loop
+		if (layer.TimePos > model.GetClipEndTime(layer.Clip))
+		{
+			layer.TimePos = 0.0f;
+		}
+
+		layer.Weight += layer.FadeRate * dt;
+		if (layer.FadeRate > 0.0f && layer.Weight >= 1.0f)
+		{
+			layer.Weight = 1.0f;
+			layer.FadeRate = 0.0f;
+			fadedIn = true;
+		}
+	}
+
+	// Once the fade in is over the layers fading out are done too, whatever
+	// rounding left of their weights.
+	for (UINT n = mLayerCount; n-- > 0;)
+	{
+		const Layer& layer = mLayers[n];
+		if (layer.FadeRate < 0.0f && (layer.Weight <= 0.0f || fadedIn))
+		{
+			RemoveLayer(n);
+		}
+	}
+}
+
+void AnimationBlend::RemoveLayer(UINT layer)
+{
+	assert(layer < mLayerCount);
+	// Rotate instead of erasing so the sampler of the removed layer keeps its
+	// memory for the next layer added.
+	std::rotate(mLayers + layer, mLayers + layer + 1, mLayers + mLayerCount);
+	--mLayerCount;
+}
+
+bool AnimationBlend::IsBlending()const
+{
+	return mLayerCount > 1;
+}
+
+UINT AnimationBlend::LayerCount()const
+{
+	return mLayerCount;
+}
+
+const AnimationBlend::Layer& AnimationBlend::GetLayer(UINT layer)const
+{
+	return mLayers[layer];
+}
+
+AnimationBlend::Layer& AnimationBlend::GetLayer(UINT layer)
+{
+	return mLayers[layer];
+}
+
+void AnimationSampler::Reset(const AnimationClip* clip)
+{
+	Clip = clip;
+	// Start every track past its last pair so the first sample does a binary search.
+	KeyCursors.assign(clip->TrackCount(), (UINT)-1);
+}
+
+float AnimationClip::GetClipStartTime()const
+{
+	if (Compressed != nullptr)
+	{
+		return Compressed->StartTime;
+	}
+	if (Resampled != nullptr)
+	{
+		return Resampled->StartTime;
+	}
+	if (Packed != nullptr)
+	{
+		return Packed->StartTime;
+	}
+
+	// Find smallest start time over all bones in this clip.
+	float t = MathHelper::Infinity;
+	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		t = min(t, BoneAnimations[i].GetStartTime());
+	}
+
+	return t;
+}
+
+float AnimationClip::GetClipEndTime()const
+{
+	if (Compressed != nullptr)
+	{
+		return Compressed->EndTime;
+	}
+	if (Resampled != nullptr)
+	{
+		return Resampled->EndTime;
+	}
+	if (Packed != nullptr)
+	{
+		return Packed->EndTime;
+	}
+
+	// Find largest end time over all bones in this clip.
+	float t = 0.0f;
+	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+
+		t = max(t, BoneAnimations[i].GetEndTime());
+	}
+
+	return t;
+}
+
+UINT AnimationClip::TrackCount()const
+{
+	if (Compressed != nullptr)
+	{
+		return Compressed->TrackCount();
+	}
+	if (Resampled != nullptr)
+	{
+		// Direct frame indexing, no cursors to keep.
+		return 0;
+	}
+	return Packed != nullptr ? Packed->TrackCount() : (UINT)BoneAnimations.size();
+}
+
+bool AnimationClip::ReduceKeyframes(const KeyframeReductionSettings& settings, KeyframeReductionReport& report)
+{
+	report = KeyframeReductionReport();
+	if (BoneAnimations.empty() || Packed != nullptr || Resampled != nullptr || Compressed != nullptr)
+	{
+		return false;
+	}
+
+	for (auto& boneAnimation : BoneAnimations)
+	{
+		report.KeyframesBefore += (UINT)boneAnimation.Keyframes.size();
+		boneAnimation.ReduceKeyframes(settings);
+		report.KeyframesAfter += (UINT)boneAnimation.Keyframes.size();
+	}
+
+	return true;
+}
+
+void AnimationClip::Interpolate(float t, std::vector<BoneTransform>& pose)const
+{
+	if (Compressed != nullptr)
+	{
+		Compressed->Interpolate(t, pose, nullptr);
+		return;
+	}
+	if (Resampled != nullptr)
+	{
+		Resampled->Interpolate(t, pose);
+		return;
+	}
+	if (Packed != nullptr)
+	{
+		Packed->Interpolate(t, pose, nullptr);
+		return;
+	}
+
+	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		UINT cursor = (UINT)BoneAnimations[i].Keyframes.size();
+		BoneAnimations[i].Interpolate(t, pose[i], cursor);
+	}
+}
+
+void AnimationClip::Interpolate(float t, std::vector<BoneTransform>& pose, AnimationSampler& sampler,
+	const BoneSet* bones)const
+{
+	if (sampler.Clip != this)
+	{
+		sampler.Reset(this);
+	}
+
+	if (Compressed != nullptr)
+	{
+		Compressed->Interpolate(t, pose, sampler.KeyCursors.data(), bones);
+		return;
+	}
+	if (Resampled != nullptr)
+	{
+		Resampled->Interpolate(t, pose, bones);
+		return;
+	}
+	if (Packed != nullptr)
+	{
+		Packed->Interpolate(t, pose, sampler.KeyCursors.data(), bones);
+		return;
+	}
+
+	if (bones != nullptr)
+	{
+		for (UINT i : bones->Bones)
+		{
+			BoneAnimations[i].Interpolate(t, pose[i], sampler.KeyCursors[i]);
+		}
+		return;
+	}
+	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	{
+		BoneAnimations[i].Interpolate(t, pose[i], sampler.KeyCursors[i]);
+	}
+}
+
+void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms)const
+{
+	std::vector<BoneTransform> pose(boneTransforms.size());
+	Interpolate(t, pose);
+
+	for (UINT i = 0; i < boneTransforms.size(); ++i)
+	{
+		XMStoreFloat4x4(&boneTransforms[i], pose[i].ToMatrix());
+	}
+}
+
+void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms, AnimationSampler& sampler)const
+{
+	sampler.LocalPose.resize(boneTransforms.size());
+	Interpolate(t, sampler.LocalPose, sampler);
+
+	for (UINT i = 0; i < boneTransforms.size(); ++i)
+	{
+		XMStoreFloat4x4(&boneTransforms[i], sampler.LocalPose[i].ToMatrix());
+	}
+}
+
+BoneMaskId Model::CreateBoneMask(const std::string& maskName, const std::vector<UINT>& rootBones)
+{
+	BoneMaskId existing = FindBoneMask(maskName);
+	if (existing != InvalidBoneMaskId)
+	{
+		return existing;
+	}
+
+	BoneMask mask;
+	UINT numBones = BoneCount();
+	mask.Bones.Bits.assign((numBones + 63) / 64, 0);
+	mask.Evaluated.Bits.assign((numBones + 63) / 64, 0);
+	for (UINT root : rootBones)
+	{
+		assert(root < numBones);
+		mask.Bones.Insert(root);
+	}
+	// Parents come before their children, so one pass adds whole subtrees.
+	for (UINT i = 1; i < numBones; ++i)
+	{
+		if (mask.Bones.Contains(mBoneHierarchy[i]))
+		{
+			mask.Bones.Insert(i);
+		}
+	}
+
+	for (UINT bone : mask.Bones.Bones)
+	{
+		for (int i = (int)bone; i >= 0 && !mask.Evaluated.Contains(i); i = mBoneHierarchy[i])
+		{
+			mask.Evaluated.Insert(i);
+		}
+	}
+
+	BoneMaskId id = (BoneMaskId)mBoneMasks.size();
+	mBoneMasks.push_back(std::move(mask));
+	mBoneMaskIds[maskName] = id;
+	return id;
+}
+
+BoneMaskId Model::FindBoneMask(const std::string& maskName)const
+{
+	auto mask = mBoneMaskIds.find(maskName);
+	return mask != mBoneMaskIds.end() ? mask->second : InvalidBoneMaskId;
+}
+
+const BoneMask& Model::GetBoneMask(BoneMaskId mask)const
+{
+	return mBoneMasks[mask];
+}
+
+ClipId Model::FindClip(const std::string& clipName)const
+{
+	auto clip = mClipIds.find(clipName);
+	return clip != mClipIds.end() ? clip->second : InvalidClipId;
+}
+
+UINT Model::ClipCount()const
+{
+	return (UINT)mClips.size();
+}
+
+const std::string& Model::GetClipName(ClipId clip)const
+{
+	return mClipNames[clip];
+}
+
+const AnimationClip& Model::GetClip(ClipId clip)const
+{
+	return mClips[clip];
+}
+
+float Model::GetClipStartTime(ClipId clip)const
+{
+	return mClipStartTimes[clip];
+}
+
+float Model::GetClipEndTime(ClipId clip)const
+{
+	return mClipEndTimes[clip];
+}
+
+float Model::GetClipStartTime(const std::string& clipName)const
+{
+	return GetClipStartTime(FindClip(clipName));
+}
+
+float Model::GetClipEndTime(const std::string& clipName)const
+{
+	return GetClipEndTime(FindClip(clipName));
+}
+
+UINT Model::BoneCount()const
+{
+	return mBoneHierarchy.size();
+}
+
+const std::vector<int>& Model::GetBoneHierarchy()const
+{
+	return mBoneHierarchy;
+}
+
+const std::vector<XMFLOAT4X4>& Model::GetBoneOffsets()const
+{
+	return mBoneOffsets;
+}
+
+bool Model::HasKeyframeTracks(ClipId clip)const
+{
+	return clip < ClipCount() && !mClips[clip].BoneAnimations.empty() &&
+		mClips[clip].BoneAnimations.size() == BoneCount();
+}
+
+bool Model::ReduceKeyframes(const KeyframeReductionSettings& settings, KeyframeReductionReport& report)
+{
+	report = KeyframeReductionReport();
+	for (ClipId clip = 0; clip < ClipCount(); ++clip)
+	{
+		const AnimationClip& c = mClips[clip];
+		if (!HasKeyframeTracks(clip) || c.Packed != nullptr || c.Resampled != nullptr || c.Compressed != nullptr)
+		{
+			return false;
+		}
+	}
+
+	for (ClipId clip = 0; clip < ClipCount(); ++clip)
+	{
+		KeyframeReductionReport clipReport;
+		mClips[clip].ReduceKeyframes(settings, clipReport);
+		report.KeyframesBefore += clipReport.KeyframesBefore;
+		report.KeyframesAfter += clipReport.KeyframesAfter;
+		CacheClipTimes(clip);
+	}
+
+	return true;
+}
+
+bool Model::CompressClip(const std::string& clipName, float maxPositionError, AnimationCompressionReport& report)
+{
+	ClipId id = FindClip(clipName);
+	if (id == InvalidClipId || !HasKeyframeTracks(id))
+	{
+		return false;
+	}
+	AnimationClip& clip = mClips[id];
+
+	auto compressed = std::make_shared<CompressedAnimationClip>();
+	report = compressed->Build(clip, mBoneHierarchy, maxPositionError);
+
+	// Only drop the tracks once the compressed clip is complete.
+	clip.Compressed = compressed;
+	clip.Packed = nullptr;
+	clip.Resampled = nullptr;
+	clip.BoneAnimations.clear();
+	clip.BoneAnimations.shrink_to_fit();
+	CacheClipTimes(id);
+
+	return true;
+}
+
+void Model::Set(std::vector<int>& boneHierarchy,
+	std::vector<XMFLOAT4X4>& boneOffsets,
+	std::unordered_map<std::string, AnimationClip>& animations)
+{
+	mBoneHierarchy = boneHierarchy;
+	mBoneOffsets = boneOffsets;
+
+	mBoneOffsetTransforms.resize(mBoneOffsets.size());
+	for (UINT i = 0; i < mBoneOffsets.size(); ++i)
+	{
+		XMVECTOR S, Q, P;
+		XMMatrixDecompose(&S, &Q, &P, XMLoadFloat4x4(&mBoneOffsets[i]));
+		mBoneOffsetTransforms[i].Set(S, Q, P);
+	}
+
+	// Hand out the ids in name order so they do not depend on the hash map.
+	mClipNames.clear();
+	for (const auto& e : animations)
+	{
+		mClipNames.push_back(e.first);
+	}
+	std::sort(mClipNames.begin(), mClipNames.end());
+
+	// The masks were built for the previous hierarchy.
+	mBoneMasks.clear();
+	mBoneMaskIds.clear();
+
+	mClips.resize(mClipNames.size());
+	mClipStartTimes.resize(mClipNames.size());
+	mClipEndTimes.resize(mClipNames.size());
+	mClipIds.clear();
+	for (ClipId clip = 0; clip < ClipCount(); ++clip)
+	{
+		mClips[clip] = animations[mClipNames[clip]];
+		mClipIds[mClipNames[clip]] = clip;
+		CacheClipTimes(clip);
+	}
+}
+
+void Model::CacheClipTimes(ClipId clip)
+{
+	mClipStartTimes[clip] = mClips[clip].GetClipStartTime();
+	mClipEndTimes[clip] = mClips[clip].GetClipEndTime();
+}
+
+void Model::GetFinalTransforms(const std::string& clipName, float timePos, std::vector<XMFLOAT3X4>& finalTransforms)const
+{
+	GetFinalTransforms(mClips[FindClip(clipName)], timePos, finalTransforms.data(), nullptr);
+}
+
+void Model::GetFinalTransforms(const std::string& clipName, float timePos, std::vector<XMFLOAT3X4>& finalTransforms,
+	AnimationSampler& sampler)const
+{
+	GetFinalTransforms(mClips[FindClip(clipName)], timePos, finalTransforms.data(), &sampler);
+}
+
+void Model::GetFinalTransforms(ClipId clip, float timePos, std::vector<XMFLOAT3X4>& finalTransforms,
+	AnimationSampler& sampler)const
+{
+	GetFinalTransforms(mClips[clip], timePos, finalTransforms.data(), &sampler);
+}
+
+void Model::GetFinalTransforms(ClipId clip, float timePos, XMFLOAT3X4* finalTransforms, AnimationSampler& sampler)const
+{
+	GetFinalTransforms(mClips[clip], timePos, finalTransforms, &sampler);
+}
+
+void Model::GetFinalTransforms(const AnimationClip& clip, float timePos, XMFLOAT3X4* finalTransforms,
+	AnimationSampler& sampler)const
+{
+	GetFinalTransforms(clip, timePos, finalTransforms, &sampler);
+}
+
+void Model::GetFinalTransforms(const std::vector<BoneTransform>& localPose, XMFLOAT3X4* finalTransforms,
+	AnimationSampler& sampler)const
+{
+	assert(localPose.size() == mBoneOffsets.size());
+	std::vector<BoneTransform>& pose = sampler.LocalPose;
+	pose.assign(localPose.begin(), localPose.end());
+	ConcatenateToRoot(pose);
+	WriteFinalTransforms(pose, finalTransforms);
+}
+
+void Model::GetFinalTransforms(ClipId clip, float timePos, BoneMaskId mask, std::vector<XMFLOAT3X4>& finalTransforms,
+	AnimationSampler& sampler)const
+{
+	const BoneSet& bones = mBoneMasks[mask].Evaluated;
+	std::vector<BoneTransform>& pose = sampler.LocalPose;
+	pose.resize(mBoneOffsets.size());
+
+	mClips[clip].Interpolate(timePos, pose, sampler, &bones);
+	ConcatenateToRoot(pose, &bones);
+	WriteFinalTransforms(pose, finalTransforms.data(), &bones);
+}
+
+void Model::GetFinalDualQuaternions(const std::string& clipName, float timePos, std::vector<XMFLOAT4>& palette)const
+{
+	GetFinalDualQuaternions(mClips[FindClip(clipName)], timePos, palette.data(), nullptr);
+}
+
+void Model::GetFinalDualQuaternions(ClipId clip, float timePos, std::vector<XMFLOAT4>& palette,
+	AnimationSampler& sampler)const
+{
+	GetFinalDualQuaternions(mClips[clip], timePos, palette.data(), &sampler);
+}
+
+void Model::GetFinalDualQuaternions(ClipId clip, float timePos, XMFLOAT4* palette, AnimationSampler& sampler)const
 {
-	// Keyframes are sorted by time, so first keyframe gives start time.
-	return Keyframes.front().Time;
+	GetFinalDualQuaternions(mClips[clip], timePos, palette, &sampler);
 }
 
-float BoneAnimation::GetEndTime()const
+void Model::EvaluateToRootPose(const AnimationClip& clip, float timePos, AnimationSampler& sampler)const
 {
-	// Keyframes are sorted by time, so last keyframe gives end time.
-	float f = Keyframes.back().Time;
+	UINT numBones = mBoneOffsets.size();
 
-	return f;
+	std::vector<BoneTransform>& pose = sampler.LocalPose;
+	pose.resize(numBones);
+
+	// Interpolate all the bones of this clip at the given time instance.
+	clip.Interpolate(timePos, pose, sampler);
+
+	ConcatenateToRoot(pose);
 }
 
-void BoneAnimation::Interpolate(float t, XMFLOAT4X4& M)const
+const std::vector<BoneTransform>& Model::EvaluateToRootPose(AnimationBlend& blend)const
 {
-	if (t <= Keyframes.front().Time)
+	assert(blend.mLayerCount > 0);
+
+	// Layers with zero weight are skipped, not sampled and scaled by 0.
+	float totalWeight = 0.0f;
+	UINT weightedLayerCount = 0;
+	UINT weightedLayer = AnimationBlend::MaxLayers;
+	UINT firstUnmaskedLayer = AnimationBlend::MaxLayers;
+	UINT overlayCount = 0;
+	for (UINT n = 0; n < blend.mLayerCount; ++n)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.front().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.front().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.front().RotationQuat);
+		const AnimationBlend::Layer& layer = blend.mLayers[n];
+		if (layer.Mask != InvalidBoneMaskId)
+		{
+			overlayCount += layer.Weight > 0.0f ? 1 : 0;
+			continue;
+		}
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+		firstUnmaskedLayer = min(firstUnmaskedLayer, n);
+		if (layer.Weight > 0.0f)
+		{
+			totalWeight += layer.Weight;
+			++weightedLayerCount;
+			weightedLayer = n;
+		}
 	}
-	else if (t >= Keyframes.back().Time)
+	assert(firstUnmaskedLayer != AnimationBlend::MaxLayers);
+	// Without weights the overlays play over the first unmasked layer.
+	UINT baseLayer = weightedLayerCount == 1 ? weightedLayer : firstUnmaskedLayer;
+
+	if (weightedLayerCount <= 1 && overlayCount == 0)
 	{
-		XMVECTOR S = XMLoadFloat3(&Keyframes.back().Scale);
-		XMVECTOR P = XMLoadFloat3(&Keyframes.back().Translation);
-		XMVECTOR Q = XMLoadFloat4(&Keyframes.back().RotationQuat);
+		// Nothing to blend: play the layer like a single clip.
+		AnimationBlend::Layer& layer = blend.mLayers[baseLayer];
+		EvaluateToRootPose(mClips[layer.Clip], layer.TimePos, layer.Sampler);
+		return layer.Sampler.LocalPose;
+	}
+
+	UINT numBones = mBoneOffsets.size();
+	std::vector<BoneTransform>& pose = blend.mPose;
+	pose.resize(numBones);
 
-		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-		XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+	if (weightedLayerCount <= 1)
+	{
+		// A single layer under the overlays is sampled straight into the pose.
+		AnimationBlend::Layer& layer = blend.mLayers[baseLayer];
+		mClips[layer.Clip].Interpolate(layer.TimePos, pose, layer.Sampler);
 	}
 	else
 	{
-		for (UINT i = 0; i < Keyframes.size() - 1; ++i)
+		const std::vector<BoneTransform>* layerPoses[AnimationBlend::MaxLayers];
+		float weights[AnimationBlend::MaxLayers];
+		UINT poseCount = 0;
+		for (UINT n = 0; n < blend.mLayerCount; ++n)
 		{
-			if (t >= Keyframes[i].Time && t <= Keyframes[i + 1].Time)
+			AnimationBlend::Layer& layer = blend.mLayers[n];
+			if (layer.Weight <= 0.0f || layer.Mask != InvalidBoneMaskId)
 			{
-				float lerpPercent = (t - Keyframes[i].Time) / (Keyframes[i + 1].Time - Keyframes[i].Time);
+				continue;
+			}
 
-				XMVECTOR s0 = XMLoadFloat3(&Keyframes[i].Scale);
-				XMVECTOR s1 = XMLoadFloat3(&Keyframes[i + 1].Scale);
+			std::vector<BoneTransform>& layerPose = layer.Sampler.LocalPose;
+			layerPose.resize(numBones);
+			mClips[layer.Clip].Interpolate(layer.TimePos, layerPose, layer.Sampler);
+			layerPoses[poseCount] = &layerPose;
+			weights[poseCount] = layer.Weight / totalWeight;
+			++poseCount;
+		}
+		BlendPoses(layerPoses, weights, poseCount, pose);
+	}
 
-				XMVECTOR p0 = XMLoadFloat3(&Keyframes[i].Translation);
-				XMVECTOR p1 = XMLoadFloat3(&Keyframes[i + 1].Translation);
+	// Overlays are sampled and blended on their masked bones only, so their
+	// cost follows the size of the mask.
+	for (UINT n = 0; n < blend.mLayerCount && overlayCount > 0; ++n)
+	{
+		AnimationBlend::Layer& layer = blend.mLayers[n];
+		if (layer.Weight <= 0.0f || layer.Mask == InvalidBoneMaskId)
+		{
+			continue;
+		}
 
-				XMVECTOR q0 = XMLoadFloat4(&Keyframes[i].RotationQuat);
-				XMVECTOR q1 = XMLoadFloat4(&Keyframes[i + 1].RotationQuat);
+		const BoneSet& bones = mBoneMasks[layer.Mask].Bones;
+		std::vector<BoneTransform>& layerPose = layer.Sampler.LocalPose;
+		layerPose.resize(numBones);
+		mClips[layer.Clip].Interpolate(layer.TimePos, layerPose, layer.Sampler, &bones);
+		OverlayPose(layerPose, min(layer.Weight, 1.0f), bones, pose);
+	}
 
-				XMVECTOR S = XMVectorLerp(s0, s1, lerpPercent);
-				XMVECTOR P = XMVectorLerp(p0, p1, lerpPercent);
-				XMVECTOR Q = XMQuaternionSlerp(q0, q1, lerpPercent);
+	// Concatenate renormalizes the rotation of every other bone.
+	XMStoreFloat4(&pose[0].Rotation, XMQuaternionNormalize(XMLoadFloat4(&pose[0].Rotation)));
+	ConcatenateToRoot(pose);
+	return pose;
+}
 
-				XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-				XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+void Model::ConcatenateToRoot(std::vector<BoneTransform>& pose, const BoneSet* bones)const
+{
+	//
+	// Traverse the hierarchy and transform all the bones to the root space.
+	// The pose stays in TRS form: parents come before their children, so each
+	// bone-to-parent transform is replaced in place by its bone-to-root one.
+	//
 
-				break;
+	// The root bone has index 0.  The root bone has no parent, so its toRootTransform
+	// is just its local bone transform.
+	if (bones != nullptr)
+	{
+		for (UINT i : bones->Bones)
+		{
+			if (i != 0)
+			{
+				pose[i] = pose[i].Concatenate(pose[mBoneHierarchy[i]]);
 			}
 		}
+		return;
+	}
+	for (UINT i = 1; i < pose.size(); ++i)
+	{
+		int parentIndex = mBoneHierarchy[i];
+		pose[i] = pose[i].Concatenate(pose[parentIndex]);
 	}
 }
 
-float AnimationClip::GetClipStartTime()const
+void Model::GetFinalTransforms(AnimationBlend& blend, std::vector<XMFLOAT3X4>& finalTransforms)const
 {
-	// Find smallest start time over all bones in this clip.
-	float t = MathHelper::Infinity;
-	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	WriteFinalTransforms(EvaluateToRootPose(blend), finalTransforms.data());
+}
+
+void Model::GetFinalTransforms(AnimationBlend& blend, XMFLOAT3X4* finalTransforms)const
+{
+	WriteFinalTransforms(EvaluateToRootPose(blend), finalTransforms);
+}
+
+void Model::GetFinalDualQuaternions(AnimationBlend& blend, std::vector<XMFLOAT4>& palette)const
+{
+	WriteFinalDualQuaternions(EvaluateToRootPose(blend), palette.data());
+}
+
+void Model::GetFinalDualQuaternions(AnimationBlend& blend, XMFLOAT4* palette)const
+{
+	WriteFinalDualQuaternions(EvaluateToRootPose(blend), palette);
+}
+
+void Model::GetFinalTransforms(const AnimationClip& clip, float timePos, XMFLOAT3X4* finalTransforms,
+	AnimationSampler* sampler)const
+{
+	// Without an instance to borrow scratch memory from, use a temporary one.
+	AnimationSampler localSampler;
+	if (sampler == nullptr)
 	{
-		t = min(t, BoneAnimations[i].GetStartTime());
+		sampler = &localSampler;
 	}
 
-	return t;
+	EvaluateToRootPose(clip, timePos, *sampler);
+	WriteFinalTransforms(sampler->LocalPose, finalTransforms);
 }
 
-float AnimationClip::GetClipEndTime()const
+void Model::EvaluateMany(InstanceState* instances, UINT instanceCount, std::vector<XMFLOAT3X4>& palette)const
 {
-	// Find largest end time over all bones in this clip.
-	float t = 0.0f;
-	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	// Instances per batch: few enough that their poses stay in the cache
+	// while the batch is walked once per track and once per bone.
+	const UINT batchSize = 16;
+
+	UINT runBegin = 0;
+	while (runBegin < instanceCount)
 	{
+		ClipId clip = instances[runBegin].Clip;
+		UINT runEnd = runBegin + 1;
+		while (runEnd < instanceCount && instances[runEnd].Clip == clip)
+		{
+			++runEnd;
+		}
 
-		t = max(t, BoneAnimations[i].GetEndTime());
+		for (UINT batchBegin = runBegin; batchBegin < runEnd; batchBegin += batchSize)
+		{
+			EvaluateBatch(mClips[clip], instances + batchBegin, min(batchSize, runEnd - batchBegin), palette);
+		}
+		runBegin = runEnd;
 	}
+}
 
-	return t;
+void Model::EvaluateBatch(const AnimationClip& clip, InstanceState* instances, UINT instanceCount,
+	std::vector<XMFLOAT3X4>& palette)const
+{
+	UINT numBones = BoneCount();
+
+	// Keyframe tracks are sampled track by track, so the keys of a track are
+	// read once for the whole batch. Packed, resampled and compressed clips
+	// sample every bone of an instance in one call.
+	bool sampleTracks = clip.Packed == nullptr && clip.Resampled == nullptr && clip.Compressed == nullptr;
+	for (UINT n = 0; n < instanceCount; ++n)
+	{
+		InstanceState& instance = instances[n];
+		assert(instance.PaletteOffset + numBones <= palette.size());
+
+		AnimationSampler& sampler = instance.Sampler;
+		sampler.LocalPose.resize(numBones);
+		if (!sampleTracks)
+		{
+			clip.Interpolate(instance.TimePos, sampler.LocalPose, sampler);
+		}
+		else if (sampler.Clip != &clip)
+		{
+			sampler.Reset(&clip);
+		}
+	}
+	if (sampleTracks)
+	{
+		assert(clip.BoneAnimations.size() == numBones);
+		for (UINT i = 0; i < numBones; ++i)
+		{
+			const BoneAnimation& track = clip.BoneAnimations[i];
+			for (UINT n = 0; n < instanceCount; ++n)
+			{
+				AnimationSampler& sampler = instances[n].Sampler;
+				track.Interpolate(instances[n].TimePos, sampler.LocalPose[i], sampler.KeyCursors[i]);
+			}
+		}
+	}
+
+	// Walk the hierarchy one bone at a time across the batch, as in ConcatenateToRoot.
+	for (UINT i = 1; i < numBones; ++i)
+	{
+		int parentIndex = mBoneHierarchy[i];
+		for (UINT n = 0; n < instanceCount; ++n)
+		{
+			std::vector<BoneTransform>& pose = instances[n].Sampler.LocalPose;
+			pose[i] = pose[i].Concatenate(pose[parentIndex]);
+		}
+	}
+
+	// Then premultiply by the bone offsets, as in WriteFinalTransforms.
+	for (UINT i = 0; i < numBones; ++i)
+	{
+		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
+		for (UINT n = 0; n < instanceCount; ++n)
+		{
+			XMMATRIX toRoot = instances[n].Sampler.LocalPose[i].ToMatrix();
+			XMStoreFloat3x4(&palette[instances[n].PaletteOffset + i], XMMatrixMultiply(offset, toRoot));
+		}
+	}
 }
 
-void AnimationClip::Interpolate(float t, std::vector<XMFLOAT4X4>& boneTransforms)const
+void Model::WriteFinalTransforms(const std::vector<BoneTransform>& toRootTransforms, XMFLOAT3X4* finalTransforms,
+	const BoneSet* bones)const
 {
-	for (UINT i = 0; i < BoneAnimations.size(); ++i)
+	// Convert to matrices only now, and premultiply by the bone offset
+	// transform to get the final transform.
+	UINT count = bones != nullptr ? (UINT)bones->Bones.size() : (UINT)toRootTransforms.size();
+	for (UINT n = 0; n < count; ++n)
 	{
-		BoneAnimations[i].Interpolate(t, boneTransforms[i]);
+		UINT i = bones != nullptr ? bones->Bones[n] : n;
+		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
+		XMMATRIX toRoot = toRootTransforms[i].ToMatrix();
+		XMMATRIX finalTransform = XMMatrixMultiply(offset, toRoot);
+		// XMStoreFloat3x4 stores the transpose without its constant last row.
+		XMStoreFloat3x4(&finalTransforms[i], finalTransform);
 	}
 }
 
-float Model::GetClipStartTime(const std::string& clipName)const
+void Model::GetFinalDualQuaternions(const AnimationClip& clip, float timePos, XMFLOAT4* palette,
+	AnimationSampler* sampler)const
 {
-	auto clip = mAnimations.find(clipName);
-	return clip->second.GetClipStartTime();
+	AnimationSampler localSampler;
+	if (sampler == nullptr)
+	{
+		sampler = &localSampler;
+	}
+
+	EvaluateToRootPose(clip, timePos, *sampler);
+	WriteFinalDualQuaternions(sampler->LocalPose, palette);
 }
 
-float Model::GetClipEndTime(const std::string& clipName)const
+void Model::WriteFinalDualQuaternions(const std::vector<BoneTransform>& toRootTransforms, XMFLOAT4* palette)const
 {
-	auto clip = mAnimations.find(clipName);
-	return clip->second.GetClipEndTime();
+	for (UINT i = 0; i < toRootTransforms.size(); ++i)
+	{
+		BoneTransform finalTransform = mBoneOffsetTransforms[i].Concatenate(toRootTransforms[i]);
+		finalTransform.ToDualQuaternion(palette[2 * i], palette[2 * i + 1]);
+	}
 }
 
-UINT Model::BoneCount()const
+void ModelInstance::EvaluateFinalTransforms(float timePos, XMFLOAT3X4* finalTransforms)
 {
-	return mBoneHierarchy.size();
+	if (Archive != nullptr)
+	{
+		UsingFallbackPose = !Archive->GetFinalTransforms(Clip, timePos, finalTransforms, Sampler);
+	}
+	else if (BakedPoses != nullptr && BakedPoses->GetClip() == Clip)
+	{
+		BakedPoses->Sample(timePos, finalTransforms, InterpolateBakedPoses);
+	}
+	else if (SharedPoses != nullptr)
+	{
+		SharedPoses->GetFinalTransforms(Clip, timePos, finalTransforms, Sampler);
+	}
+	else
+	{
+		ModelInfo->GetFinalTransforms(Clip, timePos, finalTransforms, Sampler);
+	}
 }
 
-void Model::Set(std::vector<int>& boneHierarchy,
-	std::vector<XMFLOAT4X4>& boneOffsets,
-	std::unordered_map<std::string, AnimationClip>& animations)
+size_t ModelInstance::UploadPalette(XMFLOAT3X4* palette, UINT64& uploadedVersion, PaletteUploadStats& stats)
 {
-	mBoneHierarchy = boneHierarchy;
-	mBoneOffsets = boneOffsets;
-	mAnimations = animations;
+	if (uploadedVersion == PoseVersion)
+	{
+		++stats.SkippedUploads;
+		return 0;
+	}
+
+	if (FinalPaletteVersion == PoseVersion && !DualQuaternionSkinning)
+	{
+		std::copy(FinalTransforms.begin(), FinalTransforms.end(), palette);
+	}
+	else
+	{
+		// Evaluating the same pose again gives the same palette, so every
+		// buffer that missed a pose catches up without a CPU-side copy.
+		EvaluatePalette(palette);
+	}
+	uploadedVersion = PoseVersion;
+
+	size_t bytes = ModelInfo->BoneCount() * sizeof(XMFLOAT3X4);
+	++stats.Uploads;
+	stats.UploadedBytes += bytes;
+	return bytes;
 }
 
-void Model::GetFinalTransforms(const std::string& clipName, float timePos, std::vector<XMFLOAT4X4>& finalTransforms)const
+size_t ModelInstance::UploadPalette(XMFLOAT4* dualQuaternions, UINT64& uploadedVersion, PaletteUploadStats& stats)
 {
-	UINT numBones = mBoneOffsets.size();
+	if (uploadedVersion == PoseVersion)
+	{
+		++stats.SkippedUploads;
+		return 0;
+	}
+
+	if (FinalPaletteVersion == PoseVersion && DualQuaternionSkinning)
+	{
+		std::copy(FinalDualQuaternions.begin(), FinalDualQuaternions.end(), dualQuaternions);
+	}
+	else
+	{
+		EvaluatePalette(dualQuaternions);
+	}
+	uploadedVersion = PoseVersion;
 
-	std::vector<XMFLOAT4X4> toParentTransforms(numBones);
+	size_t bytes = 2 * ModelInfo->BoneCount() * sizeof(XMFLOAT4);
+	++stats.Uploads;
+	stats.UploadedBytes += bytes;
+	return bytes;
+}
 
-	// Interpolate all the bones of this clip at the given time instance.
-	auto clip = mAnimations.find(clipName);
-	clip->second.Interpolate(timePos, toParentTransforms);
+ClipId ModelInstance::FindClip(const std::string& clipName)const
+{
+	return Archive != nullptr ? Archive->FindClip(clipName) : ModelInfo->FindClip(clipName);
+}
 
-	//
-	// Traverse the hierarchy and transform all the bones to the root space.
-	//
+float ModelInstance::GetClipEndTime()const
+{
+	return Archive != nullptr ? Archive->GetClipEndTime(Clip) : ModelInfo->GetClipEndTime(Clip);
+}
 
-	std::vector<XMFLOAT4X4> toRootTransforms(numBones);
+void ModelInstance::CrossfadeTo(const std::string& clipName, float duration)
+{
+	assert(Archive == nullptr);
+	BeginBlend();
+
+	Clip = ModelInfo->FindClip(clipName);
+	TimePos = 0.f;
+	Blend.CrossfadeTo(Clip, TimePos, duration);
+	FramesSinceLodUpdate = 0xffff;
+	LodNextInterval = 0;
+	++PoseVersion;
+	AdvanceBlend(0.0f);
+}
 
-	// The root bone has index 0.  The root bone has no parent, so its toRootTransform
-	// is just its local bone transform.
-	toRootTransforms[0] = toParentTransforms[0];
+UINT ModelInstance::AddOverlay(const std::string& clipName, const std::string& maskName, float weight)
+{
+	assert(Archive == nullptr);
+	BeginBlend();
+	FramesSinceLodUpdate = 0xffff;
+	LodNextInterval = 0;
+	++PoseVersion;
+	return Blend.AddLayer(ModelInfo->FindClip(clipName), 0.f, weight, ModelInfo->FindBoneMask(maskName));
+}
 
-	// Now find the toRootTransform of the children.
-	for (UINT i = 1; i < numBones; ++i)
+void ModelInstance::BeginBlend()
+{
+	if (Blend.LayerCount() == 0)
 	{
-		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
-		XMMATRIX toParent = XMLoadFloat4x4(&toParentTransforms[i]);
+		// Hand the playing clip over to the blend, cursors included.
+		Blend.Play(Clip, TimePos);
+		std::swap(Blend.GetLayer(0).Sampler, Sampler);
+	}
+}
 
-		int parentIndex = mBoneHierarchy[i];
-		XMMATRIX parentToRoot = XMLoadFloat4x4(&toRootTransforms[parentIndex]);
+void ModelInstance::AdvanceBlend(float dt)
+{
+	Blend.Update(*ModelInfo, dt);
+	if (!Blend.IsBlending())
+	{
+		AnimationBlend::Layer& layer = Blend.GetLayer(0);
+		Clip = layer.Clip;
+		TimePos = layer.TimePos;
+		std::swap(layer.Sampler, Sampler);
+		Blend.Clear();
+	}
+}
 
-		XMMATRIX toRoot = XMMatrixMultiply(toParent, parentToRoot);
-		XMStoreFloat4x4(&toRootTransforms[i], toRoot);
+bool ModelInstance::UpdateSkinnedAnimation(float dt, UINT frameIndex, AnimationLodStats& stats)
+{
+	UINT64 poseVersion = PoseVersion;
+	AdvanceTime(dt);
+	if (FinalPaletteVersion == PoseVersion)
+	{
+		// Paused, the palette is up to date.
+		++stats.SavedEvaluations;
+		return false;
+	}
 
+	if (Blend.IsBlending())
+	{
+		// Crossfades are short; evaluate them every frame whatever the LOD.
+		++stats.Evaluations;
+		FramesSinceLodUpdate = 0;
+		LodNextInterval = 0;
+		EvaluatePalette();
+		return true;
 	}
 
-	// Premultiply by the bone offset transform to get the final transform.
-	for (UINT i = 0; i < numBones; ++i)
+	UINT interval = GetAnimationLodInterval(Lod);
+	UINT framesSinceUpdate = ++FramesSinceLodUpdate;
+	bool interpolate = InterpolateLod && !DualQuaternionSkinning && interval > 1;
+
+	// Instances are staggered by LodPhase. One that is overdue, because its LOD
+	// was raised or it never evaluated, updates right away. So does one that
+	// interpolates without a pose evaluated ahead for this interval, because its
+	// LOD changed since: blending towards it would overshoot or stop short.
+	bool due = (frameIndex + LodPhase) % interval == 0 || framesSinceUpdate >= interval ||
+		(interpolate && LodNextInterval != interval);
+	if (!due)
 	{
-		XMMATRIX offset = XMLoadFloat4x4(&mBoneOffsets[i]);
-		XMMATRIX toRoot = XMLoadFloat4x4(&toRootTransforms[i]);
-		XMMATRIX finalTransform = XMMatrixMultiply(offset, toRoot);
-		XMStoreFloat4x4(&finalTransforms[i], XMMatrixTranspose(finalTransform));
+		++stats.SavedEvaluations;
+		if (interpolate)
+		{
+			// Linear blend of the matrices; the slight shrinking of fast
+			// rotations is not noticeable at the distances the LOD is used.
+			float s = (float)framesSinceUpdate / LodNextInterval;
+			for (UINT i = 0; i < FinalTransforms.size(); ++i)
+			{
+				XMMATRIX previous = XMLoadFloat3x4(&LodPreviousTransforms[i]);
+				XMMATRIX next = XMLoadFloat3x4(&LodNextTransforms[i]);
+				XMMATRIX M;
+				for (UINT r = 0; r < 4; ++r)
+				{
+					M.r[r] = XMVectorLerp(previous.r[r], next.r[r], s);
+				}
+				XMStoreFloat3x4(&FinalTransforms[i], M);
+			}
+			FinalPaletteVersion = PoseVersion;
+		}
+		else
+		{
+			// The palette is held, so buffers that hold it need no upload.
+			PoseVersion = poseVersion;
+		}
+		return false;
 	}
-}
 
+	FramesSinceLodUpdate = 0;
+	++stats.Evaluations;
+	if (!interpolate)
+	{
+		LodNextInterval = 0;
+		EvaluatePalette();
+		return true;
+	}
+
+	// The pose of this frame was evaluated ahead by the previous update, unless
+	// the update came early or late.
+	LodPreviousTransforms.resize(FinalTransforms.size());
+	LodNextTransforms.resize(FinalTransforms.size());
+	if (LodNextInterval == framesSinceUpdate)
+	{
+		LodPreviousTransforms.swap(LodNextTransforms);
+	}
+	else
+	{
+		EvaluateFinalTransforms(TimePos, LodPreviousTransforms.data());
+		++stats.Evaluations;
+	}
+
+	// Evaluate the pose of the next update ahead of time, assuming dt stays
+	// the same until then.
+	float nextTimePos = TimePos;
+	for (UINT i = 0; i < interval; ++i)
+	{
+		nextTimePos += dt;
+		if (nextTimePos > GetClipEndTime())
+		{
+			nextTimePos = 0.f;
+		}
+	}
+	EvaluateFinalTransforms(nextTimePos, LodNextTransforms.data());
+	LodNextInterval = interval;
+
+	std::copy(LodPreviousTransforms.begin(), LodPreviousTransforms.end(), FinalTransforms.begin());
+	FinalPaletteVersion = PoseVersion;
+	return true;
+}
 
 using namespace DirectX;
 
@@ -218,7 +1481,10 @@ bool M3DLoader::LoadM3d(const std::string& filename,
 		ReadTriangles(fin, numTriangles, indices);
 		ReadBoneOffsets(fin, numBones, boneOffsets);
 		ReadBoneHierarchy(fin, numBones, boneIndexToParentIndex);
-		ReadAnimationClips(fin, numBones, numAnimationClips, animations);
+		if (LoadAnimationClips)
+		{
+			ReadAnimationClips(fin, numBones, numAnimationClips, animations);
+		}
 
 		modelInfo.Set(boneIndexToParentIndex, boneOffsets, animations);
 
@@ -365,10 +1631,39 @@ void M3DLoader::ReadAnimationClips(std::ifstream& fin, UINT numBones, UINT numAn
 
 		for (UINT boneIndex = 0; boneIndex < numBones; ++boneIndex)
 		{
+			const BoneAnimation& boneAnimation = clip.BoneAnimations[boneIndex];
 			ReadBoneKeyframes(fin, numBones, clip.BoneAnimations[boneIndex]);
+
+			UINT constantChannels = 0;
+			for (AnimationChannelClass channelClass :
+				{ boneAnimation.TranslationClass, boneAnimation.RotationClass, boneAnimation.ScaleClass })
+			{
+				switch (channelClass)
+				{
+				case AnimationChannelAnimated: ++clip.Channels.AnimatedChannels; break;
+				case AnimationChannelConstant: ++clip.Channels.ConstantChannels; ++constantChannels; break;
+				case AnimationChannelIdentity: ++clip.Channels.IdentityChannels; ++constantChannels; break;
+				}
+			}
+			clip.Channels.ConstantTracks += constantChannels == 3 ? 1 : 0;
 		}
 		fin >> ignore; // }
 
+		if (ResampleRate > 0.0f)
+		{
+			auto resampled = std::make_shared<ResampledAnimationClip>();
+			resampled->Build(clip, ResampleRate);
+			clip.Resampled = resampled;
+			clip.BoneAnimations.clear();
+		}
+		else if (PackedClipLanes != 0)
+		{
+			auto packed = std::make_shared<PackedAnimationClip>();
+			packed->Build(clip, PackedClipLanes);
+			clip.Packed = packed;
+			clip.BoneAnimations.clear();
+		}
+
 		animations[clipName] = clip;
 	}
 }
@@ -399,4 +1694,81 @@ void M3DLoader::ReadBoneKeyframes(std::ifstream& fin, UINT numBones, BoneAnimati
 	}
 
 	fin >> ignore; // }
-}
\ No newline at end of file
+
+	if (ClassifyChannels)
+	{
+		boneAnimation.ClassifyChannels(ConstantChannelTolerances);
+	}
+}
+
+bool M3DWriter::SaveM3dAnimations(const std::string& sourceFilename, const std::string& filename, const Model& modelInfo)
+{
+	// Clips without their keyframe tracks would be written empty.
+	for (ClipId clip = 0; clip < modelInfo.ClipCount(); ++clip)
+	{
+		if (!modelInfo.HasKeyframeTracks(clip))
+		{
+			return false;
+		}
+	}
+
+	std::ifstream fin(sourceFilename);
+	if (!fin)
+	{
+		return false;
+	}
+
+	std::ofstream fout(filename);
+	if (!fout)
+	{
+		return false;
+	}
+	// Enough digits for floats to round-trip.
+	fout.precision(9);
+
+	// Copy everything up to the AnimationClips header text.
+	std::string line;
+	while (std::getline(fin, line))
+	{
+		if (line.find("AnimationClips*") != std::string::npos)
+		{
+			break;
+		}
+		fout << line << "\n";
+	}
+
+	WriteAnimationClips(fout, modelInfo);
+
+	return (bool)fout;
+}
+
+void M3DWriter::WriteAnimationClips(std::ofstream& fout, const Model& modelInfo)
+{
+	fout << "***************AnimationClips****************\n";
+	for (ClipId clip = 0; clip < modelInfo.ClipCount(); ++clip)
+	{
+		fout << "AnimationClip " << modelInfo.GetClipName(clip) << "\n";
+		fout << "{\n";
+
+		const auto& boneAnimations = modelInfo.GetClip(clip).BoneAnimations;
+		for (UINT boneIndex = 0; boneIndex < boneAnimations.size(); ++boneIndex)
+		{
+			WriteBoneKeyframes(fout, boneIndex, boneAnimations[boneIndex]);
+		}
+		fout << "}\n\n";
+	}
+}
+
+void M3DWriter::WriteBoneKeyframes(std::ofstream& fout, UINT boneIndex, const BoneAnimation& boneAnimation)
+{
+	fout << "\tBone" << boneIndex << " #Keyframes: " << boneAnimation.Keyframes.size() << "\n";
+	fout << "\t{\n";
+	for (const auto& key : boneAnimation.Keyframes)
+	{
+		fout << "\t\tTime: " << key.Time <<
+			" Pos: " << key.Translation.x << " " << key.Translation.y << " " << key.Translation.z <<
+			" Scale: " << key.Scale.x << " " << key.Scale.y << " " << key.Scale.z <<
+			" Quat: " << key.RotationQuat.x << " " << key.RotationQuat.y << " " << key.RotationQuat.z << " " << key.RotationQuat.w << "\n";
+	}
+	fout << "\t}\n\n";
+}
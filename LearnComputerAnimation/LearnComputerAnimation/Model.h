@@ -2,6 +2,11 @@
 #include "../Common/d3dUtil.h"
 #include "../Common/MathHelper.h"
 #include "Vertex.h"
+#include "AnimationPose.h"
+#include "PackedAnimationClip.h"
+#include "ResampledAnimationClip.h"
+#include "CompressedAnimationClip.h"
+#include "AnimationLod.h"
 
 struct Keyframe
 {
@@ -13,14 +18,100 @@ struct Keyframe
 	DirectX::XMFLOAT4 RotationQuat;
 };
 
+// Tolerances of the keyframe reduction pass. A key is dropped when
+// interpolating its neighbours reproduces it within all three.
+struct KeyframeReductionSettings
+{
+	float TranslationTolerance = 0.001f;
+	// Radians.
+	float RotationTolerance = 0.0005f;
+	float ScaleTolerance = 0.0001f;
+};
+
+struct KeyframeReductionReport
+{
+	UINT KeyframesBefore = 0;
+	UINT KeyframesAfter = 0;
+};
+
+// How a translation, rotation or scale channel of a BoneAnimation changes
+// over its keys, see BoneAnimation::ClassifyChannels.
+enum AnimationChannelClass
+{
+	AnimationChannelAnimated = 0,
+	// Every key is within the tolerance of the first one.
+	AnimationChannelConstant,
+	// Constant, and within the tolerance of the identity.
+	AnimationChannelIdentity
+};
+
+struct AnimationChannelReport
+{
+	// Channels of all the tracks of a clip, three per track, by class.
+	UINT AnimatedChannels = 0;
+	UINT ConstantChannels = 0;
+	UINT IdentityChannels = 0;
+	// Tracks whose three channels are constant or identity.
+	UINT ConstantTracks = 0;
+};
+
 struct BoneAnimation
 {
 	float GetStartTime()const;
 	float GetEndTime()const;
 
+	// Returns i such that Keyframes[i].Time <= t < Keyframes[i+1].Time.
+	// cursor is the pair found by the previous call: forward playback only
+	// steps it ahead, seeks and loops fall back to a binary search.
+	UINT FindKeyframe(float t, UINT& cursor)const;
+
 	void Interpolate(float t, DirectX::XMFLOAT4X4& M)const;
+	void Interpolate(float t, DirectX::XMFLOAT4X4& M, UINT& cursor)const;
+	void Interpolate(float t, BoneTransform& transform, UINT& cursor)const;
+
+	// Drops the keys that lerp (translation, scale) and slerp (rotation) of
+	// the kept neighbours reproduce. The first and last key always stay.
+	void ReduceKeyframes(const KeyframeReductionSettings& settings);
+
+	// Classifies each channel against the tolerances. The value of a constant
+	// channel is stored once in ConstantTransform, written back to every key,
+	// and Interpolate no longer blends it. A track with no animated channel
+	// keeps only its first and last key, for the clip times, and Interpolate
+	// returns ConstantTransform without looking the keys up.
+	void ClassifyChannels(const KeyframeReductionSettings& tolerances);
 
 	std::vector<Keyframe> Keyframes;
+
+	AnimationChannelClass TranslationClass = AnimationChannelAnimated;
+	AnimationChannelClass RotationClass = AnimationChannelAnimated;
+	AnimationChannelClass ScaleClass = AnimationChannelAnimated;
+	BoneTransform ConstantTransform;
+};
+
+// Finds the keys bracketing t in a time column whose entries are stride
+// floats apart, for the packed and compressed clip formats. Before the first
+// or after the last key both indices are clamped to that key. Same cursor
+// contract as BoneAnimation::FindKeyframe; cursor may be null.
+void FindKeyframePair(const float* times, UINT stride, UINT count, float t, UINT* cursor,
+	UINT& k0, UINT& k1, float& lerpPercent);
+
+struct AnimationClip;
+
+///<summary>
+/// Per-instance sampling state for an AnimationClip. Remembers the keyframe
+/// pair every BoneAnimation was last sampled at, so a playing instance finds
+/// its keys in O(1) amortized instead of searching the whole track.
+///</summary>
+struct AnimationSampler
+{
+	void Reset(const AnimationClip* clip);
+
+	// Clip the cursors belong to; the sampler resets itself when it changes.
+	const AnimationClip* Clip = nullptr;
+	std::vector<UINT> KeyCursors;
+
+	// Scratch pose the clip is sampled into, kept so playing does not allocate.
+	std::vector<BoneTransform> LocalPose;
 };
 
 ///<summary>
@@ -33,18 +124,148 @@ struct AnimationClip
 	float GetClipStartTime()const;
 	float GetClipEndTime()const;
 
+	// Samples the bone-to-parent transforms of every bone.
+	void Interpolate(float t, std::vector<BoneTransform>& pose)const;
+	// With bones, only those bones are sampled and the rest of pose is left as is.
+	void Interpolate(float t, std::vector<BoneTransform>& pose, AnimationSampler& sampler,
+		const BoneSet* bones = nullptr)const;
+
+	// Same as above, converted to matrices.
 	void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms)const;
+	void Interpolate(float t, std::vector<DirectX::XMFLOAT4X4>& boneTransforms, AnimationSampler& sampler)const;
+
+	// Number of key cursors an AnimationSampler needs for this clip.
+	UINT TrackCount()const;
+
+	// Reduces the keyframe tracks. Packed, Resampled and Compressed copies are
+	// built from the tracks, so reduce before creating them: fails without
+	// changing the clip if it has no tracks or already has one of the copies.
+	bool ReduceKeyframes(const KeyframeReductionSettings& settings, KeyframeReductionReport& report);
 
 	std::vector<BoneAnimation> BoneAnimations;
+
+	// Optional SoA copy of the tracks. When set it is used for sampling, and
+	// BoneAnimations may be empty if the clip was packed at load time.
+	std::shared_ptr<const PackedAnimationClip> Packed;
+
+	// Optional fixed-rate copy of the tracks; takes precedence over Packed.
+	std::shared_ptr<const ResampledAnimationClip> Resampled;
+
+	// Optional quantized copy of the tracks; takes precedence over the others.
+	std::shared_ptr<const CompressedAnimationClip> Compressed;
+
+	// Channel classes of the tracks, counted when the clip was loaded.
+	AnimationChannelReport Channels;
 };
 
 
+// Index of a clip inside its Model, resolved once with Model::FindClip so the
+// per-frame calls need no string lookups.
+typedef UINT ClipId;
+const ClipId InvalidClipId = 0xffffffff;
+
+// Index of a bone mask inside its Model, see Model::CreateBoneMask.
+typedef UINT BoneMaskId;
+const BoneMaskId InvalidBoneMaskId = 0xffffffff;
+
+///<summary>
+/// Animation state of one member of a crowd, see Model::EvaluateMany.
+///</summary>
+struct InstanceState
+{
+	ClipId Clip = InvalidClipId;
+	float TimePos = 0.0f;
+	// First entry of the instance in the palette given to EvaluateMany.
+	UINT PaletteOffset = 0;
+	AnimationSampler Sampler;
+};
+
+class Model;
+
+///<summary>
+/// Weighted blend of up to MaxLayers clips, each playing at its own time with
+/// its own AnimationSampler, evaluated by Model::GetFinalTransforms.
+/// CrossfadeTo fades a clip in while the other layers fade out; layers can
+/// also be weighted by hand with AddLayer and SetWeight. The weights are
+/// normalized when the pose is evaluated, and layers with zero weight are
+/// not sampled at all, so a blend with one weighted layer costs the same as
+/// playing that clip.
+///</summary>
+class AnimationBlend
+{
+public:
+	static const UINT MaxLayers = 4;
+
+	struct Layer
+	{
+		ClipId Clip = InvalidClipId;
+		float TimePos = 0.0f;
+		float Weight = 0.0f;
+		// Weight change per second; a layer is removed once it fades out.
+		float FadeRate = 0.0f;
+		// A masked layer is an overlay: it is blended by its own weight over
+		// the pose of the unmasked layers, on the masked bones only.
+		BoneMaskId Mask = InvalidBoneMaskId;
+		AnimationSampler Sampler;
+	};
+
+	// Plays clip alone.
+	void Play(ClipId clip, float timePos);
+	// Fades clip in over duration seconds while every other unmasked layer
+	// fades out; overlays keep playing. When all the layers are in use the
+	// lightest unmasked one is dropped first.
+	void CrossfadeTo(ClipId clip, float timePos, float duration);
+	// Adds a layer with a fixed weight and returns its index, or MaxLayers if
+	// all the layers are in use.
+	UINT AddLayer(ClipId clip, float timePos, float weight, BoneMaskId mask = InvalidBoneMaskId);
+	void SetWeight(UINT layer, float weight);
+	void Clear();
+
+	// Advances every layer, looping at the end of its clip, and the fades.
+	// Layers that faded out are removed and the indices of the later ones
+	// move down.
+	void Update(const Model& model, float dt);
+
+	// True while more than one layer is left.
+	bool IsBlending()const;
+	UINT LayerCount()const;
+	const Layer& GetLayer(UINT layer)const;
+	Layer& GetLayer(UINT layer);
+
+private:
+	friend class Model;
+
+	void RemoveLayer(UINT layer);
+
+	Layer mLayers[MaxLayers];
+	UINT mLayerCount = 0;
+	// Scratch blended pose, kept so playing does not allocate.
+	std::vector<BoneTransform> mPose;
+};
+
 class Model
 {
 public:
 
 	UINT BoneCount()const;
+	const std::vector<int>& GetBoneHierarchy()const;
 
+	// Builds a mask of the subtrees of rootBones, once per Model; the masks
+	// are cleared by Set. Returns the id of an existing mask with that name.
+	BoneMaskId CreateBoneMask(const std::string& maskName, const std::vector<UINT>& rootBones);
+	// Returns InvalidBoneMaskId if the model has no mask with that name.
+	BoneMaskId FindBoneMask(const std::string& maskName)const;
+	const BoneMask& GetBoneMask(BoneMaskId mask)const;
+
+	// Returns InvalidClipId if the model has no clip with that name.
+	ClipId FindClip(const std::string& clipName)const;
+	UINT ClipCount()const;
+	const std::string& GetClipName(ClipId clip)const;
+	const AnimationClip& GetClip(ClipId clip)const;
+
+	// Cached when the clips are set, no per-bone scan.
+	float GetClipStartTime(ClipId clip)const;
+	float GetClipEndTime(ClipId clip)const;
 	float GetClipStartTime(const std::string& clipName)const;
 	float GetClipEndTime(const std::string& clipName)const;
 
@@ -53,19 +274,142 @@ public:
 		std::vector<DirectX::XMFLOAT4X4>& boneOffsets,
 		std::unordered_map<std::string, AnimationClip>& animations);
 
-	// In a real project, you'd want to cache the result if there was a chance
-	// that you were calling this several times with the same clipName at 
-	// the same timePos.
+	const std::vector<DirectX::XMFLOAT4X4>& GetBoneOffsets()const;
+
+	// Whether the clip still has one keyframe track per bone. Packing,
+	// resampling or compressing a clip drops its tracks.
+	bool HasKeyframeTracks(ClipId clip)const;
+
+	// Runs the keyframe reduction pass over every clip, e.g. right after
+	// M3DLoader::LoadM3d. Fails without changing any clip if one of them
+	// cannot be reduced, see AnimationClip::ReduceKeyframes.
+	bool ReduceKeyframes(const KeyframeReductionSettings& settings, KeyframeReductionReport& report);
+
+	// Replaces the keyframes of a clip with a CompressedAnimationClip whose
+	// bone tips stay within maxPositionError of the original. Fails without
+	// changing the clip if there is no clip with that name or it has no
+	// keyframe tracks left, e.g. because it was already compressed.
+	bool CompressClip(const std::string& clipName, float maxPositionError, AnimationCompressionReport& report);
+
+	// Instances that may ask for the same clip at the same timePos can share
+	// the results through a PoseCache.
+	// finalTransforms must hold BoneCount() entries. Each one is the transposed
+	// final transform without its constant (0, 0, 0, 1) column, ready for the
+	// float3x4 palette of the shader. The pose stays in TRS form until the
+	// final transforms are written. This overload allocates its scratch pose;
+	// playing instances should pass their AnimationSampler.
 	void GetFinalTransforms(const std::string& clipName, float timePos,
-		std::vector<DirectX::XMFLOAT4X4>& finalTransforms)const;
+		std::vector<DirectX::XMFLOAT3X4>& finalTransforms)const;
+	// Same as above, but reuses the keyframe cursors and scratch pose of a
+	// playing instance, so steady-state calls do not allocate.
+	void GetFinalTransforms(const std::string& clipName, float timePos,
+		std::vector<DirectX::XMFLOAT3X4>& finalTransforms, AnimationSampler& sampler)const;
+	void GetFinalTransforms(ClipId clip, float timePos,
+		std::vector<DirectX::XMFLOAT3X4>& finalTransforms, AnimationSampler& sampler)const;
+	// Writes the BoneCount() entries to finalTransforms, which may point
+	// straight into a mapped upload buffer such as the SkinnedCB slot of the
+	// current frame resource. The entries are only written, never read back,
+	// so write-combined memory is fine.
+	void GetFinalTransforms(ClipId clip, float timePos,
+		DirectX::XMFLOAT3X4* finalTransforms, AnimationSampler& sampler)const;
+	// Partial evaluation: samples and concatenates only the bones of mask and
+	// their ancestors, and writes only their final transforms, so the cost
+	// follows the size of the mask. The other entries are left as they are.
+	void GetFinalTransforms(ClipId clip, float timePos, BoneMaskId mask,
+		std::vector<DirectX::XMFLOAT3X4>& finalTransforms, AnimationSampler& sampler)const;
+	// Same for a clip the model does not own, such as a streamed clip of an
+	// AnimationArchive, which must have a track per bone of the model.
+	void GetFinalTransforms(const AnimationClip& clip, float timePos,
+		DirectX::XMFLOAT3X4* finalTransforms, AnimationSampler& sampler)const;
+	// Same for a pose sampled elsewhere: localPose holds the bone-to-parent
+	// transform of every bone.
+	void GetFinalTransforms(const std::vector<BoneTransform>& localPose,
+		DirectX::XMFLOAT3X4* finalTransforms, AnimationSampler& sampler)const;
+
+	// Dual quaternion skinning palette: two float4 per bone, the rotation
+	// followed by the dual part (see BoneTransform::ToDualQuaternion), so
+	// palette must hold 2 * BoneCount() entries. Only the rigid part of the
+	// final transforms is kept.
+	void GetFinalDualQuaternions(const std::string& clipName, float timePos,
+		std::vector<DirectX::XMFLOAT4>& palette)const;
+	void GetFinalDualQuaternions(ClipId clip, float timePos,
+		std::vector<DirectX::XMFLOAT4>& palette, AnimationSampler& sampler)const;
+	void GetFinalDualQuaternions(ClipId clip, float timePos,
+		DirectX::XMFLOAT4* palette, AnimationSampler& sampler)const;
+
+	// Same as above for the blended pose of every weighted layer of blend.
+	// Blends the bone-to-parent poses, so the hierarchy is walked and the
+	// palette written once whatever the number of layers.
+	void GetFinalTransforms(AnimationBlend& blend, std::vector<DirectX::XMFLOAT3X4>& finalTransforms)const;
+	void GetFinalTransforms(AnimationBlend& blend, DirectX::XMFLOAT3X4* finalTransforms)const;
+	void GetFinalDualQuaternions(AnimationBlend& blend, std::vector<DirectX::XMFLOAT4>& palette)const;
+	void GetFinalDualQuaternions(AnimationBlend& blend, DirectX::XMFLOAT4* palette)const;
+
+	// Evaluates a whole crowd in one call. Each instance writes its BoneCount()
+	// final transforms, laid out as in GetFinalTransforms, to palette starting
+	// at its PaletteOffset. Runs of consecutive instances playing the same clip
+	// are evaluated in batches, one track and one bone at a time across the
+	// batch, so keep instances grouped by clip.
+	void EvaluateMany(InstanceState* instances, UINT instanceCount,
+		std::vector<DirectX::XMFLOAT3X4>& palette)const;
 
 private:
+	void GetFinalTransforms(const AnimationClip& clip, float timePos,
+		DirectX::XMFLOAT3X4* finalTransforms, AnimationSampler* sampler)const;
+	void GetFinalDualQuaternions(const AnimationClip& clip, float timePos,
+		DirectX::XMFLOAT4* palette, AnimationSampler* sampler)const;
+
+	// Samples the clip and walks the hierarchy, leaving the bone-to-root
+	// transforms in sampler.LocalPose.
+	void EvaluateToRootPose(const AnimationClip& clip, float timePos, AnimationSampler& sampler)const;
+	// Same for a blend; returns the pose holding the bone-to-root transforms.
+	const std::vector<BoneTransform>& EvaluateToRootPose(AnimationBlend& blend)const;
+	// EvaluateMany for instances that all play clip.
+	void EvaluateBatch(const AnimationClip& clip, InstanceState* instances, UINT instanceCount,
+		std::vector<DirectX::XMFLOAT3X4>& palette)const;
+	// Replaces the bone-to-parent transforms of pose by bone-to-root ones,
+	// for every bone or only for bones, which must hold its ancestors.
+	void ConcatenateToRoot(std::vector<BoneTransform>& pose, const BoneSet* bones = nullptr)const;
+	// Premultiplies the bone-to-root transforms by the bone offsets.
+	void WriteFinalTransforms(const std::vector<BoneTransform>& toRootTransforms,
+		DirectX::XMFLOAT3X4* finalTransforms, const BoneSet* bones = nullptr)const;
+	void WriteFinalDualQuaternions(const std::vector<BoneTransform>& toRootTransforms,
+		DirectX::XMFLOAT4* palette)const;
+
+	void CacheClipTimes(ClipId clip);
+
+
 	// Gives parentIndex of ith bone.
 	std::vector<int> mBoneHierarchy;
 
 	std::vector<DirectX::XMFLOAT4X4> mBoneOffsets;
+	// mBoneOffsets decomposed, for the dual quaternion palette.
+	std::vector<BoneTransform> mBoneOffsetTransforms;
+
+	// Clips indexed by ClipId, sorted by name.
+	std::vector<AnimationClip> mClips;
+	std::vector<std::string> mClipNames;
+	std::vector<float> mClipStartTimes;
+	std::vector<float> mClipEndTimes;
+	std::unordered_map<std::string, ClipId> mClipIds;
+
+	// Masks indexed by BoneMaskId, in creation order.
+	std::vector<BoneMask> mBoneMasks;
+	std::unordered_map<std::string, BoneMaskId> mBoneMaskIds;
+};
+
+class PoseCache;
+class BakedClip;
+class AnimationArchive;
 
-	std::unordered_map<std::string, AnimationClip> mAnimations;
+// Per-frame counters of ModelInstance::UploadPalette, reset by the caller
+// every frame.
+struct PaletteUploadStats
+{
+	UINT Uploads = 0;
+	// Buffers that already held the current pose.
+	UINT SkippedUploads = 0;
+	UINT64 UploadedBytes = 0;
 };
 
 // 运行时蒙皮网格实例
@@ -73,23 +417,171 @@ struct ModelInstance
 {
 	Model* ModelInfo = nullptr;
 	// 存储给定时间点的最终变化
-	std::vector<DirectX::XMFLOAT4X4> FinalTransforms;
-	// 当前动画名称 
-	std::string ClipName;
+	std::vector<DirectX::XMFLOAT3X4> FinalTransforms;
+	// 对偶四元数蒙皮时使用, 每个骨骼两个float4
+	bool DualQuaternionSkinning = false;
+	std::vector<DirectX::XMFLOAT4> FinalDualQuaternions;
+	// 当前动画, 由SetClip从名称解析. 混合时是正在淡入的动画
+	ClipId Clip = InvalidClipId;
 	// 当前时间点
 	float TimePos = 0.f;
+	// 关键帧查找缓存
+	AnimationSampler Sampler;
+	// 在BonePalette中的偏移, 由BonePalette::Allocate分配
+	UINT BonePaletteOffset = 0;
+	// 这个实例在每个上传缓冲区中写入的姿势版本, 传给UploadPalette. 由上传的程序分配和编号,
+	// 比如每个FrameResource的SkinnedCB, SkinnedDqCB和BonePaletteBuffer各一个
+	std::vector<UINT64> UploadedPoseVersions;
+	// 同一Model的实例共享的姿势缓存, 可以为空. 只用于矩阵调色板
+	PoseCache* SharedPoses = nullptr;
+	// 预先烘焙的当前动画, 可以为空. 优先于SharedPoses, 只用于矩阵调色板
+	const BakedClip* BakedPoses = nullptr;
+	// 在烘焙的两帧之间插值, 否则直接拷贝最近的一帧
+	bool InterpolateBakedPoses = true;
+	// 按需加载的动画库, 可以为空. 非空时Clip是Archive中的动画, 加载完成前播放它的后备姿势.
+	// 优先于BakedPoses和SharedPoses, 只用于矩阵调色板, 不能混合
+	AnimationArchive* Archive = nullptr;
+	// 上一次求值用的是后备姿势, 动画加载完成后姿势会变化
+	bool UsingFallbackPose = false;
+
+	// 多个动画的混合, 由CrossfadeTo开始, 只剩一个动画时回到单个动画播放
+	AnimationBlend Blend;
+
+	// 动画LOD, 远处或屏幕外的角色降低求值频率, 见SelectAnimationLod
+	AnimationLod Lod = AnimationLodFull;
+	// 错开求值的帧, 同一LOD的实例取不同的值可以让每帧的开销保持平稳
+	UINT LodPhase = 0;
+	// 两次求值之间插值调色板, 否则保持上一次的结果. 只用于矩阵调色板
+	bool InterpolateLod = false;
+	// 距离上一次求值的帧数, 初始值足够大, 保证第一次更新时求值
+	UINT FramesSinceLodUpdate = 0xffff;
+	// 暂停时AdvanceTime不推进时间, 姿势不变, 也就不再求值和上传
+	bool Paused = false;
+	// 姿势的版本, 每次姿势变化时加1. 每个上传缓冲区记下自己写入的版本, 相同时跳过求值和上传,
+	// 见UploadPalette. 直接修改Clip, TimePos或Blend后需要手动加1
+	UINT64 PoseVersion = 1;
+	// FinalTransforms或FinalDualQuaternions中的姿势的版本, 由DualQuaternionSkinning决定是哪一个.
+	// 修改DualQuaternionSkinning后需要清零
+	UINT64 FinalPaletteVersion = 0;
+
+	// 插值时使用: 本次求值时的调色板, 和提前求出的下一次求值时的调色板
+	std::vector<DirectX::XMFLOAT3X4> LodPreviousTransforms;
+	std::vector<DirectX::XMFLOAT3X4> LodNextTransforms;
+	// LodNextTransforms对应的帧数, 0表示无效
+	UINT LodNextInterval = 0;
+
+	void SetClip(const std::string& clipName)
+	{
+		Clip = FindClip(clipName);
+		TimePos = 0.f;
+		Blend.Clear();
+		FramesSinceLodUpdate = 0xffff;
+		LodNextInterval = 0;
+		++PoseVersion;
+	}
+
+	// 在duration秒内从当前动画(或混合)过渡到clipName
+	void CrossfadeTo(const std::string& clipName, float duration);
+	// 在maskName的骨骼上以weight叠加播放clipName, 比如只播放上半身的动画. 返回Blend中的层
+	UINT AddOverlay(const std::string& clipName, const std::string& maskName, float weight);
 
 	void UpdateSkinnedAnimation(float dt)
 	{
+		AdvanceTime(dt);
+		if (FinalPaletteVersion != PoseVersion)
+		{
+			EvaluatePalette();
+		}
+	}
+
+	// 按Lod更新, frameIndex每帧加1. 返回本帧是否对动画求值, 并累计到stats.
+	bool UpdateSkinnedAnimation(float dt, UINT frameIndex, AnimationLodStats& stats);
+
+	void AdvanceTime(float dt)
+	{
+		if (UsingFallbackPose)
+		{
+			// 动画可能已经加载完成, 需要重新求值
+			++PoseVersion;
+		}
+		if (Paused || dt == 0.f)
+		{
+			return;
+		}
+		++PoseVersion;
+
+		if (Blend.LayerCount() > 0)
+		{
+			AdvanceBlend(dt);
+			return;
+		}
+
 		TimePos += dt;
 		// Loop
-		if (TimePos > ModelInfo->GetClipEndTime(ClipName))
+		if (TimePos > GetClipEndTime())
 		{
 			TimePos = 0.f;
 		}
-		ModelInfo->GetFinalTransforms(ClipName, TimePos, FinalTransforms);
 	}
 
+	// 在Archive或者ModelInfo中查找动画
+	ClipId FindClip(const std::string& clipName)const;
+	float GetClipEndTime()const;
+
+	void EvaluatePalette()
+	{
+		if (DualQuaternionSkinning)
+		{
+			EvaluatePalette(FinalDualQuaternions.data());
+		}
+		else
+		{
+			EvaluatePalette(FinalTransforms.data());
+		}
+		FinalPaletteVersion = PoseVersion;
+	}
+
+	// 直接写入给定的调色板, 比如当前FrameResource中映射的SkinnedCB, 省去经过FinalTransforms
+	// 和SkinnedConstants的两次拷贝. 只写不读, 所以可以是上传堆的write-combined内存.
+	// 每次都写入全部骨骼, 不能和按Lod更新一起使用
+	void EvaluatePalette(DirectX::XMFLOAT3X4* finalTransforms)
+	{
+		if (Blend.IsBlending())
+		{
+			ModelInfo->GetFinalTransforms(Blend, finalTransforms);
+		}
+		else
+		{
+			EvaluateFinalTransforms(TimePos, finalTransforms);
+		}
+	}
+	void EvaluatePalette(DirectX::XMFLOAT4* dualQuaternions)
+	{
+		assert(Archive == nullptr);
+		if (Blend.IsBlending())
+		{
+			ModelInfo->GetFinalDualQuaternions(Blend, dualQuaternions);
+		}
+		else
+		{
+			ModelInfo->GetFinalDualQuaternions(Clip, TimePos, dualQuaternions, Sampler);
+		}
+	}
+
+	// 求出当前动画在timePos的最终变换, 有BakedPoses时从烘焙的表中采样, 有SharedPoses时从缓存中读取
+	void EvaluateFinalTransforms(float timePos, DirectX::XMFLOAT3X4* finalTransforms);
+
+	// 把当前姿势写入上传缓冲区palette, uploadedVersion是palette中这个实例的姿势版本, 每个实例
+	// 在每个缓冲区(比如每个FrameResource的SkinnedCB)各存一份, 见UploadedPoseVersions. 版本相同时什么也不做. FinalTransforms是
+	// 当前姿势时(比如按Lod更新)直接拷贝, 否则求值到palette中. 返回写入的字节数, 并累计到stats
+	size_t UploadPalette(DirectX::XMFLOAT3X4* palette, UINT64& uploadedVersion, PaletteUploadStats& stats);
+	size_t UploadPalette(DirectX::XMFLOAT4* dualQuaternions, UINT64& uploadedVersion, PaletteUploadStats& stats);
+
+	// 开始混合: 把当前动画交给Blend的第一层
+	void BeginBlend();
+	// 推进混合, 淡入完成后把剩下的动画交还给Clip, TimePos和Sampler
+	void AdvanceBlend(float dt);
+
 };
 
 class M3DLoader
@@ -117,6 +609,21 @@ public:
 		std::string NormalMapName;
 	};
 	
+	// 0 keeps the clips as per-bone keyframe tracks. 4 or 8 packs every clip
+	// into a PackedAnimationClip with that many bones per SIMD group and
+	// drops the per-bone tracks.
+	UINT PackedClipLanes = 0;
+	// 0 keeps the clips as loaded. Otherwise every clip is resampled into a
+	// ResampledAnimationClip at this many frames per second and the per-bone
+	// tracks are dropped. Takes precedence over PackedClipLanes.
+	float ResampleRate = 0.0f;
+	// false skips the clips, e.g. when they stream from an AnimationArchive.
+	bool LoadAnimationClips = true;
+	// Channels of the keyframe tracks that stay within these tolerances are
+	// stored once and skipped when sampling, see BoneAnimation::ClassifyChannels.
+	bool ClassifyChannels = true;
+	KeyframeReductionSettings ConstantChannelTolerances;
+
 	bool LoadM3d(const std::string& filename,
 		std::vector<SkinnedVertex>& vertices,
 		std::vector<USHORT>& indices,
@@ -134,4 +641,18 @@ private:
 	void ReadAnimationClips(std::ifstream& fin, UINT numBones, UINT numAnimationClips, std::unordered_map<std::string, AnimationClip>& animations);
 	void ReadBoneKeyframes(std::ifstream& fin, UINT numBones, BoneAnimation& boneAnimation);
 
+};
+
+class M3DWriter
+{
+public:
+	// Writes a copy of sourceFilename with its AnimationClips section replaced
+	// by the keyframe tracks of modelInfo. Everything before that section is
+	// copied verbatim, so the mesh data round-trips exactly. Fails if a clip
+	// has no keyframe tracks left, see Model::HasKeyframeTracks.
+	bool SaveM3dAnimations(const std::string& sourceFilename, const std::string& filename, const Model& modelInfo);
+
+private:
+	void WriteAnimationClips(std::ofstream& fout, const Model& modelInfo);
+	void WriteBoneKeyframes(std::ofstream& fout, UINT boneIndex, const BoneAnimation& boneAnimation);
 };
\ No newline at end of file
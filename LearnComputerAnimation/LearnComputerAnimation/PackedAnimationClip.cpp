@@ -0,0 +1,245 @@
+#include "PackedAnimationClip.h"
+#include "Model.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Loads one component of 4 lanes. When all the lanes sit on the same row
+	// this is a single vector load, otherwise the lanes are gathered.
+	XMVECTOR LoadLanes(const float* component, UINT rowStride, const UINT rows[4], bool sameRow)
+	{
+		if (sameRow)
+		{
+			return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(component + rows[0] * rowStride));
+		}
+
+		return XMVectorSet(
+			component[rows[0] * rowStride + 0],
+			component[rows[1] * rowStride + 1],
+			component[rows[2] * rowStride + 2],
+			component[rows[3] * rowStride + 3]);
+	}
+
+	// Slerp of 4 quaternions stored component-wise: q[0] holds the x of all lanes, etc.
+	void SlerpLanes(const XMVECTOR q0[4], const XMVECTOR q1[4], FXMVECTOR t, XMVECTOR q[4])
+	{
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR oneMinusEpsilon = XMVectorReplicate(1.0f - 0.00001f);
+
+		XMVECTOR cosOmega = XMVectorMultiply(q0[0], q1[0]);
+		cosOmega = XMVectorMultiplyAdd(q0[1], q1[1], cosOmega);
+		cosOmega = XMVectorMultiplyAdd(q0[2], q1[2], cosOmega);
+		cosOmega = XMVectorMultiplyAdd(q0[3], q1[3], cosOmega);
+
+		// Take the shorter arc.
+		XMVECTOR sign = XMVectorSelect(one, XMVectorNegate(one), XMVectorLess(cosOmega, XMVectorZero()));
+		cosOmega = XMVectorMultiply(cosOmega, sign);
+
+		XMVECTOR omega = XMVectorACos(XMVectorMin(cosOmega, one));
+		XMVECTOR invSinOmega = XMVectorReciprocal(XMVectorSin(omega));
+
+		XMVECTOR w0 = XMVectorMultiply(XMVectorSin(XMVectorMultiply(XMVectorSubtract(one, t), omega)), invSinOmega);
+		XMVECTOR w1 = XMVectorMultiply(XMVectorSin(XMVectorMultiply(t, omega)), invSinOmega);
+
+		// Nearly identical rotations: fall back to lerp to avoid dividing by ~0.
+		XMVECTOR linear = XMVectorGreater(cosOmega, oneMinusEpsilon);
+		w0 = XMVectorSelect(w0, XMVectorSubtract(one, t), linear);
+		w1 = XMVectorSelect(w1, t, linear);
+		w1 = XMVectorMultiply(w1, sign);
+
+		for (int c = 0; c < 4; ++c)
+		{
+			q[c] = XMVectorMultiplyAdd(q0[c], w0, XMVectorMultiply(q1[c], w1));
+		}
+	}
+}
+
+void PackedAnimationClip::Build(const AnimationClip& clip, UINT lanes)
+{
+	assert(lanes == 4 || lanes == 8);
+
+	Lanes = lanes;
+	BoneCount = (UINT)clip.BoneAnimations.size();
+	GroupCount = (BoneCount + Lanes - 1) / Lanes;
+	StartTime = clip.GetClipStartTime();
+	EndTime = clip.GetClipEndTime();
+
+	GroupKeyStart.assign(GroupCount, 0);
+	GroupKeyCount.assign(GroupCount, 0);
+	GroupSharedTimes.assign(GroupCount, true);
+	BoneKeyCount.assign(GroupCount * Lanes, 1);
+
+	UINT rowCount = 0;
+	for (UINT g = 0; g < GroupCount; ++g)
+	{
+		UINT keyCount = 1;
+		const BoneAnimation* first = &clip.BoneAnimations[g * Lanes];
+		for (UINT lane = 0; lane < Lanes; ++lane)
+		{
+			UINT bone = g * Lanes + lane;
+			if (bone >= BoneCount)
+			{
+				// Padding lanes follow the first track so they never split a shared group.
+				BoneKeyCount[bone] = (UINT)first->Keyframes.size();
+				continue;
+			}
+
+			const auto& keys = clip.BoneAnimations[bone].Keyframes;
+			BoneKeyCount[bone] = (UINT)keys.size();
+			keyCount = max(keyCount, (UINT)keys.size());
+
+			bool sameTimes = keys.size() == first->Keyframes.size();
+			for (UINT k = 0; sameTimes && k < keys.size(); ++k)
+			{
+				sameTimes = keys[k].Time == first->Keyframes[k].Time;
+			}
+			GroupSharedTimes[g] = GroupSharedTimes[g] && sameTimes;
+		}
+
+		GroupKeyStart[g] = rowCount;
+		GroupKeyCount[g] = keyCount;
+		rowCount += keyCount;
+	}
+
+	TimeStream = 0;
+	TranslationStream = TimeStream + rowCount * Lanes;
+	RotationStream = TranslationStream + rowCount * 3 * Lanes;
+	ScaleStream = RotationStream + rowCount * 4 * Lanes;
+	Data.assign(ScaleStream + rowCount * 3 * Lanes, 0.0f);
+
+	for (UINT g = 0; g < GroupCount; ++g)
+	{
+		const BoneAnimation* first = &clip.BoneAnimations[g * Lanes];
+		for (UINT lane = 0; lane < Lanes; ++lane)
+		{
+			UINT bone = g * Lanes + lane;
+			Keyframe identity;
+			for (UINT k = 0; k < GroupKeyCount[g]; ++k)
+			{
+				UINT row = GroupKeyStart[g] + k;
+
+				const Keyframe* key = &identity;
+				float time = first->Keyframes[min(k, (UINT)first->Keyframes.size() - 1)].Time;
+				if (bone < BoneCount)
+				{
+					const auto& keys = clip.BoneAnimations[bone].Keyframes;
+					key = &keys[min(k, (UINT)keys.size() - 1)];
+					time = key->Time;
+				}
+
+				Data[TimeStream + row * Lanes + lane] = time;
+
+				Data[TranslationStream + (row * 3 + 0) * Lanes + lane] = key->Translation.x;
+				Data[TranslationStream + (row * 3 + 1) * Lanes + lane] = key->Translation.y;
+				Data[TranslationStream + (row * 3 + 2) * Lanes + lane] = key->Translation.z;
+
+				Data[RotationStream + (row * 4 + 0) * Lanes + lane] = key->RotationQuat.x;
+				Data[RotationStream + (row * 4 + 1) * Lanes + lane] = key->RotationQuat.y;
+				Data[RotationStream + (row * 4 + 2) * Lanes + lane] = key->RotationQuat.z;
+				Data[RotationStream + (row * 4 + 3) * Lanes + lane] = key->RotationQuat.w;
+
+				Data[ScaleStream + (row * 3 + 0) * Lanes + lane] = key->Scale.x;
+				Data[ScaleStream + (row * 3 + 1) * Lanes + lane] = key->Scale.y;
+				Data[ScaleStream + (row * 3 + 2) * Lanes + lane] = key->Scale.z;
+			}
+		}
+	}
+}
+
+UINT PackedAnimationClip::TrackCount()const
+{
+	return GroupCount * Lanes;
+}
+
+void PackedAnimationClip::Interpolate(float t, std::vector<BoneTransform>& pose, UINT* cursors,
+	const BoneSet* bones)const
+{
+	const XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+
+	for (UINT g = 0; g < GroupCount; ++g)
+	{
+		UINT keyStart = GroupKeyStart[g];
+		const float* times = &Data[TimeStream + keyStart * Lanes];
+
+		// A group of 8 lanes is processed as two 4-wide slices.
+		for (UINT slice = 0; slice < Lanes; slice += 4)
+		{
+			UINT firstBone = g * Lanes + slice;
+			if (firstBone >= BoneCount)
+			{
+				break;
+			}
+			if (bones != nullptr && !bones->ContainsAny(firstBone, 4))
+			{
+				continue;
+			}
+
+			UINT rows0[4];
+			UINT rows1[4];
+			float lerpPercent[4];
+
+			bool sameRow = GroupSharedTimes[g];
+			if (sameRow)
+			{
+				UINT* cursor = cursors != nullptr ? &cursors[g * Lanes] : nullptr;
+				FindKeyframePair(times, Lanes, GroupKeyCount[g], t, cursor, rows0[0], rows1[0], lerpPercent[0]);
+				for (UINT lane = 1; lane < 4; ++lane)
+				{
+					rows0[lane] = rows0[0];
+					rows1[lane] = rows1[0];
+					lerpPercent[lane] = lerpPercent[0];
+				}
+			}
+			else
+			{
+				for (UINT lane = 0; lane < 4; ++lane)
+				{
+					UINT bone = firstBone + lane;
+					UINT* cursor = cursors != nullptr ? &cursors[bone] : nullptr;
+					FindKeyframePair(times + slice + lane, Lanes, BoneKeyCount[bone], t, cursor,
+						rows0[lane], rows1[lane], lerpPercent[lane]);
+				}
+			}
+
+			for (UINT lane = 0; lane < 4; ++lane)
+			{
+				rows0[lane] += keyStart;
+				rows1[lane] += keyStart;
+			}
+
+			XMVECTOR s = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(lerpPercent));
+
+			XMVECTOR P[3];
+			XMVECTOR S[3];
+			XMVECTOR Q[4];
+			XMVECTOR q0[4];
+			XMVECTOR q1[4];
+			for (UINT c = 0; c < 3; ++c)
+			{
+				const float* p = &Data[TranslationStream + c * Lanes + slice];
+				P[c] = XMVectorLerpV(LoadLanes(p, 3 * Lanes, rows0, sameRow), LoadLanes(p, 3 * Lanes, rows1, sameRow), s);
+
+				const float* sc = &Data[ScaleStream + c * Lanes + slice];
+				S[c] = XMVectorLerpV(LoadLanes(sc, 3 * Lanes, rows0, sameRow), LoadLanes(sc, 3 * Lanes, rows1, sameRow), s);
+			}
+			for (UINT c = 0; c < 4; ++c)
+			{
+				const float* q = &Data[RotationStream + c * Lanes + slice];
+				q0[c] = LoadLanes(q, 4 * Lanes, rows0, sameRow);
+				q1[c] = LoadLanes(q, 4 * Lanes, rows1, sameRow);
+			}
+			SlerpLanes(q0, q1, s, Q);
+
+			// Transpose back to one row per bone.
+			XMMATRIX translations = XMMatrixTranspose(XMMATRIX(P[0], P[1], P[2], zero));
+			XMMATRIX scales = XMMatrixTranspose(XMMATRIX(S[0], S[1], S[2], zero));
+			XMMATRIX rotations = XMMatrixTranspose(XMMATRIX(Q[0], Q[1], Q[2], Q[3]));
+
+			for (UINT lane = 0; lane < 4 && firstBone + lane < BoneCount; ++lane)
+			{
+				pose[firstBone + lane].Set(scales.r[lane], rotations.r[lane], translations.r[lane]);
+			}
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+#include "AnimationPose.h"
+
+struct AnimationClip;
+
+///<summary>
+/// An AnimationClip repacked into one contiguous block of float streams.
+/// Bones are grouped Lanes at a time (4 for SSE, 8 for AVX). Inside a group
+/// every key row stores a component of all the lanes side by side, so one
+/// vector load fetches e.g. the translation x of 4 bones at once:
+///
+///   Data[TimeStream        + row * Lanes + lane]
+///   Data[TranslationStream + (row * 3 + c) * Lanes + lane]
+///   Data[RotationStream    + (row * 4 + c) * Lanes + lane]
+///   Data[ScaleStream       + (row * 3 + c) * Lanes + lane]
+///
+/// Tracks shorter than their group repeat their last key, and the padding
+/// lanes past BoneCount hold the identity transform.
+///</summary>
+struct PackedAnimationClip
+{
+	void Build(const AnimationClip& clip, UINT lanes);
+
+	// cursors may be null; otherwise it holds GroupCount * Lanes entries
+	// (see AnimationSampler). With bones, only the 4-lane slices holding one
+	// of them are sampled.
+	void Interpolate(float t, std::vector<BoneTransform>& pose, UINT* cursors,
+		const BoneSet* bones = nullptr)const;
+
+	UINT TrackCount()const;
+
+	UINT Lanes = 4;
+	UINT BoneCount = 0;
+	UINT GroupCount = 0;
+	float StartTime = 0.0f;
+	float EndTime = 0.0f;
+
+	// Per group: first key row in the streams and number of rows.
+	std::vector<UINT> GroupKeyStart;
+	std::vector<UINT> GroupKeyCount;
+	// Per group: true if all its bones share the same key times, in which case
+	// the group is sampled with a single key search and aligned loads.
+	std::vector<bool> GroupSharedTimes;
+	// Per padded bone: number of real keys.
+	std::vector<UINT> BoneKeyCount;
+
+	// Offsets of the streams inside Data, in floats.
+	UINT TimeStream = 0;
+	UINT TranslationStream = 0;
+	UINT RotationStream = 0;
+	UINT ScaleStream = 0;
+
+	std::vector<float> Data;
+};
@@ -0,0 +1,163 @@
+#include "PoseCache.h"
+
+using namespace DirectX;
+
+PoseCache::PoseCache(const Model& model, UINT capacity, float sampleRate)
+	: mModel(&model), mCapacity(max(1u, capacity)), mSampleRate(sampleRate)
+{
+	assert(sampleRate > 0.0f);
+	mEntries.reserve(mCapacity);
+	mEntryIndices.reserve(mCapacity);
+}
+
+void PoseCache::GetFinalTransforms(ClipId clip, float timePos, XMFLOAT3X4* finalTransforms,
+	AnimationSampler& sampler)
+{
+	UINT frame = (UINT)(max(timePos, 0.0f) * mSampleRate + 0.5f);
+	UINT64 key = ((UINT64)clip << 32) | frame;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mEntryIndices.find(key);
+		if (it != mEntryIndices.end())
+		{
+			++mHits;
+			Entry& entry = mEntries[it->second];
+			std::copy(entry.FinalTransforms.begin(), entry.FinalTransforms.end(), finalTransforms);
+			Unlink(it->second);
+			PushFront(it->second);
+			return;
+		}
+		++mMisses;
+	}
+
+	// Evaluate outside the lock so other threads keep hitting the cache, into
+	// scratch memory since finalTransforms may be too slow to read back.
+	static thread_local std::vector<XMFLOAT3X4> pose;
+	pose.resize(mModel->BoneCount());
+	mModel->GetFinalTransforms(clip, frame / mSampleRate, pose, sampler);
+	std::copy(pose.begin(), pose.end(), finalTransforms);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mEntryIndices.count(key) != 0)
+	{
+		// Another thread evaluated the same pose meanwhile.
+		return;
+	}
+
+	UINT index;
+	if (mEntries.size() < mCapacity)
+	{
+		index = (UINT)mEntries.size();
+		mEntries.emplace_back();
+	}
+	else
+	{
+		index = mLeastRecent;
+		Unlink(index);
+		mEntryIndices.erase(mEntries[index].Key);
+		++mEvictions;
+	}
+
+	Entry& entry = mEntries[index];
+	entry.Key = key;
+	entry.FinalTransforms.assign(pose.begin(), pose.end());
+	mEntryIndices[key] = index;
+	PushFront(index);
+}
+
+void PoseCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries.clear();
+	mEntryIndices.clear();
+	mMostRecent = InvalidEntry;
+	mLeastRecent = InvalidEntry;
+}
+
+void PoseCache::ResetCounters()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mHits = 0;
+	mMisses = 0;
+	mEvictions = 0;
+}
+
+UINT64 PoseCache::Hits()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mHits;
+}
+
+UINT64 PoseCache::Misses()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMisses;
+}
+
+UINT64 PoseCache::Evictions()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEvictions;
+}
+
+float PoseCache::HitRate()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	UINT64 lookups = mHits + mMisses;
+	return lookups > 0 ? (float)((double)mHits / lookups) : 0.0f;
+}
+
+UINT PoseCache::Capacity()const
+{
+	return mCapacity;
+}
+
+float PoseCache::SampleRate()const
+{
+	return mSampleRate;
+}
+
+size_t PoseCache::SizeInBytes()const
+{
+	return (size_t)mCapacity * mModel->BoneCount() * sizeof(XMFLOAT3X4);
+}
+
+void PoseCache::Unlink(UINT entry)
+{
+	Entry& e = mEntries[entry];
+	if (e.Previous != InvalidEntry)
+	{
+		mEntries[e.Previous].Next = e.Next;
+	}
+	else
+	{
+		mMostRecent = e.Next;
+	}
+	if (e.Next != InvalidEntry)
+	{
+		mEntries[e.Next].Previous = e.Previous;
+	}
+	else
+	{
+		mLeastRecent = e.Previous;
+	}
+	e.Previous = InvalidEntry;
+	e.Next = InvalidEntry;
+}
+
+void PoseCache::PushFront(UINT entry)
+{
+	Entry& e = mEntries[entry];
+	e.Previous = InvalidEntry;
+	e.Next = mMostRecent;
+	if (mMostRecent != InvalidEntry)
+	{
+		mEntries[mMostRecent].Previous = entry;
+	}
+	mMostRecent = entry;
+	if (mLeastRecent == InvalidEntry)
+	{
+		mLeastRecent = entry;
+	}
+}
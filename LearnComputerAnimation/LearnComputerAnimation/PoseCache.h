@@ -0,0 +1,70 @@
+#pragma once
+#include <mutex>
+#include "Model.h"
+
+///<summary>
+/// Final transforms of recently evaluated poses, shared by all the
+/// ModelInstances of one Model (see ModelInstance::SharedPoses). Poses are
+/// keyed by clip and by the time rounded to SampleRate, so instances playing
+/// the same clip in lockstep, or a few phase offsets apart, evaluate each
+/// distinct pose once and copy it afterwards. Holds at most Capacity poses and
+/// evicts the least recently used one. Safe to use from several threads.
+///</summary>
+class PoseCache
+{
+public:
+	PoseCache(const Model& model, UINT capacity, float sampleRate = 60.0f);
+	PoseCache(const PoseCache& rhs) = delete;
+	PoseCache& operator=(const PoseCache& rhs) = delete;
+
+	// Same as Model::GetFinalTransforms, except that timePos is rounded to the
+	// sample rate. sampler is only used when the pose is not cached.
+	// finalTransforms is only written, so it may point into a mapped upload
+	// buffer.
+	void GetFinalTransforms(ClipId clip, float timePos,
+		DirectX::XMFLOAT3X4* finalTransforms, AnimationSampler& sampler);
+
+	void Clear();
+	void ResetCounters();
+
+	UINT64 Hits()const;
+	UINT64 Misses()const;
+	UINT64 Evictions()const;
+	// Hits / (Hits + Misses), 0 before the first lookup.
+	float HitRate()const;
+
+	UINT Capacity()const;
+	float SampleRate()const;
+	// Memory of the cached final transforms when the cache is full.
+	size_t SizeInBytes()const;
+
+private:
+	static const UINT InvalidEntry = 0xffffffff;
+
+	struct Entry
+	{
+		UINT64 Key = 0;
+		// Neighbours in the LRU list, most recently used first.
+		UINT Previous = InvalidEntry;
+		UINT Next = InvalidEntry;
+		std::vector<DirectX::XMFLOAT3X4> FinalTransforms;
+	};
+
+	void Unlink(UINT entry);
+	void PushFront(UINT entry);
+
+	const Model* mModel = nullptr;
+	UINT mCapacity = 0;
+	float mSampleRate = 60.0f;
+
+	std::vector<Entry> mEntries;
+	std::unordered_map<UINT64, UINT> mEntryIndices;
+	UINT mMostRecent = InvalidEntry;
+	UINT mLeastRecent = InvalidEntry;
+
+	UINT64 mHits = 0;
+	UINT64 mMisses = 0;
+	UINT64 mEvictions = 0;
+
+	mutable std::mutex mMutex;
+};
@@ -0,0 +1,99 @@
+#include "ResampledAnimationClip.h"
+#include "Model.h"
+
+using namespace DirectX;
+
+void ResampledAnimationClip::Build(const AnimationClip& clip, float sampleRate)
+{
+	assert(sampleRate > 0.0f);
+
+	BoneCount = (UINT)clip.BoneAnimations.size();
+	StartTime = clip.GetClipStartTime();
+	EndTime = clip.GetClipEndTime();
+
+	float duration = EndTime - StartTime;
+	UINT intervals = max(1u, (UINT)ceilf(duration * sampleRate - 0.001f));
+	FrameCount = intervals + 1;
+	SampleRate = duration > 0.0f ? (float)intervals / duration : sampleRate;
+
+	Frames.assign(FrameCount * BoneCount * 3, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+
+	for (UINT bone = 0; bone < BoneCount; ++bone)
+	{
+		const BoneAnimation& track = clip.BoneAnimations[bone];
+		const auto& keys = track.Keyframes;
+
+		UINT cursor = (UINT)keys.size();
+		XMVECTOR previousQ = XMQuaternionIdentity();
+		for (UINT frame = 0; frame < FrameCount; ++frame)
+		{
+			float t = frame + 1 == FrameCount ? EndTime : StartTime + (float)frame / SampleRate;
+
+			XMVECTOR P;
+			XMVECTOR Q;
+			XMVECTOR S;
+			if (keys.size() == 1 || t <= keys.front().Time)
+			{
+				P = XMLoadFloat3(&keys.front().Translation);
+				Q = XMLoadFloat4(&keys.front().RotationQuat);
+				S = XMLoadFloat3(&keys.front().Scale);
+			}
+			else if (t >= keys.back().Time)
+			{
+				P = XMLoadFloat3(&keys.back().Translation);
+				Q = XMLoadFloat4(&keys.back().RotationQuat);
+				S = XMLoadFloat3(&keys.back().Scale);
+			}
+			else
+			{
+				UINT i = track.FindKeyframe(t, cursor);
+				float lerpPercent = (t - keys[i].Time) / (keys[i + 1].Time - keys[i].Time);
+
+				P = XMVectorLerp(XMLoadFloat3(&keys[i].Translation), XMLoadFloat3(&keys[i + 1].Translation), lerpPercent);
+				Q = XMQuaternionSlerp(XMLoadFloat4(&keys[i].RotationQuat), XMLoadFloat4(&keys[i + 1].RotationQuat), lerpPercent);
+				S = XMVectorLerp(XMLoadFloat3(&keys[i].Scale), XMLoadFloat3(&keys[i + 1].Scale), lerpPercent);
+			}
+
+			// Keep neighbouring frames in the same hemisphere.
+			if (frame > 0 && XMVectorGetX(XMVector4Dot(Q, previousQ)) < 0.0f)
+			{
+				Q = XMVectorNegate(Q);
+			}
+			previousQ = Q;
+
+			XMFLOAT4* key = &Frames[(frame * BoneCount + bone) * 3];
+			XMStoreFloat4(&key[0], P);
+			XMStoreFloat4(&key[1], Q);
+			XMStoreFloat4(&key[2], S);
+		}
+	}
+}
+
+void ResampledAnimationClip::Interpolate(float t, std::vector<BoneTransform>& pose, const BoneSet* bones)const
+{
+	float frame = MathHelper::Clamp((t - StartTime) * SampleRate, 0.0f, (float)(FrameCount - 1));
+	UINT f0 = min((UINT)frame, FrameCount - 2);
+	float lerpPercent = frame - (float)f0;
+
+	const XMFLOAT4* keys0 = &Frames[f0 * BoneCount * 3];
+	const XMFLOAT4* keys1 = keys0 + BoneCount * 3;
+
+	UINT count = bones != nullptr ? (UINT)bones->Bones.size() : BoneCount;
+	for (UINT n = 0; n < count; ++n)
+	{
+		UINT bone = bones != nullptr ? bones->Bones[n] : n;
+		const XMFLOAT4* k0 = &keys0[bone * 3];
+		const XMFLOAT4* k1 = &keys1[bone * 3];
+
+		XMVECTOR P = XMVectorLerp(XMLoadFloat4(&k0[0]), XMLoadFloat4(&k1[0]), lerpPercent);
+		XMVECTOR Q = XMQuaternionSlerp(XMLoadFloat4(&k0[1]), XMLoadFloat4(&k1[1]), lerpPercent);
+		XMVECTOR S = XMVectorLerp(XMLoadFloat4(&k0[2]), XMLoadFloat4(&k1[2]), lerpPercent);
+
+		pose[bone].Set(S, Q, P);
+	}
+}
+
+size_t ResampledAnimationClip::SizeInBytes()const
+{
+	return sizeof(ResampledAnimationClip) + Frames.size() * sizeof(XMFLOAT4);
+}
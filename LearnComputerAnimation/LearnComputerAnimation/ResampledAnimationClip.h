@@ -0,0 +1,38 @@
+#pragma once
+#include "../Common/d3dUtil.h"
+#include "../Common/MathHelper.h"
+#include "AnimationPose.h"
+
+struct AnimationClip;
+
+///<summary>
+/// An AnimationClip resampled at a fixed rate. Every bone has a key on every
+/// frame, so sampling needs no key search: frame = (t - StartTime) * SampleRate
+/// gives the same pair of frames for all the bones. The frames are stored one
+/// after the other, each holding the translation, rotation and scale of all
+/// the bones:
+///
+///   Frames[(frame * BoneCount + bone) * 3 + 0]   translation
+///   Frames[(frame * BoneCount + bone) * 3 + 1]   rotation
+///   Frames[(frame * BoneCount + bone) * 3 + 2]   scale
+///</summary>
+struct ResampledAnimationClip
+{
+	// The clip must still have its keyframe tracks. sampleRate is in frames per
+	// second; it is adjusted slightly so the last frame lands on the end time.
+	void Build(const AnimationClip& clip, float sampleRate);
+
+	// With bones, only those bones are sampled.
+	void Interpolate(float t, std::vector<BoneTransform>& pose, const BoneSet* bones = nullptr)const;
+
+	size_t SizeInBytes()const;
+
+	UINT BoneCount = 0;
+	// At least 2, so there is always a pair of frames to interpolate.
+	UINT FrameCount = 0;
+	float SampleRate = 30.0f;
+	float StartTime = 0.0f;
+	float EndTime = 0.0f;
+
+	std::vector<DirectX::XMFLOAT4> Frames;
+};
@@ -55,11 +55,31 @@ cbuffer cbPass : register(b2)
     Light gLights[MaxLights];
 }
 // 骨骼信息
+#ifdef BONE_PALETTE_BUFFER
+// 所有实例的骨骼矩阵放在一个结构化缓冲区中, 不再限制骨骼数量
+struct BonePaletteEntry
+{
+    row_major float3x4 Transform;
+};
+StructuredBuffer<BonePaletteEntry> gBonePalette : register(t1);
+// 当前实例的第一个骨骼在gBonePalette中的位置
+cbuffer cbBonePalette : register(b4)
+{
+    uint gBoneOffset;
+};
+#else
 cbuffer cbSkinned : register(b3)
 {
+#ifdef DUAL_QUATERNION_SKINNING
+    // 每个骨骼两个float4: 旋转四元数和对偶部分
+    float4 gBoneDualQuat[96 * 2];
+#else
     // 每个角色最多由96个骨骼构成
-    float4x4 gBoneTransform[96];
+    // 3x4仿射矩阵, 每行是骨骼变换的一列, 省去恒为(0,0,0,1)的一列
+    row_major float3x4 gBoneTransform[96];
+#endif
 };
+#endif
 
 struct VertexIn
 {
@@ -84,6 +104,13 @@ struct VertexOut
 Texture2D gDiffuseTex : register(t0);
 SamplerState gsamPointWrap : register(s0);
 
+#ifdef DUAL_QUATERNION_SKINNING
+float3 QuatRotate(float4 q, float3 v)
+{
+    return v + 2.0f * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+#endif
+
 VertexOut VS(VertexIn vin)
 {
 #ifdef SKINNED
@@ -92,17 +119,43 @@ VertexOut VS(VertexIn vin)
     weights[1] = vin.WEIGHTS.y;
     weights[2] = vin.WEIGHTS.z;
     weights[3] = 1.f - weights[0] -weights[1]-weights[2];
+#ifdef DUAL_QUATERNION_SKINNING
+    // 混合对偶四元数, 与第一个骨骼不在同一半球的取反
+    float4 firstReal = gBoneDualQuat[vin.BoneIndices[0] * 2];
+    float4 real = float4(0.f,0.f,0.f,0.f);
+    float4 dual = float4(0.f,0.f,0.f,0.f);
+    for(int i=0;i<4;++i)
+    {
+        float4 r = gBoneDualQuat[vin.BoneIndices[i] * 2];
+        float4 d = gBoneDualQuat[vin.BoneIndices[i] * 2 + 1];
+        float w = dot(r, firstReal) < 0.f ? -weights[i] : weights[i];
+        real += w * r;
+        dual += w * d;
+    }
+    float invLength = 1.0f / length(real);
+    real *= invLength;
+    dual *= invLength;
+    float3 translation = 2.0f * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    vin.PosL = QuatRotate(real, vin.PosL) + translation;
+    vin.NormalL = QuatRotate(real, vin.NormalL);
+#else
     float3 posL = float3(0.f,0.f,0.f);
     float3 normalL = float3(0.f,0.f,0.f);
     for(int i=0;i<4;++i)
     {
-        posL+=weights[i]*mul(float4(vin.PosL,1.0f),gBoneTransform[vin.BoneIndices[i]]).xyz;
+#ifdef BONE_PALETTE_BUFFER
+        float3x4 boneTransform = gBonePalette[gBoneOffset + vin.BoneIndices[i]].Transform;
+#else
+        float3x4 boneTransform = gBoneTransform[vin.BoneIndices[i]];
+#endif
+        posL+=weights[i]*mul(boneTransform,float4(vin.PosL,1.0f));
         // 假设法线不包含非等比变化
-        normalL+=weights[i]*mul(vin.NormalL,(float3x3)gBoneTransform[vin.BoneIndices[i]]);
+        normalL+=weights[i]*mul((float3x3)boneTransform,vin.NormalL);
     }
     vin.PosL = posL;
     vin.NormalL = normalL;
 #endif
+#endif
     
     
   VertexOut vout;
@@ -4,8 +4,10 @@
 #include "Constants.h"
 #include "Vertex.h"
 #include "Model.h"
+#include "BonePalette.h"
 #include "../Common/d3dApp.h"
 #include "../Common/DDSTextureLoader.h"
+#include "../Common/JobSystem.h"
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
 
@@ -39,12 +41,24 @@ struct RenderItem
 	ModelInstance* SkinnedModelInst = nullptr;
 };
 
+// 蒙皮实例的调色板可以写入的上传缓冲区, 每个FrameResource各有一组
+enum SkinnedPaletteBuffer
+{
+	// SkinnedCB, 线性混合蒙皮
+	SkinnedPaletteCB = 0,
+	// SkinnedDqCB, 对偶四元数蒙皮
+	SkinnedPaletteDqCB,
+	// BonePaletteBuffer, 所有实例共用的结构化缓冲区
+	SkinnedPaletteStructured,
+	SkinnedPaletteBufferCount
+};
+
 // 以CPU每帧都需更新的资源作为基本元素，包括CmdListAlloc、ConstantBuffer等.
 // Draw()中进行绘制时，执行CmdList的Reset函数，来指定当前FrameResource所使用的CmdAlloc,从而将绘制命令存储在每帧的Alloc中.
 class FrameResource
 {
 public:
-	FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT MaterialCount, UINT skinnedCount)
+	FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT MaterialCount, UINT skinnedCount, UINT paletteBoneCount)
 	{
 		device->CreateCommandAllocator(
 			D3D12_COMMAND_LIST_TYPE_DIRECT,
@@ -54,6 +68,8 @@ public:
 		PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
 		MaterialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, MaterialCount, true);
 		SkinnedCB = std::make_unique<UploadBuffer<SkinnedConstants>>(device, skinnedCount, true);
+		SkinnedDqCB = std::make_unique<UploadBuffer<SkinnedDualQuaternionConstants>>(device, skinnedCount, true);
+		BonePaletteBuffer = std::make_unique<UploadBuffer<XMFLOAT3X4>>(device, max(1u, paletteBoneCount), false);
 
 	}
 	FrameResource(const FrameResource& rhs) = delete;
@@ -67,6 +83,18 @@ public:
 	std::unique_ptr<UploadBuffer<PassConstants>> PassCB = nullptr;
 	std::unique_ptr<UploadBuffer<MaterialConstants>> MaterialCB = nullptr;
 	std::unique_ptr<UploadBuffer<SkinnedConstants>> SkinnedCB = nullptr;
+	// 对偶四元数蒙皮时使用
+	std::unique_ptr<UploadBuffer<SkinnedDualQuaternionConstants>> SkinnedDqCB = nullptr;
+	// 所有实例的骨骼矩阵, 结构化缓冲区
+	std::unique_ptr<UploadBuffer<XMFLOAT3X4>> BonePaletteBuffer = nullptr;
+	// 在mFrameResources中的位置, 用来找到实例在本帧缓冲区中的姿势版本, 见SkinnedPoseVersion
+	UINT Index = 0;
+	// 写入上面缓冲区的动画求值任务, 在上一帧的Draw期间运行. 完成前Draw不能引用这些缓冲区
+	JobHandle AnimationJob = nullptr;
+	// 这一帧调色板上传的统计, AnimationJob完成后有效
+	PaletteUploadStats SkinnedUploadStats;
+	// 这一帧的调色板写入的缓冲区, 安排AnimationJob时决定. Draw据此选择蒙皮的PSO和根参数
+	SkinnedPaletteBuffer SkinnedPalette = SkinnedPaletteCB;
 
 	// 每帧需要有自己的fence，来判断GPU与CPU的帧之间的同步.
 	UINT64 Fence = 0;
@@ -80,7 +108,17 @@ public:
 	LearnComputerAnimApp(HINSTANCE hInstance):D3DApp(hInstance){}
 	LearnComputerAnimApp(const LearnComputerAnimApp&) = delete;
 	LearnComputerAnimApp& operator=(const LearnComputerAnimApp&) =delete;
-	~LearnComputerAnimApp(){};
+	~LearnComputerAnimApp()
+	{
+		// 还在求值的动画会写入FrameResource
+		for (auto& frameResource : mFrameResources)
+		{
+			if (frameResource->AnimationJob != nullptr)
+			{
+				mJobSystem.Wait(frameResource->AnimationJob);
+			}
+		}
+	};
 
 
 	bool Initialize() override;
@@ -88,6 +126,12 @@ private:
 	virtual void OnResize() override;
 	void Update(const GameTimer& gt) override;
 	void Draw(const GameTimer& gt) override;
+	// 等待GPU用完frameResource
+	void WaitForFrameResource(const FrameResource* frameResource);
+	// 推进动画并把调色板写入frameResource, 在工作线程上运行
+	JobHandle ScheduleAnimation(FrameResource* frameResource, float dt);
+	// instance写入frameResource的buffer中的姿势版本
+	static UINT64& SkinnedPoseVersion(ModelInstance* instance, const FrameResource* frameResource, SkinnedPaletteBuffer buffer);
 
 	virtual void OnMouseDown(WPARAM btnState, int x, int y) override;
 	virtual void OnMouseUp(WPARAM btnState, int x, int y) override;
@@ -121,6 +165,9 @@ private:
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
 	// 是否开启线框模式
 	bool mIsWireframe = false;
+	// 是否使用对偶四元数蒙皮, 按2切换
+	bool mUseDualQuaternionSkinning = false;
+	bool mDualQuaternionKeyDown = false;
 
 
 	// 存储所有渲染项.
@@ -151,6 +198,13 @@ private:
 	std::vector<std::string> mSkinnedTextureNames;
 	// 骨骼模型实例信息
 	std::unique_ptr<ModelInstance> mSkinnedModelInst = nullptr;
+	// 使用结构化缓冲区上传所有实例的骨骼矩阵, 不受96个骨骼的限制. 按3切换, 骨骼超过96个时总是使用
+	bool mUseBonePaletteBuffer = false;
+	bool mBonePaletteKeyDown = false;
+	BonePalette mBonePalette;
+
+	// 动画求值和调色板上传在工作线程上运行, 与主线程的Draw重叠
+	JobSystem mJobSystem;
 
 
 };
@@ -181,7 +235,14 @@ bool LearnComputerAnimApp::Initialize()
 		mSkinnedModelInst = std::make_unique<ModelInstance>();
 		mSkinnedModelInst->ModelInfo = &mModel;
 		mSkinnedModelInst->FinalTransforms.resize(mModel.BoneCount());
-		// 暂时不处理动画信息.
+		mSkinnedModelInst->FinalDualQuaternions.resize(2 * mModel.BoneCount());
+		mSkinnedModelInst->BonePaletteOffset = mBonePalette.Allocate(mModel.BoneCount());
+		mUseBonePaletteBuffer = mModel.BoneCount() * sizeof(XMFLOAT3X4) > sizeof(SkinnedConstants);
+		// 播放第一个动画
+		if (mModel.ClipCount() > 0)
+		{
+			mSkinnedModelInst->Clip = 0;
+		}
 
 		const UINT vbByteSize = (UINT) vertices.size()* sizeof(SkinnedVertex);
 		const UINT ibByteSize = (UINT) indices.size()* sizeof(std::uint16_t);
@@ -248,10 +309,12 @@ bool LearnComputerAnimApp::Initialize()
 	// 3. srv table
 	// 4. sampler	table
 	// 5. model cbv.
+	// 6. bone palette offset.
+	// 7. bone palette srv.
 	{
 
 
-		D3D12_ROOT_PARAMETER slotRootParameter[6];
+		D3D12_ROOT_PARAMETER slotRootParameter[8];
 		// obj cbv
 		slotRootParameter[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
 		slotRootParameter[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -304,12 +367,24 @@ bool LearnComputerAnimApp::Initialize()
 		slotRootParameter[5].Descriptor.RegisterSpace = 0;
 		slotRootParameter[5].Descriptor.ShaderRegister = 3;			//b3
 
+		// bone palette offset, root constant.
+		slotRootParameter[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		slotRootParameter[6].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+		slotRootParameter[6].Constants.Num32BitValues = 1;
+		slotRootParameter[6].Constants.RegisterSpace = 0;
+		slotRootParameter[6].Constants.ShaderRegister = 4;			//b4
+		// bone palette srv, structured buffer.
+		slotRootParameter[7].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+		slotRootParameter[7].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+		slotRootParameter[7].Descriptor.RegisterSpace = 0;
+		slotRootParameter[7].Descriptor.ShaderRegister = 1;			//t1
+
 		// d3d12规定，必须将根签名的描述布局进行序列化，才可以传入CreateRootSignature方法.
 		ComPtr<ID3DBlob> serializedBlob = nullptr, errBlob = nullptr;
 
 		D3D12_ROOT_SIGNATURE_DESC rootSignatureDesc;
 		rootSignatureDesc.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
-		rootSignatureDesc.NumParameters = 6;
+		rootSignatureDesc.NumParameters = 8;
 		rootSignatureDesc.pParameters = slotRootParameter;
 		rootSignatureDesc.pStaticSamplers = nullptr;
 		rootSignatureDesc.NumStaticSamplers = 0;
@@ -399,9 +474,23 @@ bool LearnComputerAnimApp::Initialize()
 				"SKINNED", "1",
 				NULL, NULL
 		};	
+		const D3D_SHADER_MACRO skinnedDqDefines[] =
+		{
+				"SKINNED", "1",
+				"DUAL_QUATERNION_SKINNING", "1",
+				NULL, NULL
+		};
+		const D3D_SHADER_MACRO skinnedPaletteDefines[] =
+		{
+				"SKINNED", "1",
+				"BONE_PALETTE_BUFFER", "1",
+				NULL, NULL
+		};
 
 		mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\color.hlsl", nullptr, "VS", "vs_5_1");
 		mShaders["skinnedVS"] = d3dUtil::CompileShader(L"Shaders\\color.hlsl", skinnedDefines, "VS", "vs_5_1");
+		mShaders["skinnedDqVS"] = d3dUtil::CompileShader(L"Shaders\\color.hlsl", skinnedDqDefines, "VS", "vs_5_1");
+		mShaders["skinnedPaletteVS"] = d3dUtil::CompileShader(L"Shaders\\color.hlsl", skinnedPaletteDefines, "VS", "vs_5_1");
 		mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\color.hlsl", nullptr, "PS", "ps_5_1");
 		mInputLayout =
 		{
@@ -476,8 +565,11 @@ bool LearnComputerAnimApp::Initialize()
 		{
 			mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
 				1, (UINT)mAllRenderItems.size(),
-				(UINT)mMaterials.size(),1));
+				(UINT)mMaterials.size(),1,mBonePalette.BoneCount()));
+			mFrameResources.back()->Index = i;
 		}
+		// 每个FrameResource的每个调色板缓冲区记一个版本
+		mSkinnedModelInst->UploadedPoseVersions.assign(gNumFrameResources * SkinnedPaletteBufferCount, 0);
 	}
 
 	// 创建PSO.根据shader数目来创建，同时加一个wireframe的pso
@@ -524,10 +616,39 @@ bool LearnComputerAnimApp::Initialize()
 		};
 		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedOpaquePsoDesc, IID_PPV_ARGS(&mPSOs["skinnedOpaque"])));
 
+		// PSO for dual quaternion skinning.
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC skinnedDqOpaquePsoDesc = skinnedOpaquePsoDesc;
+		skinnedDqOpaquePsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["skinnedDqVS"]->GetBufferPointer()),
+			mShaders["skinnedDqVS"]->GetBufferSize()
+		};
+		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedDqOpaquePsoDesc, IID_PPV_ARGS(&mPSOs["skinnedDqOpaque"])));
+
+		// PSO for skinning from the bone palette buffer.
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC skinnedPaletteOpaquePsoDesc = skinnedOpaquePsoDesc;
+		skinnedPaletteOpaquePsoDesc.VS =
+		{
+			reinterpret_cast<BYTE*>(mShaders["skinnedPaletteVS"]->GetBufferPointer()),
+			mShaders["skinnedPaletteVS"]->GetBufferSize()
+		};
+		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedPaletteOpaquePsoDesc, IID_PPV_ARGS(&mPSOs["skinnedPaletteOpaque"])));
+
 		// wireframe
 		D3D12_GRAPHICS_PIPELINE_STATE_DESC wireframePSO = opaquePsoDesc;
 		wireframePSO.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
 		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&wireframePSO, IID_PPV_ARGS(&mPSOs["wireframe"])));
+
+		// 三种蒙皮的wireframe
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC skinnedWireframePSO = skinnedOpaquePsoDesc;
+		skinnedWireframePSO.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedWireframePSO, IID_PPV_ARGS(&mPSOs["skinnedWireframe"])));
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC skinnedDqWireframePSO = skinnedDqOpaquePsoDesc;
+		skinnedDqWireframePSO.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedDqWireframePSO, IID_PPV_ARGS(&mPSOs["skinnedDqWireframe"])));
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC skinnedPaletteWireframePSO = skinnedPaletteOpaquePsoDesc;
+		skinnedPaletteWireframePSO.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+		ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&skinnedPaletteWireframePSO, IID_PPV_ARGS(&mPSOs["skinnedPaletteWireframe"])));
 	
 	}
 
@@ -562,12 +683,11 @@ void LearnComputerAnimApp::Update(const GameTimer& gt)
 	mCurrentFrameResource = mFrameResources[mCurrentFrameIndex].get();
 
 	// 如果队列满，等待
-	if (mCurrentFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrentFrameResource->Fence)
+	WaitForFrameResource(mCurrentFrameResource);
+	// 本帧的动画在上一帧的Update末尾就已经开始求值, 只有第一帧需要在这里开始
+	if (mCurrentFrameResource->AnimationJob == nullptr)
 	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFrameResource->Fence, eventHandle));
-		WaitForSingleObject(eventHandle, INFINITE);
-		CloseHandle(eventHandle);
+		mCurrentFrameResource->AnimationJob = ScheduleAnimation(mCurrentFrameResource, gt.DeltaTime());
 	}
 	// 更新相机位置
 	{
@@ -585,10 +705,10 @@ void LearnComputerAnimApp::Update(const GameTimer& gt)
 		XMStoreFloat4x4(&mView, view);
 	}
 
-	// 更新物体CB
+	// 更新物体CB. 只有几个渲染项, 分发到工作线程的开销比写入本身还大, 留在主线程
 	{
 		auto currObjCB = mCurrentFrameResource->ObjectsCB.get();
-		for(auto& e:mAllRenderItems)
+		for (auto& e : mAllRenderItems)
 		{
 			if (e->NumFramesDirty > 0)
 			{
@@ -601,13 +721,6 @@ void LearnComputerAnimApp::Update(const GameTimer& gt)
 			}
 		}
 	}
-	// 更新动画的CB
-	{
-		auto currSkinCB = mCurrentFrameResource->SkinnedCB.get();
-		SkinnedConstants skinnedConstants;
-		std::copy(std::begin(mSkinnedModelInst->FinalTransforms),std::end(mSkinnedModelInst->FinalTransforms),&skinnedConstants.BoneTransform[0]);
-		currSkinCB->CopyData(0,skinnedConstants);
-	}
 	// 更新材质的CB
 	{
 		auto currMaterialCB = mCurrentFrameResource->MaterialCB.get();
@@ -662,27 +775,107 @@ void LearnComputerAnimApp::Update(const GameTimer& gt)
 		currPassCB->CopyData(0, passConstants);
 	}
 
+	// Draw要引用本帧的调色板, 必须等它写完
+	mJobSystem.Wait(mCurrentFrameResource->AnimationJob);
+	mCurrentFrameResource->AnimationJob = nullptr;
 
+	// 下一帧的动画在工作线程上与本帧的Draw同时求值, 写入下一个FrameResource.
+	// 下一帧的dt还不知道, 假设与本帧相同
+	FrameResource* nextFrameResource = mFrameResources[(mCurrentFrameIndex + 1) % gNumFrameResources].get();
+	nextFrameResource->AnimationJob = ScheduleAnimation(nextFrameResource, gt.DeltaTime());
 }
 
-void LearnComputerAnimApp::Draw(const GameTimer& gt)
+void LearnComputerAnimApp::WaitForFrameResource(const FrameResource* frameResource)
 {
-	auto cmdListAlloc = mCurrentFrameResource->CmdAlloc;
-	cmdListAlloc->Reset();
-	// 3 pso:skinnedOpaque,opaque,wireframe
-	if (mIsWireframe)
+	if (frameResource->Fence != 0 && mFence->GetCompletedValue() < frameResource->Fence)
 	{
-		mCommandList->Reset(cmdListAlloc.Get(), mPSOs["wireframe"].Get());
+		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
+		ThrowIfFailed(mFence->SetEventOnCompletion(frameResource->Fence, eventHandle));
+		WaitForSingleObject(eventHandle, INFINITE);
+		CloseHandle(eventHandle);
+	}
+}
 
+JobHandle LearnComputerAnimApp::ScheduleAnimation(FrameResource* frameResource, float dt)
+{
+	// 在主线程上决定蒙皮方式, 任务和Draw都只看frameResource中记录的结果
+	if (mUseBonePaletteBuffer)
+	{
+		frameResource->SkinnedPalette = SkinnedPaletteStructured;
+	}
+	else if (mUseDualQuaternionSkinning)
+	{
+		frameResource->SkinnedPalette = SkinnedPaletteDqCB;
 	}
 	else
-	{	
-		// 目前只绘制一个模型，不考虑默认
-		mCommandList->Reset(cmdListAlloc.Get(), mPSOs["opaque"].Get());
-		//mCommandList->Reset(cmdListAlloc.Get(), mPSOs["skinnedOpaque"].Get());
-
+	{
+		frameResource->SkinnedPalette = SkinnedPaletteCB;
 	}
 
+	return mJobSystem.Schedule([this, frameResource, dt]()
+	{
+		frameResource->SkinnedUploadStats = PaletteUploadStats();
+		ModelInstance* instance = mSkinnedModelInst.get();
+		if (instance->Clip == InvalidClipId)
+		{
+			return;
+		}
+		// 动画任务一次只运行一个, 只有它修改实例
+		bool dualQuaternionSkinning = frameResource->SkinnedPalette == SkinnedPaletteDqCB;
+		if (instance->DualQuaternionSkinning != dualQuaternionSkinning)
+		{
+			instance->DualQuaternionSkinning = dualQuaternionSkinning;
+			instance->FinalPaletteVersion = 0;
+		}
+		instance->AdvanceTime(dt);
+
+		// GPU可能还在使用这个FrameResource的缓冲区. 通常GPU落后不到两帧, 不用等待
+		WaitForFrameResource(frameResource);
+
+		// 直接写入FrameResource映射的内存, 不经过FinalTransforms和栈上的SkinnedConstants.
+		// 每个FrameResource有自己的缓冲区, 实例在其中已经是当前姿势时跳过求值和上传
+		PaletteUploadStats& stats = frameResource->SkinnedUploadStats;
+		if (frameResource->SkinnedPalette == SkinnedPaletteStructured)
+		{
+			// 每个实例写入BonePalette中自己的区间
+			instance->UploadPalette(frameResource->BonePaletteBuffer->MappedData(instance->BonePaletteOffset),
+				SkinnedPoseVersion(instance, frameResource, SkinnedPaletteStructured), stats);
+		}
+		else if (frameResource->SkinnedPalette == SkinnedPaletteDqCB)
+		{
+			assert(2 * mModel.BoneCount() * sizeof(XMFLOAT4) <= sizeof(SkinnedDualQuaternionConstants));
+			instance->UploadPalette(frameResource->SkinnedDqCB->MappedData(0)->BoneDualQuaternion,
+				SkinnedPoseVersion(instance, frameResource, SkinnedPaletteDqCB), stats);
+		}
+		else
+		{
+			assert(mModel.BoneCount() * sizeof(XMFLOAT3X4) <= sizeof(SkinnedConstants));
+			instance->UploadPalette(frameResource->SkinnedCB->MappedData(0)->BoneTransform,
+				SkinnedPoseVersion(instance, frameResource, SkinnedPaletteCB), stats);
+		}
+	});
+}
+
+UINT64& LearnComputerAnimApp::SkinnedPoseVersion(ModelInstance* instance, const FrameResource* frameResource,
+	SkinnedPaletteBuffer buffer)
+{
+	return instance->UploadedPoseVersions[frameResource->Index * SkinnedPaletteBufferCount + buffer];
+}
+
+void LearnComputerAnimApp::Draw(const GameTimer& gt)
+{
+	auto cmdListAlloc = mCurrentFrameResource->CmdAlloc;
+	cmdListAlloc->Reset();
+	// 8 pso:skinnedOpaque,skinnedDqOpaque,skinnedPaletteOpaque,opaque和它们的wireframe.
+	// 蒙皮渲染项的PSO由本帧调色板所在的缓冲区决定, 按SkinnedPaletteBuffer排列
+	static const char* skinnedOpaquePSOs[SkinnedPaletteBufferCount] = { "skinnedOpaque", "skinnedDqOpaque", "skinnedPaletteOpaque" };
+	static const char* skinnedWireframePSOs[SkinnedPaletteBufferCount] = { "skinnedWireframe", "skinnedDqWireframe", "skinnedPaletteWireframe" };
+	ID3D12PipelineState* pso = mPSOs[mIsWireframe ? "wireframe" : "opaque"].Get();
+	ID3D12PipelineState* skinnedPso = mPSOs[mIsWireframe ?
+		skinnedWireframePSOs[mCurrentFrameResource->SkinnedPalette] :
+		skinnedOpaquePSOs[mCurrentFrameResource->SkinnedPalette]].Get();
+	mCommandList->Reset(cmdListAlloc.Get(), pso);
+
 	// 设置视口
 	mCommandList->RSSetViewports(1, &mScreenViewport);
 	mCommandList->RSSetScissorRects(1, &mScissorRect);
@@ -721,6 +914,7 @@ void LearnComputerAnimApp::Draw(const GameTimer& gt)
 		for (size_t i = 0; i < mAllRenderItems.size(); ++i)
 		{
 			auto ri = mAllRenderItems[i].get();
+			mCommandList->SetPipelineState(ri->SkinnedModelInst != nullptr ? skinnedPso : pso);
 			mCommandList->IASetVertexBuffers(0,1,&ri->Geo->VertexBufferView());
 			mCommandList->IASetIndexBuffer(&ri->Geo->IndexBufferView());
 			mCommandList->IASetPrimitiveTopology(ri->PrimitiveTopology);
@@ -737,9 +931,23 @@ void LearnComputerAnimApp::Draw(const GameTimer& gt)
 			D3D12_GPU_DESCRIPTOR_HANDLE texHandle = mCbvHeap->GetGPUDescriptorHandleForHeapStart();
 			texHandle.ptr += (mSrvOffset  + ri->Mat->DiffuseSrvHeapIndex) * mCbvUavDescriptorSize;
 			mCommandList->SetGraphicsRootDescriptorTable(3, texHandle);
-			// 设置模型
-			D3D12_GPU_VIRTUAL_ADDRESS modelAddress = mCurrentFrameResource->SkinnedCB->Resource()->GetGPUVirtualAddress();
-			mCommandList->SetGraphicsRootConstantBufferView(5, modelAddress);
+			// 设置模型. 下一帧的动画任务正在修改实例, 只读FrameResource中的记录.
+			// 不蒙皮的渲染项不绑定调色板
+			if (ri->SkinnedModelInst != nullptr)
+			{
+				if (mCurrentFrameResource->SkinnedPalette == SkinnedPaletteStructured)
+				{
+					mCommandList->SetGraphicsRoot32BitConstant(6, ri->SkinnedModelInst->BonePaletteOffset, 0);
+					mCommandList->SetGraphicsRootShaderResourceView(7, mCurrentFrameResource->BonePaletteBuffer->Resource()->GetGPUVirtualAddress());
+				}
+				else
+				{
+					D3D12_GPU_VIRTUAL_ADDRESS modelAddress = mCurrentFrameResource->SkinnedPalette == SkinnedPaletteDqCB ?
+						mCurrentFrameResource->SkinnedDqCB->Resource()->GetGPUVirtualAddress() :
+						mCurrentFrameResource->SkinnedCB->Resource()->GetGPUVirtualAddress();
+					mCommandList->SetGraphicsRootConstantBufferView(5, modelAddress);
+				}
+			}
 
 			mCommandList->DrawIndexedInstanced(ri->IndexCount,1,ri->StartIndexLocation,ri->BaseVertexLocation,0);
 		}
@@ -842,6 +1050,23 @@ void LearnComputerAnimApp::OnKeyboardInput(const GameTimer& gt)
 	{
 		mIsWireframe = false;
 	}
+
+	// 按下2时切换, 从下一次安排的动画任务开始生效
+	bool dualQuaternionKeyDown = (GetAsyncKeyState('2') & 0x8000) != 0;
+	if (dualQuaternionKeyDown && !mDualQuaternionKeyDown)
+	{
+		mUseDualQuaternionSkinning = !mUseDualQuaternionSkinning;
+	}
+	mDualQuaternionKeyDown = dualQuaternionKeyDown;
+
+	// 按下3时切换结构化缓冲区, 常量缓冲区放不下骨骼时不能切回
+	bool bonePaletteKeyDown = (GetAsyncKeyState('3') & 0x8000) != 0;
+	if (bonePaletteKeyDown && !mBonePaletteKeyDown &&
+		mModel.BoneCount() * sizeof(XMFLOAT3X4) <= sizeof(SkinnedConstants))
+	{
+		mUseBonePaletteBuffer = !mUseBonePaletteBuffer;
+	}
+	mBonePaletteKeyDown = bonePaletteKeyDown;
 }
 
 // debug模式下开启命令行窗口
@@ -0,0 +1,2376 @@
+// Offline processing of .m3d model files.
+//
+//   M3dTool reduce <input.m3d> <output.m3d> [translationTol rotationTol scaleTol]
+//   M3dTool bench <input.m3d> [resampleRate]
+//   M3dTool keysearch [maxKeyCount]
+//   M3dTool skin <input.m3d>
+//   M3dTool palette <input.m3d> [instanceCount]
+//   M3dTool crowd <input.m3d> [maxInstanceCount [maxThreadCount]]
+//   M3dTool lod <input.m3d> [instanceCount]
+//   M3dTool posecache <input.m3d> [instanceCount [phaseCount [capacity]]]
+//   M3dTool bake <input.m3d> [instanceCount]
+//   M3dTool blend <input.m3d> [instanceCount]
+//   M3dTool mask <input.m3d> <rootBone> [rootBone ...]
+//   M3dTool channels <input.m3d>
+//   M3dTool compress <input.m3d> [maxPositionError]
+//   M3dTool upload <input.m3d> [instanceCount]
+//   M3dTool archive <input.m3d> <output.m3da> [clipCount [budgetClips]]
+//   M3dTool pipeline <input.m3d> [instanceCount [recordMicroseconds [presentMicroseconds]]]
+//   M3dTool skinbench <input.m3d> [syntheticVertexCount [maxThreadCount]]
+//   M3dTool influences <input.m3d> [weightThreshold]
+//
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <thread>
+#include "../LearnComputerAnimation/Model.h"
+#include "../LearnComputerAnimation/CpuSkinning.h"
+#include "../LearnComputerAnimation/BonePalette.h"
+#include "../LearnComputerAnimation/AnimationCrowd.h"
+#include "../LearnComputerAnimation/PoseCache.h"
+#include "../LearnComputerAnimation/BakedClip.h"
+#include "../LearnComputerAnimation/AnimationArchive.h"
+
+using namespace DirectX;
+
+namespace
+{
+	// Counts every heap allocation of the tool, see operator new below.
+	// Job system workers allocate too, so the counter is atomic.
+	std::atomic<size_t> gHeapAllocations(0);
+}
+
+void* operator new(size_t size)
+{
+	gHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size > 0 ? size : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+namespace
+{
+	void PrintUsage()
+	{
+		std::cout << "Usage:\n";
+		std::cout << "  M3dTool reduce <input.m3d> <output.m3d> [translationTol rotationTol scaleTol]\n";
+		std::cout << "  M3dTool bench <input.m3d> [resampleRate]\n";
+		std::cout << "  M3dTool keysearch [maxKeyCount]\n";
+		std::cout << "  M3dTool skin <input.m3d>\n";
+		std::cout << "  M3dTool palette <input.m3d> [instanceCount]\n";
+		std::cout << "  M3dTool crowd <input.m3d> [maxInstanceCount [maxThreadCount]]\n";
+		std::cout << "  M3dTool lod <input.m3d> [instanceCount]\n";
+		std::cout << "  M3dTool posecache <input.m3d> [instanceCount [phaseCount [capacity]]]\n";
+		std::cout << "  M3dTool bake <input.m3d> [instanceCount]\n";
+		std::cout << "  M3dTool blend <input.m3d> [instanceCount]\n";
+		std::cout << "  M3dTool mask <input.m3d> <rootBone> [rootBone ...]\n";
+		std::cout << "  M3dTool channels <input.m3d>\n";
+		std::cout << "  M3dTool compress <input.m3d> [maxPositionError]\n";
+		std::cout << "  M3dTool upload <input.m3d> [instanceCount]\n";
+		std::cout << "  M3dTool archive <input.m3d> <output.m3da> [clipCount [budgetClips]]\n";
+		std::cout << "  M3dTool pipeline <input.m3d> [instanceCount [recordMicroseconds [presentMicroseconds]]]\n";
+		std::cout << "  M3dTool skinbench <input.m3d> [syntheticVertexCount [maxThreadCount]]\n";
+		std::cout << "  M3dTool influences <input.m3d> [weightThreshold]\n";
+	}
+
+	bool LoadModel(M3DLoader& m3dLoader, const char* filename, Model& model,
+		std::vector<SkinnedVertex>& vertices)
+	{
+		std::vector<USHORT> indices;
+		std::vector<M3DLoader::Subset> subsets;
+		std::vector<M3DLoader::M3dMaterial> mats;
+
+		if (!m3dLoader.LoadM3d(filename, vertices, indices, subsets, mats, model))
+		{
+			std::cerr << "Failed to load " << filename << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Plays every clip of the model at 60 fps and returns the average cost of
+	// one GetFinalTransforms call in microseconds. Once an instance is set up
+	// the updates must not touch the heap; allocations counts any that do.
+	double TimeEvaluations(const Model& model, UINT evaluations, size_t& allocations)
+	{
+		allocations = 0;
+
+		std::vector<XMFLOAT3X4> finalTransforms(model.BoneCount());
+		double totalMicroseconds = 0.0;
+
+		for (ClipId clip = 0; clip < model.ClipCount(); ++clip)
+		{
+			AnimationSampler sampler;
+			float endTime = model.GetClipEndTime(clip);
+			float timePos = 0.0f;
+
+			// The first update sets up the sampler.
+			model.GetFinalTransforms(clip, timePos, finalTransforms, sampler);
+			size_t allocationsBefore = gHeapAllocations;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT i = 0; i < evaluations; ++i)
+			{
+				timePos += 1.0f / 60.0f;
+				if (timePos > endTime)
+				{
+					timePos = 0.0f;
+				}
+				model.GetFinalTransforms(clip, timePos, finalTransforms, sampler);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			allocations += gHeapAllocations - allocationsBefore;
+
+			totalMicroseconds += std::chrono::duration<double, std::micro>(end - start).count() / evaluations;
+		}
+
+		return totalMicroseconds / max(1u, model.ClipCount());
+	}
+
+	// Largest difference between the final transforms of two loads of the same model.
+	float MaxTransformError(const Model& a, const Model& b, UINT samples)
+	{
+		std::vector<XMFLOAT3X4> finalA(a.BoneCount());
+		std::vector<XMFLOAT3X4> finalB(b.BoneCount());
+		float maxError = 0.0f;
+
+		for (ClipId clip = 0; clip < a.ClipCount(); ++clip)
+		{
+			const std::string& clipName = a.GetClipName(clip);
+			float endTime = a.GetClipEndTime(clip);
+			for (UINT s = 0; s <= samples; ++s)
+			{
+				float timePos = endTime * s / samples;
+				a.GetFinalTransforms(clipName, timePos, finalA);
+				b.GetFinalTransforms(clipName, timePos, finalB);
+
+				for (UINT i = 0; i < a.BoneCount(); ++i)
+				{
+					for (UINT r = 0; r < 3; ++r)
+					{
+						for (UINT c = 0; c < 4; ++c)
+						{
+							maxError = max(maxError, fabsf(finalA[i](r, c) - finalB[i](r, c)));
+						}
+					}
+				}
+			}
+		}
+
+		return maxError;
+	}
+
+	int Reduce(int argc, char** argv)
+	{
+		if (argc != 4 && argc != 7)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		KeyframeReductionSettings settings;
+		if (argc == 7)
+		{
+			settings.TranslationTolerance = (float)atof(argv[4]);
+			settings.RotationTolerance = (float)atof(argv[5]);
+			settings.ScaleTolerance = (float)atof(argv[6]);
+		}
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		KeyframeReductionReport report;
+		if (!model.ReduceKeyframes(settings, report))
+		{
+			std::cerr << "The clips of " << argv[2] << " have no keyframe tracks to reduce\n";
+			return 1;
+		}
+
+		M3DWriter m3dWriter;
+		if (!m3dWriter.SaveM3dAnimations(argv[2], argv[3], model))
+		{
+			std::cerr << "Failed to write " << argv[3] << "\n";
+			return 1;
+		}
+
+		std::cout << "Keyframes: " << report.KeyframesBefore << " -> " << report.KeyframesAfter << "\n";
+		return 0;
+	}
+
+	// Times GetFinalTransforms on the keyframe tracks, on clips resampled at
+	// resampleRate and on clips packed 4 and 8 bones wide. Packing keeps every
+	// key, so packed clips must match the keyframes up to rounding.
+	int Bench(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT evaluations = 20000;
+
+		Model keyframed;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader keyframedLoader;
+		if (!LoadModel(keyframedLoader, argv[2], keyframed, vertices))
+		{
+			return 1;
+		}
+
+		Model resampled;
+		M3DLoader resampledLoader;
+		resampledLoader.ResampleRate = argc == 4 ? (float)atof(argv[3]) : 30.0f;
+		if (!LoadModel(resampledLoader, argv[2], resampled, vertices))
+		{
+			return 1;
+		}
+
+		const UINT packedLoadCount = 2;
+		const UINT packedLanes[packedLoadCount] = { 4, 8 };
+		Model packed[packedLoadCount];
+		for (UINT p = 0; p < packedLoadCount; ++p)
+		{
+			M3DLoader packedLoader;
+			packedLoader.PackedClipLanes = packedLanes[p];
+			if (!LoadModel(packedLoader, argv[2], packed[p], vertices))
+			{
+				return 1;
+			}
+		}
+
+		size_t keyframedAllocations = 0;
+		size_t resampledAllocations = 0;
+		double keyframedTime = TimeEvaluations(keyframed, evaluations, keyframedAllocations);
+		double resampledTime = TimeEvaluations(resampled, evaluations, resampledAllocations);
+
+		std::cout << "Keyframes:           " << keyframedTime << " us per evaluation\n";
+		std::cout << "Resampled at " << resampledLoader.ResampleRate << " Hz: " <<
+			resampledTime << " us per evaluation, max error " <<
+			MaxTransformError(keyframed, resampled, 1000) << "\n";
+
+		// Packing only reorders the sums of the interpolation.
+		const float packedTolerance = 1e-4f;
+		for (UINT p = 0; p < packedLoadCount; ++p)
+		{
+			size_t packedAllocations = 0;
+			double packedTime = TimeEvaluations(packed[p], evaluations, packedAllocations);
+			float packedError = MaxTransformError(keyframed, packed[p], 1000);
+			std::cout << "Packed " << packedLanes[p] << " wide:       " <<
+				packedTime << " us per evaluation, max error " << packedError << "\n";
+
+			if (packedError > packedTolerance)
+			{
+				std::cerr << "Clips packed " << packedLanes[p] << " wide do not match the keyframes\n";
+				return 1;
+			}
+			if (packedAllocations != 0)
+			{
+				std::cerr << "Steady-state updates allocated: " << packedAllocations << " (packed " <<
+					packedLanes[p] << " wide)\n";
+				return 1;
+			}
+		}
+
+		if (keyframedAllocations != 0 || resampledAllocations != 0)
+		{
+			std::cerr << "Steady-state updates allocated: " << keyframedAllocations << " (keyframes), " <<
+				resampledAllocations << " (resampled)\n";
+			return 1;
+		}
+		std::cout << "Steady-state updates allocated nothing\n";
+		return 0;
+	}
+
+	// BoneAnimation::Interpolate as it was before the keyframe cursors: a
+	// linear scan from the first key for the pair bracketing t.
+	void LinearScanInterpolate(const BoneAnimation& animation, float t, XMFLOAT4X4& M)
+	{
+		const std::vector<Keyframe>& keyframes = animation.Keyframes;
+		XMVECTOR zero = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+		if (t <= keyframes.front().Time)
+		{
+			XMStoreFloat4x4(&M, XMMatrixAffineTransformation(XMLoadFloat3(&keyframes.front().Scale), zero,
+				XMLoadFloat4(&keyframes.front().RotationQuat), XMLoadFloat3(&keyframes.front().Translation)));
+			return;
+		}
+		if (t >= keyframes.back().Time)
+		{
+			XMStoreFloat4x4(&M, XMMatrixAffineTransformation(XMLoadFloat3(&keyframes.back().Scale), zero,
+				XMLoadFloat4(&keyframes.back().RotationQuat), XMLoadFloat3(&keyframes.back().Translation)));
+			return;
+		}
+		for (UINT i = 0; i < keyframes.size() - 1; ++i)
+		{
+			if (t >= keyframes[i].Time && t <= keyframes[i + 1].Time)
+			{
+				float lerpPercent = (t - keyframes[i].Time) / (keyframes[i + 1].Time - keyframes[i].Time);
+				XMVECTOR S = XMVectorLerp(XMLoadFloat3(&keyframes[i].Scale), XMLoadFloat3(&keyframes[i + 1].Scale), lerpPercent);
+				XMVECTOR P = XMVectorLerp(XMLoadFloat3(&keyframes[i].Translation), XMLoadFloat3(&keyframes[i + 1].Translation), lerpPercent);
+				XMVECTOR Q = XMQuaternionSlerp(XMLoadFloat4(&keyframes[i].RotationQuat), XMLoadFloat4(&keyframes[i + 1].RotationQuat), lerpPercent);
+				XMStoreFloat4x4(&M, XMMatrixAffineTransformation(S, zero, Q, P));
+				return;
+			}
+		}
+	}
+
+	// Builds tracks of more and more keys at 30 keys per second and plays each
+	// at 60 fps, once with the linear scan keyframe lookup of the original
+	// code and once with a keyframe cursor. Reports nanoseconds per sample:
+	// the scan grows with the track length, the cursor must stay flat. Both
+	// must interpolate the same pose; at the exact time of a key the scan
+	// lerps the previous pair at 1 and the cursor the next pair at 0, so the
+	// results are compared within a tolerance rather than bit for bit.
+	int KeySearch(int argc, char** argv)
+	{
+		if (argc != 2 && argc != 3)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT maxKeyCount = argc == 3 ? (UINT)atoi(argv[2]) : 16384;
+		const float keyRate = 30.0f;
+		const float sampleRate = 60.0f;
+		// Enough samples per run for about 4 million key comparisons of the scan.
+		const double scanBudget = 4e6;
+
+		std::cout << std::setw(10) << "Keys" << std::setw(16) << "Scan ns" << std::setw(16) << "Cursor ns" <<
+			std::setw(12) << "Speedup" << "\n";
+		for (UINT keyCount = 16; keyCount <= maxKeyCount; keyCount *= 4)
+		{
+			BoneAnimation animation;
+			animation.Keyframes.resize(keyCount);
+			for (UINT k = 0; k < keyCount; ++k)
+			{
+				Keyframe& key = animation.Keyframes[k];
+				key.Time = k / keyRate;
+				key.Translation = XMFLOAT3(sinf(0.1f * k), cosf(0.07f * k), 0.01f * k);
+				XMStoreFloat4(&key.RotationQuat, XMQuaternionRotationRollPitchYaw(0.05f * k, 0.03f * k, 0.02f * k));
+			}
+
+			UINT sampleCount = (UINT)(animation.GetEndTime() * sampleRate) + 1;
+			UINT passes = (UINT)max(1.0, scanBudget / ((double)sampleCount * keyCount / 2));
+
+			float maxError = 0.0f;
+			XMFLOAT4X4 scanM, cursorM;
+			UINT cursor = 0;
+			for (UINT s = 0; s < sampleCount; ++s)
+			{
+				LinearScanInterpolate(animation, s / sampleRate, scanM);
+				animation.Interpolate(s / sampleRate, cursorM, cursor);
+				for (UINT r = 0; r < 4; ++r)
+				{
+					for (UINT c = 0; c < 4; ++c)
+					{
+						maxError = max(maxError, fabsf(scanM(r, c) - cursorM(r, c)));
+					}
+				}
+			}
+
+			// Keeps the compiler from dropping the unused samples.
+			volatile float sink = 0.0f;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT pass = 0; pass < passes; ++pass)
+			{
+				for (UINT s = 0; s < sampleCount; ++s)
+				{
+					LinearScanInterpolate(animation, s / sampleRate, scanM);
+					sink = scanM(3, 0);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			double scanTime = std::chrono::duration<double, std::nano>(end - start).count() / ((double)passes * sampleCount);
+
+			start = std::chrono::high_resolution_clock::now();
+			for (UINT pass = 0; pass < passes; ++pass)
+			{
+				cursor = 0;
+				for (UINT s = 0; s < sampleCount; ++s)
+				{
+					animation.Interpolate(s / sampleRate, cursorM, cursor);
+					sink = cursorM(3, 0);
+				}
+			}
+			end = std::chrono::high_resolution_clock::now();
+			double cursorTime = std::chrono::duration<double, std::nano>(end - start).count() / ((double)passes * sampleCount);
+
+			std::cout << std::setw(10) << keyCount << std::setw(16) << scanTime << std::setw(16) << cursorTime <<
+				std::setw(12) << scanTime / cursorTime << "\n";
+
+			if (maxError > 1e-5f)
+			{
+				std::cerr << "The cursor lookup does not match the linear scan: max error " << maxError << "\n";
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	// Reports the channels of every clip found constant or identity at load
+	// time, and compares the evaluation cost and result with a load that
+	// keeps every channel animated.
+	int Channels(int argc, char** argv)
+	{
+		if (argc != 3)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT evaluations = 20000;
+
+		Model classified;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader classifiedLoader;
+		if (!LoadModel(classifiedLoader, argv[2], classified, vertices))
+		{
+			return 1;
+		}
+
+		Model animated;
+		M3DLoader animatedLoader;
+		animatedLoader.ClassifyChannels = false;
+		if (!LoadModel(animatedLoader, argv[2], animated, vertices))
+		{
+			return 1;
+		}
+
+		std::cout << std::setw(16) << "Clip" << std::setw(10) << "Animated" << std::setw(10) << "Constant" <<
+			std::setw(10) << "Identity" << std::setw(12) << "Eliminated" << std::setw(16) << "Constant tracks" << "\n";
+		for (ClipId clip = 0; clip < classified.ClipCount(); ++clip)
+		{
+			const AnimationChannelReport& report = classified.GetClip(clip).Channels;
+			UINT channels = report.AnimatedChannels + report.ConstantChannels + report.IdentityChannels;
+			std::cout << std::setw(16) << classified.GetClipName(clip) << std::setw(10) << report.AnimatedChannels <<
+				std::setw(10) << report.ConstantChannels << std::setw(10) << report.IdentityChannels <<
+				std::setw(12) << channels - report.AnimatedChannels << std::setw(16) << report.ConstantTracks << "\n";
+		}
+
+		size_t allocations = 0;
+		double animatedTime = TimeEvaluations(animated, evaluations, allocations);
+		double classifiedTime = TimeEvaluations(classified, evaluations, allocations);
+		std::cout << "Every channel animated: " << animatedTime << " us per evaluation\n";
+		std::cout << "Constant channels skipped: " << classifiedTime << " us per evaluation, max error " <<
+			MaxTransformError(animated, classified, 1000) << "\n";
+		return 0;
+	}
+
+	// Compresses every clip with Model::CompressClip and reports the sizes,
+	// the compression ratio, the bone tip error and the channels stored
+	// constant or quantized. Then compares the evaluation cost and result
+	// with an uncompressed load. Fails when a clip exceeds the error budget or
+	// the final transforms drift from the uncompressed ones.
+	int Compress(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT evaluations = 20000;
+		float maxPositionError = argc == 4 ? (float)atof(argv[3]) : 0.01f;
+
+		Model keyframed;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader keyframedLoader;
+		if (!LoadModel(keyframedLoader, argv[2], keyframed, vertices))
+		{
+			return 1;
+		}
+
+		Model compressed;
+		M3DLoader compressedLoader;
+		if (!LoadModel(compressedLoader, argv[2], compressed, vertices))
+		{
+			return 1;
+		}
+
+		std::cout << "Error budget " << maxPositionError << "\n";
+		std::cout << std::setw(16) << "Clip" << std::setw(12) << "Original" << std::setw(12) << "Compressed" <<
+			std::setw(10) << "Ratio" << std::setw(14) << "Max error" << std::setw(10) << "Constant" <<
+			std::setw(10) << "Animated" << "\n";
+		bool withinBudget = true;
+		for (ClipId clip = 0; clip < compressed.ClipCount(); ++clip)
+		{
+			AnimationCompressionReport report;
+			if (!compressed.CompressClip(compressed.GetClipName(clip), maxPositionError, report))
+			{
+				std::cerr << "Clip " << compressed.GetClipName(clip) << " has no keyframe tracks to compress\n";
+				return 1;
+			}
+			std::cout << std::setw(16) << compressed.GetClipName(clip) << std::setw(12) << report.OriginalBytes <<
+				std::setw(12) << report.CompressedBytes << std::setw(10) << report.CompressionRatio <<
+				std::setw(14) << report.MaxPositionError << std::setw(10) << report.ConstantChannels <<
+				std::setw(10) << report.AnimatedChannels << "\n";
+			withinBudget = withinBudget && report.MaxPositionError <= maxPositionError;
+		}
+
+		size_t allocations = 0;
+		double keyframedTime = TimeEvaluations(keyframed, evaluations, allocations);
+		double compressedTime = TimeEvaluations(compressed, evaluations, allocations);
+		float transformError = MaxTransformError(keyframed, compressed, 1000);
+		std::cout << "Keyframes:  " << keyframedTime << " us per evaluation\n";
+		std::cout << "Compressed: " << compressedTime << " us per evaluation, max error " << transformError << "\n";
+
+		if (!withinBudget)
+		{
+			std::cerr << "Compressed clips exceed the error budget of " << maxPositionError << "\n";
+			return 1;
+		}
+		// The translation of a final transform is where the model origin ends
+		// up, which lies much further from most bones than their tips, so a
+		// rotation error moves it several times more than the tip error.
+		if (transformError > 16.0f * maxPositionError)
+		{
+			std::cerr << "Compressed final transforms differ by " << transformError << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	// Fills one 256-byte aligned palette slot per instance, laid out as the
+	// SkinnedCB upload buffer, once through FinalTransforms and a copy of
+	// SkinnedConstants, and once by evaluating straight into the slots.
+	// Both must write the same bytes. Then cycles through frame resources
+	// with playing, paused and LOD-held instances, uploading only the
+	// palettes whose pose version changed, and checks that every slot
+	// holds the palette the instance shows.
+	int Upload(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT frames = 120;
+		const float dt = 1.0f / 60.0f;
+		const UINT maxBones = 96;
+		UINT instanceCount = argc == 4 ? (UINT)atoi(argv[3]) : 1024;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+		if (model.BoneCount() > maxBones)
+		{
+			std::cerr << model.BoneCount() << " bones do not fit in SkinnedConstants\n";
+			return 1;
+		}
+
+		// Constant buffer elements are padded to a multiple of 256 bytes.
+		const UINT slotSize = (maxBones * sizeof(XMFLOAT3X4) + 255) & ~255u;
+		std::vector<std::vector<BYTE>> mapped(2, std::vector<BYTE>(instanceCount * slotSize));
+
+		double frameTimes[2] = {};
+		size_t copiedBytes[2] = {};
+		for (int direct = 0; direct < 2; ++direct)
+		{
+			std::vector<ModelInstance> instances(instanceCount);
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ModelInstance& instance = instances[i];
+				instance.ModelInfo = &model;
+				instance.FinalTransforms.resize(model.BoneCount());
+				instance.Clip = i % model.ClipCount();
+				instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				for (UINT i = 0; i < instanceCount; ++i)
+				{
+					ModelInstance& instance = instances[i];
+					BYTE* slot = &mapped[direct][i * slotSize];
+					instance.AdvanceTime(dt);
+					if (direct)
+					{
+						instance.EvaluatePalette(reinterpret_cast<XMFLOAT3X4*>(slot));
+					}
+					else
+					{
+						instance.EvaluatePalette();
+						XMFLOAT3X4 skinnedConstants[maxBones];
+						std::copy(instance.FinalTransforms.begin(), instance.FinalTransforms.end(), skinnedConstants);
+						memcpy(slot, skinnedConstants, sizeof(skinnedConstants));
+						copiedBytes[direct] += model.BoneCount() * sizeof(XMFLOAT3X4) + sizeof(skinnedConstants);
+					}
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			frameTimes[direct] = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+		}
+
+		std::cout << instanceCount << " instances of " << model.BoneCount() << " bones\n";
+		std::cout << "Copy through SkinnedConstants: " << frameTimes[0] << " ms per frame, " <<
+			copiedBytes[0] / frames << " bytes copied per frame\n";
+		std::cout << "Evaluate into the slots:       " << frameTimes[1] << " ms per frame, " <<
+			copiedBytes[1] / frames << " bytes copied per frame\n";
+
+		size_t paletteBytes = model.BoneCount() * sizeof(XMFLOAT3X4);
+		for (UINT i = 0; i < instanceCount; ++i)
+		{
+			if (memcmp(&mapped[0][i * slotSize], &mapped[1][i * slotSize], paletteBytes) != 0)
+			{
+				std::cerr << "Instance " << i << " wrote a different palette\n";
+				return 1;
+			}
+		}
+		std::cout << "Both paths wrote the same palettes\n";
+
+		// One in four instances each: playing, paused, held by a quarter rate
+		// LOD, and interpolated by a half rate LOD.
+		const UINT frameResourceCount = 3;
+		std::vector<std::vector<BYTE>> frameResources(frameResourceCount, std::vector<BYTE>(instanceCount * slotSize));
+		std::vector<std::vector<UINT64>> uploadedVersions(frameResourceCount, std::vector<UINT64>(instanceCount, 0));
+		std::vector<ModelInstance> instances(instanceCount);
+		for (UINT i = 0; i < instanceCount; ++i)
+		{
+			ModelInstance& instance = instances[i];
+			instance.ModelInfo = &model;
+			instance.FinalTransforms.resize(model.BoneCount());
+			instance.Clip = i % model.ClipCount();
+			instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+			instance.Paused = i % 4 == 1;
+			instance.Lod = i % 4 == 2 ? AnimationLodQuarter : i % 4 == 3 ? AnimationLodHalf : AnimationLodFull;
+			instance.InterpolateLod = i % 4 == 3;
+			instance.LodPhase = i;
+		}
+
+		std::vector<XMFLOAT3X4> expected(model.BoneCount());
+		UINT64 uploadedBytes = 0;
+		UINT64 skippedUploads = 0;
+		UINT mismatches = 0;
+		for (UINT frame = 0; frame < frames; ++frame)
+		{
+			std::vector<BYTE>& frameResource = frameResources[frame % frameResourceCount];
+			PaletteUploadStats stats;
+			AnimationLodStats lodStats;
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ModelInstance& instance = instances[i];
+				XMFLOAT3X4* slot = reinterpret_cast<XMFLOAT3X4*>(&frameResource[i * slotSize]);
+				if (instance.Lod != AnimationLodFull)
+				{
+					instance.UpdateSkinnedAnimation(dt, frame, lodStats);
+					expected = instance.FinalTransforms;
+				}
+				else
+				{
+					instance.AdvanceTime(dt);
+					instance.EvaluatePalette(expected.data());
+				}
+				instance.UploadPalette(slot, uploadedVersions[frame % frameResourceCount][i], stats);
+
+				if (memcmp(slot, expected.data(), paletteBytes) != 0)
+				{
+					++mismatches;
+				}
+			}
+			// The first frames fill every frame resource.
+			if (frame >= frameResourceCount)
+			{
+				uploadedBytes += stats.UploadedBytes;
+				skippedUploads += stats.SkippedUploads;
+			}
+		}
+
+		UINT measuredFrames = frames - frameResourceCount;
+		std::cout << "Every palette uploaded:   " << instanceCount * paletteBytes << " bytes per frame\n";
+		std::cout << "Changed palettes only:    " << uploadedBytes / measuredFrames << " bytes per frame, " <<
+			(float)skippedUploads / measuredFrames << " uploads skipped per frame\n";
+		if (mismatches != 0)
+		{
+			std::cerr << mismatches << " slots did not hold the palette of their instance\n";
+			return 1;
+		}
+		std::cout << "Every frame resource holds the palette its instances show\n";
+		return 0;
+	}
+
+	// Skins the mesh on the CPU with both palettes over every clip. Vertices
+	// bound to a single bone must land in the same place; blended vertices
+	// differ by design, dual quaternions do not collapse at twisted joints.
+	int Skin(int argc, char** argv)
+	{
+		if (argc != 3)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT samples = 60;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		// Tolerance relative to the size of the bind pose mesh.
+		XMFLOAT3 boxMin(FLT_MAX, FLT_MAX, FLT_MAX);
+		XMFLOAT3 boxMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (const auto& v : vertices)
+		{
+			boxMin = XMFLOAT3(min(boxMin.x, v.Pos.x), min(boxMin.y, v.Pos.y), min(boxMin.z, v.Pos.z));
+			boxMax = XMFLOAT3(max(boxMax.x, v.Pos.x), max(boxMax.y, v.Pos.y), max(boxMax.z, v.Pos.z));
+		}
+		float extent = max(boxMax.x - boxMin.x, max(boxMax.y - boxMin.y, boxMax.z - boxMin.z));
+		float tolerance = 1e-4f * extent;
+
+		std::vector<XMFLOAT3X4> finalTransforms(model.BoneCount());
+		std::vector<XMFLOAT4> palette(2 * model.BoneCount());
+
+		float maxRigidError = 0.0f;
+		float maxBlendedError = 0.0f;
+		double sumBlendedError = 0.0;
+		size_t blendedCount = 0;
+		for (ClipId clip = 0; clip < model.ClipCount(); ++clip)
+		{
+			const std::string& clipName = model.GetClipName(clip);
+			float startTime = model.GetClipStartTime(clip);
+			float endTime = model.GetClipEndTime(clip);
+			for (UINT s = 0; s <= samples; ++s)
+			{
+				float timePos = startTime + (endTime - startTime) * s / samples;
+				model.GetFinalTransforms(clipName, timePos, finalTransforms);
+				model.GetFinalDualQuaternions(clipName, timePos, palette);
+
+				for (const auto& v : vertices)
+				{
+					XMFLOAT3 linearPos, linearNormal, dqPos, dqNormal;
+					SkinVertexLinear(v, finalTransforms, linearPos, linearNormal);
+					SkinVertexDualQuaternion(v, palette, dqPos, dqNormal);
+
+					float error = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&linearPos), XMLoadFloat3(&dqPos))));
+					float maxWeight = max(max(v.BoneWeights.x, v.BoneWeights.y),
+						max(v.BoneWeights.z, 1.0f - v.BoneWeights.x - v.BoneWeights.y - v.BoneWeights.z));
+					if (maxWeight > 0.999f)
+					{
+						maxRigidError = max(maxRigidError, error);
+					}
+					else
+					{
+						maxBlendedError = max(maxBlendedError, error);
+						sumBlendedError += error;
+						++blendedCount;
+					}
+				}
+			}
+		}
+
+		std::cout << "Mesh size " << extent << ", tolerance " << tolerance << "\n";
+		std::cout << "Rigid vertices:   max difference " << maxRigidError << "\n";
+		std::cout << "Blended vertices: max difference " << maxBlendedError << ", average " <<
+			(blendedCount > 0 ? sumBlendedError / blendedCount : 0.0) << "\n";
+
+		if (maxRigidError > tolerance)
+		{
+			std::cerr << "Dual quaternion skinning does not match matrix skinning\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	// Packs several instances of the model, each at its own time, into one
+	// BonePalette the way WinMain uploads them, and checks that every instance
+	// skins the same from its offset in the palette as from its own transforms.
+	int Palette(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT frames = 10;
+		UINT instanceCount = argc == 4 ? (UINT)atoi(argv[3]) : 8;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		BonePalette palette;
+		std::vector<ModelInstance> instances(instanceCount);
+		for (UINT i = 0; i < instanceCount; ++i)
+		{
+			ModelInstance& instance = instances[i];
+			instance.ModelInfo = &model;
+			instance.FinalTransforms.resize(model.BoneCount());
+			instance.Clip = i % model.ClipCount();
+			instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+			instance.BonePaletteOffset = palette.Allocate(model.BoneCount());
+
+			if (instance.BonePaletteOffset != i * model.BoneCount())
+			{
+				std::cerr << "Instance " << i << " got offset " << instance.BonePaletteOffset << "\n";
+				return 1;
+			}
+		}
+		if (palette.BoneCount() != instanceCount * model.BoneCount())
+		{
+			std::cerr << "Palette holds " << palette.BoneCount() << " bones\n";
+			return 1;
+		}
+
+		UINT mismatches = 0;
+		for (UINT frame = 0; frame < frames; ++frame)
+		{
+			for (auto& instance : instances)
+			{
+				instance.UpdateSkinnedAnimation(1.0f / 60.0f);
+				palette.Write(instance.BonePaletteOffset, instance.FinalTransforms);
+			}
+
+			for (const auto& instance : instances)
+			{
+				const XMFLOAT3X4* bones = &palette.Bones[instance.BonePaletteOffset];
+				for (const auto& v : vertices)
+				{
+					XMFLOAT3 pos, normal, palettePos, paletteNormal;
+					SkinVertexLinear(v, instance.FinalTransforms, pos, normal);
+					SkinVertexLinear(v, bones, palettePos, paletteNormal);
+					if (memcmp(&pos, &palettePos, sizeof(pos)) != 0 || memcmp(&normal, &paletteNormal, sizeof(normal)) != 0)
+					{
+						++mismatches;
+					}
+				}
+			}
+		}
+
+		std::cout << instanceCount << " instances of " << model.BoneCount() << " bones: " <<
+			palette.BoneCount() << " palette entries, " << palette.SizeInBytes() << " bytes per upload\n";
+
+		if (mismatches != 0)
+		{
+			std::cerr << mismatches << " vertices skinned differently from the palette\n";
+			return 1;
+		}
+		std::cout << "Every instance skins the same from its palette offset\n";
+		return 0;
+	}
+
+	// Builds a crowd of instanceCount instances cycling through the clips.
+	void FillCrowd(const Model& model, UINT instanceCount, AnimationCrowd& crowd)
+	{
+		for (UINT i = 0; i < instanceCount; ++i)
+		{
+			ClipId clip = i % model.ClipCount();
+			crowd.Add(clip, model.GetClipEndTime(clip) * i / instanceCount);
+		}
+	}
+
+	// Updates growing crowds through AnimationCrowd (Model::EvaluateMany, in
+	// batches), through GetFinalTransforms one instance at a time, and as
+	// separate ModelInstances copied into a BonePalette, and reports instances
+	// updated per millisecond. All must produce the same palette, and the crowd
+	// must not allocate once it is set up. Then updates the largest crowd on a
+	// JobSystem with more and more threads.
+	int Crowd(int argc, char** argv)
+	{
+		if (argc < 3 || argc > 5)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT maxInstanceCount = argc >= 4 ? (UINT)atoi(argv[3]) : 4096;
+		UINT maxThreadCount = argc == 5 ? (UINT)atoi(argv[4]) : JobSystem::DefaultWorkerCount() + 1;
+		const float dt = 1.0f / 60.0f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		std::cout << "Instances per millisecond\n";
+		std::cout << std::setw(10) << "Instances" << std::setw(16) << "EvaluateMany" << std::setw(16) << "Per instance" <<
+			std::setw(16) << "ModelInstance" << "\n";
+		for (UINT instanceCount = 1; instanceCount <= maxInstanceCount; instanceCount *= 4)
+		{
+			// Enough frames for about 20000 instance updates.
+			UINT frames = max(10u, 20000 / instanceCount);
+
+			AnimationCrowd crowd(model);
+			std::vector<ModelInstance> instances(instanceCount);
+			BonePalette palette;
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ClipId clip = i % model.ClipCount();
+				float timePos = model.GetClipEndTime(clip) * i / instanceCount;
+				crowd.Add(clip, timePos);
+
+				ModelInstance& instance = instances[i];
+				instance.ModelInfo = &model;
+				instance.FinalTransforms.resize(model.BoneCount());
+				instance.Clip = clip;
+				instance.TimePos = timePos;
+			}
+			// The crowd groups its instances by clip; lay out the palette the same way.
+			std::stable_sort(instances.begin(), instances.end(),
+				[](const ModelInstance& a, const ModelInstance& b) { return a.Clip < b.Clip; });
+			for (auto& instance : instances)
+			{
+				instance.BonePaletteOffset = palette.Allocate(model.BoneCount());
+			}
+
+			// The first update sets up the samplers.
+			crowd.Update(dt);
+			size_t allocationsBefore = gHeapAllocations;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				crowd.Update(dt);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			size_t crowdAllocations = gHeapAllocations - allocationsBefore;
+			double crowdMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+			// The same instances evaluated one after the other, as EvaluateMany did before batching.
+			std::vector<InstanceState> states(instanceCount);
+			BonePalette statePalette;
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				states[i].Clip = instances[i].Clip;
+				states[i].TimePos = instances[i].TimePos;
+				states[i].PaletteOffset = statePalette.Allocate(model.BoneCount());
+			}
+			auto updateStates = [&]()
+			{
+				for (auto& state : states)
+				{
+					state.TimePos += dt;
+					if (state.TimePos > model.GetClipEndTime(state.Clip))
+					{
+						state.TimePos = 0.0f;
+					}
+					model.GetFinalTransforms(state.Clip, state.TimePos, &statePalette.Bones[state.PaletteOffset], state.Sampler);
+				}
+			};
+			updateStates();
+			start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				updateStates();
+			}
+			end = std::chrono::high_resolution_clock::now();
+			double stateMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+			for (auto& instance : instances)
+			{
+				instance.UpdateSkinnedAnimation(dt);
+				palette.Write(instance.BonePaletteOffset, instance.FinalTransforms);
+			}
+			start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				for (auto& instance : instances)
+				{
+					instance.UpdateSkinnedAnimation(dt);
+					palette.Write(instance.BonePaletteOffset, instance.FinalTransforms);
+				}
+			}
+			end = std::chrono::high_resolution_clock::now();
+			double instanceMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+			std::cout << std::setw(10) << instanceCount <<
+				std::setw(16) << (double)instanceCount * frames / crowdMilliseconds <<
+				std::setw(16) << (double)instanceCount * frames / stateMilliseconds <<
+				std::setw(16) << (double)instanceCount * frames / instanceMilliseconds << "\n";
+
+			if (memcmp(crowd.GetPalette().Bones.data(), palette.Bones.data(), palette.SizeInBytes()) != 0)
+			{
+				std::cerr << "EvaluateMany does not match GetFinalTransforms for " << instanceCount << " instances\n";
+				return 1;
+			}
+			if (memcmp(statePalette.Bones.data(), palette.Bones.data(), palette.SizeInBytes()) != 0)
+			{
+				std::cerr << "Per instance evaluation does not match GetFinalTransforms for " << instanceCount << " instances\n";
+				return 1;
+			}
+			if (crowdAllocations != 0)
+			{
+				std::cerr << "Crowd updates allocated " << crowdAllocations << " times\n";
+				return 1;
+			}
+		}
+
+		// Thread scaling of the largest crowd. Every run starts from the same
+		// state and must end with the palette of a single-threaded update.
+		const UINT frames = max(10u, 20000 / maxInstanceCount);
+		AnimationCrowd reference(model);
+		FillCrowd(model, maxInstanceCount, reference);
+		for (UINT frame = 0; frame <= frames; ++frame)
+		{
+			reference.Update(dt);
+		}
+
+		// Threads beyond the hardware threads only time-slice, their speedup means nothing.
+		std::cout << "\n" << maxInstanceCount << " instances, " << std::thread::hardware_concurrency() << " hardware threads\n";
+		std::cout << std::setw(10) << "Threads" << std::setw(16) << "Instances/ms" << std::setw(16) << "Speedup" << "\n";
+		double singleThreaded = 0.0;
+		for (UINT threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2)
+		{
+			JobSystem jobSystem(threadCount - 1);
+			AnimationCrowd crowd(model);
+			FillCrowd(model, maxInstanceCount, crowd);
+
+			crowd.Update(dt, jobSystem);
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				crowd.Update(dt, jobSystem);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			double instancesPerMillisecond = (double)maxInstanceCount * frames /
+				std::chrono::duration<double, std::milli>(end - start).count();
+			if (threadCount == 1)
+			{
+				singleThreaded = instancesPerMillisecond;
+			}
+
+			std::cout << std::setw(10) << threadCount << std::setw(16) << instancesPerMillisecond <<
+				std::setw(16) << instancesPerMillisecond / singleThreaded << "\n";
+
+			if (memcmp(crowd.GetPalette().Bones.data(), reference.GetPalette().Bones.data(),
+				reference.GetPalette().SizeInBytes()) != 0)
+			{
+				std::cerr << "Multithreaded update with " << threadCount << " threads does not match\n";
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	// Spreads a crowd from 0 to 100 units away and plays it with animation LOD,
+	// holding and then interpolating the palette between updates. Reports the
+	// evaluations per frame, which must stay flat thanks to the staggering,
+	// and how far the palettes drift from a crowd updated every frame. A last
+	// interpolating run moves every instance to another LOD halfway through;
+	// its palettes must drift no further than those of the steady run.
+	int Lod(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT frames = 240;
+		const float dt = 1.0f / 60.0f;
+		UINT instanceCount = argc == 4 ? (UINT)atoi(argv[3]) : 256;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		AnimationLodSettings settings;
+		UINT lodCounts[AnimationLodCount] = {};
+		float steadyError = 0.0f;
+
+		for (int run = 0; run < 3; ++run)
+		{
+			bool interpolate = run > 0;
+			bool changeLod = run == 2;
+			std::vector<ModelInstance> instances(instanceCount);
+			std::vector<ModelInstance> references(instanceCount);
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				float distance = 100.0f * i / instanceCount;
+				for (ModelInstance* instance : { &instances[i], &references[i] })
+				{
+					instance->ModelInfo = &model;
+					instance->FinalTransforms.resize(model.BoneCount());
+					instance->Clip = i % model.ClipCount();
+					instance->TimePos = model.GetClipEndTime(instance->Clip) * i / instanceCount;
+				}
+				instances[i].Lod = SelectAnimationLod(settings, distance, 1.0f, true);
+				instances[i].LodPhase = i;
+				instances[i].InterpolateLod = interpolate;
+				lodCounts[instances[i].Lod] += run == 0 ? 1 : 0;
+			}
+
+			UINT minEvaluations = UINT_MAX;
+			UINT maxEvaluations = 0;
+			UINT totalSaved = 0;
+			float maxError[AnimationLodCount] = {};
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				AnimationLodStats stats;
+				for (UINT i = 0; i < instanceCount; ++i)
+				{
+					if (changeLod && frame == frames / 2)
+					{
+						// Full to half, half to quarter and quarter to full rate.
+						instances[i].Lod = (AnimationLod)((instances[i].Lod + 1) % AnimationLodCount);
+					}
+					instances[i].UpdateSkinnedAnimation(dt, frame, stats);
+					references[i].UpdateSkinnedAnimation(dt);
+
+					// Skip the start-up frames, every instance evaluates on its first update.
+					if (frame < 4)
+					{
+						continue;
+					}
+					for (UINT b = 0; b < model.BoneCount(); ++b)
+					{
+						for (UINT r = 0; r < 3; ++r)
+						{
+							for (UINT c = 0; c < 4; ++c)
+							{
+								float error = fabsf(instances[i].FinalTransforms[b](r, c) - references[i].FinalTransforms[b](r, c));
+								maxError[instances[i].Lod] = max(maxError[instances[i].Lod], error);
+							}
+						}
+					}
+				}
+				if (frame >= 4)
+				{
+					minEvaluations = min(minEvaluations, stats.Evaluations);
+					maxEvaluations = max(maxEvaluations, stats.Evaluations);
+					totalSaved += stats.SavedEvaluations;
+				}
+			}
+
+			if (run == 0)
+			{
+				std::cout << instanceCount << " instances: " << lodCounts[AnimationLodFull] << " full rate, " <<
+					lodCounts[AnimationLodHalf] << " half rate, " << lodCounts[AnimationLodQuarter] << " quarter rate\n";
+			}
+			static const char* runNames[] = { "Hold:        ", "Interpolate: ", "Change LOD:  " };
+			std::cout << runNames[run] <<
+				"evaluations per frame " << minEvaluations << " to " << maxEvaluations <<
+				", saved per frame " << (float)totalSaved / (frames - 4) <<
+				", max palette error (half, quarter) " << maxError[AnimationLodHalf] << ", " << maxError[AnimationLodQuarter] << "\n";
+
+			if (maxError[AnimationLodFull] != 0.0f)
+			{
+				std::cerr << "Full rate instances do not match\n";
+				return 1;
+			}
+			// Staggering keeps every frame within one evaluation per LOD level of the average.
+			// Changing the LOD updates the instances out of turn once.
+			if (!changeLod && maxEvaluations - minEvaluations > AnimationLodCount)
+			{
+				std::cerr << "Evaluations are not spread evenly over the frames\n";
+				return 1;
+			}
+			if (run == 1)
+			{
+				steadyError = max(maxError[AnimationLodHalf], maxError[AnimationLodQuarter]);
+			}
+			// Interpolating past the pose evaluated ahead would extrapolate the palette.
+			if (changeLod && max(maxError[AnimationLodHalf], maxError[AnimationLodQuarter]) > steadyError)
+			{
+				std::cerr << "Palettes drift further after a LOD change\n";
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	// Plays a crowd in lockstep with a few phase offsets, once through a shared
+	// PoseCache and once without. When the cache can hold a frame's poses, each
+	// distinct pose must be evaluated once per frame. Reports the hit rate, the
+	// speedup and the error of rounding the time to the cache sample rate.
+	int PoseCacheBench(int argc, char** argv)
+	{
+		if (argc < 3 || argc > 6)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT frames = 120;
+		const float dt = 1.0f / 60.0f;
+		UINT instanceCount = argc >= 4 ? (UINT)atoi(argv[3]) : 1024;
+		UINT phaseCount = argc >= 5 ? max(1, atoi(argv[4])) : 4;
+		UINT capacity = argc >= 6 ? (UINT)atoi(argv[5]) : 64;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		PoseCache cache(model, capacity);
+		std::vector<ModelInstance> cached(instanceCount);
+		std::vector<ModelInstance> uncached(instanceCount);
+		for (UINT i = 0; i < instanceCount; ++i)
+		{
+			ClipId clip = i % model.ClipCount();
+			UINT phase = (i / model.ClipCount()) % phaseCount;
+			for (ModelInstance* instance : { &cached[i], &uncached[i] })
+			{
+				instance->ModelInfo = &model;
+				instance->FinalTransforms.resize(model.BoneCount());
+				instance->Clip = clip;
+				instance->TimePos = model.GetClipEndTime(clip) * phase / phaseCount;
+			}
+			cached[i].SharedPoses = &cache;
+		}
+
+		UINT distinctPoses = min(instanceCount, phaseCount * model.ClipCount());
+		UINT64 maxMissesPerFrame = 0;
+		float maxError = 0.0f;
+		double cachedMilliseconds = 0.0;
+		double uncachedMilliseconds = 0.0;
+		for (UINT frame = 0; frame < frames; ++frame)
+		{
+			UINT64 missesBefore = cache.Misses();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (auto& instance : cached)
+			{
+				instance.UpdateSkinnedAnimation(dt);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			cachedMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+			maxMissesPerFrame = max(maxMissesPerFrame, cache.Misses() - missesBefore);
+
+			start = std::chrono::high_resolution_clock::now();
+			for (auto& instance : uncached)
+			{
+				instance.UpdateSkinnedAnimation(dt);
+			}
+			end = std::chrono::high_resolution_clock::now();
+			uncachedMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				for (UINT b = 0; b < model.BoneCount(); ++b)
+				{
+					for (UINT r = 0; r < 3; ++r)
+					{
+						for (UINT c = 0; c < 4; ++c)
+						{
+							maxError = max(maxError, fabsf(cached[i].FinalTransforms[b](r, c) - uncached[i].FinalTransforms[b](r, c)));
+						}
+					}
+				}
+			}
+		}
+
+		std::cout << instanceCount << " instances, " << distinctPoses << " distinct poses per frame, capacity " <<
+			cache.Capacity() << " (" << cache.SizeInBytes() << " bytes)\n";
+		std::cout << "Hit rate " << cache.HitRate() << ", " << cache.Misses() << " misses, " <<
+			cache.Evictions() << " evictions, at most " << maxMissesPerFrame << " evaluations per frame\n";
+		std::cout << "Cached " << cachedMilliseconds / frames << " ms per frame, uncached " <<
+			uncachedMilliseconds / frames << " ms per frame, max palette error " << maxError << "\n";
+
+		if (cache.Capacity() < distinctPoses)
+		{
+			std::cout << "The cache is smaller than the poses of one frame; LRU eviction thrashes\n";
+		}
+		else if (maxMissesPerFrame > distinctPoses)
+		{
+			std::cerr << "Poses were evaluated more than once per frame\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	// Bakes every clip at a few frame rates and reports the size, which must
+	// match BakedClip::EstimateSizeInBytes, and the error against evaluating
+	// the clip, copying the nearest frame or interpolating. Then times a crowd
+	// evaluated, and sampling clips baked at 60 Hz.
+	int Bake(int argc, char** argv)
+	{
+		if (argc < 3 || argc > 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT instanceCount = argc == 4 ? (UINT)atoi(argv[3]) : 1024;
+		const UINT frames = 120;
+		const UINT samples = 1000;
+		const float dt = 1.0f / 60.0f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		std::vector<XMFLOAT3X4> expected(model.BoneCount());
+		std::vector<XMFLOAT3X4> baked(model.BoneCount());
+		AnimationSampler sampler;
+		std::cout << std::setw(10) << "Rate" << std::setw(12) << "Bytes" << std::setw(12) << "Bake ms" <<
+			std::setw(16) << "Nearest error" << std::setw(16) << "Lerp error" << "\n";
+		for (float frameRate : { 15.0f, 30.0f, 60.0f, 120.0f })
+		{
+			size_t estimatedBytes = 0;
+			size_t bytes = 0;
+			double bakeMilliseconds = 0.0;
+			float maxError[2] = { 0.0f, 0.0f };
+			for (ClipId clip = 0; clip < model.ClipCount(); ++clip)
+			{
+				BakedClip bakedClip;
+				auto start = std::chrono::high_resolution_clock::now();
+				bakedClip.Bake(model, clip, frameRate);
+				auto end = std::chrono::high_resolution_clock::now();
+				bakeMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+				estimatedBytes += BakedClip::EstimateSizeInBytes(model, clip, frameRate);
+				bytes += bakedClip.SizeInBytes();
+
+				float startTime = model.GetClipStartTime(clip);
+				float endTime = model.GetClipEndTime(clip);
+				for (UINT s = 0; s <= samples; ++s)
+				{
+					float timePos = startTime + (endTime - startTime) * s / samples;
+					model.GetFinalTransforms(clip, timePos, expected, sampler);
+					for (int interpolate = 0; interpolate < 2; ++interpolate)
+					{
+						bakedClip.Sample(timePos, baked.data(), interpolate != 0);
+						for (UINT i = 0; i < model.BoneCount(); ++i)
+						{
+							for (UINT r = 0; r < 3; ++r)
+							{
+								for (UINT c = 0; c < 4; ++c)
+								{
+									maxError[interpolate] = max(maxError[interpolate], fabsf(expected[i](r, c) - baked[i](r, c)));
+								}
+							}
+						}
+					}
+				}
+			}
+
+			std::cout << std::setw(10) << frameRate << std::setw(12) << bytes << std::setw(12) << bakeMilliseconds <<
+				std::setw(16) << maxError[0] << std::setw(16) << maxError[1] << "\n";
+			if (bytes != estimatedBytes)
+			{
+				std::cerr << "Estimated " << estimatedBytes << " bytes\n";
+				return 1;
+			}
+		}
+
+		std::vector<BakedClip> bakedClips(model.ClipCount());
+		for (ClipId clip = 0; clip < model.ClipCount(); ++clip)
+		{
+			bakedClips[clip].Bake(model, clip, 60.0f);
+		}
+
+		std::cout << "\n" << instanceCount << " instances\n";
+		std::cout << std::setw(10) << "Mode" << std::setw(16) << "ms per frame" << "\n";
+		const char* modes[] = { "Evaluate", "Nearest", "Lerp" };
+		for (int mode = 0; mode < 3; ++mode)
+		{
+			AnimationCrowd crowd(model);
+			FillCrowd(model, instanceCount, crowd);
+			if (mode != 0)
+			{
+				for (const BakedClip& bakedClip : bakedClips)
+				{
+					crowd.SetBakedClip(&bakedClip, mode == 2);
+				}
+			}
+
+			crowd.Update(dt);
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				crowd.Update(dt);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			std::cout << std::setw(10) << modes[mode] << std::setw(16) <<
+				std::chrono::duration<double, std::milli>(end - start).count() / frames << "\n";
+		}
+		return 0;
+	}
+
+	float MaxElementError(const XMFLOAT3X4& a, const XMFLOAT3X4& b)
+	{
+		float maxError = 0.0f;
+		for (UINT r = 0; r < 3; ++r)
+		{
+			for (UINT c = 0; c < 4; ++c)
+			{
+				maxError = max(maxError, fabsf(a(r, c) - b(r, c)));
+			}
+		}
+		return maxError;
+	}
+
+	float MaxPaletteError(const std::vector<XMFLOAT3X4>& a, const std::vector<XMFLOAT3X4>& b)
+	{
+		float maxError = 0.0f;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			maxError = max(maxError, MaxElementError(a[i], b[i]));
+		}
+		return maxError;
+	}
+
+	// Checks AnimationBlend against single clip playback: zero-weight layers
+	// must not change the pose, blending a pose with itself must give it back,
+	// also with every rotation negated, and a crossfade must hand the clip
+	// back to the instance once it is over. Then times a crowd of instances
+	// playing one clip, crossfading between two, and crossfading with a third
+	// layer of zero weight.
+	int Blend(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT instanceCount = argc == 4 ? (UINT)atoi(argv[3]) : 1024;
+		const UINT frames = 120;
+		const float dt = 1.0f / 60.0f;
+		const float tolerance = 1e-3f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		ClipId clip = 0;
+		float endTime = model.GetClipEndTime(clip);
+		std::vector<XMFLOAT3X4> expected(model.BoneCount());
+		std::vector<XMFLOAT3X4> blended(model.BoneCount());
+		AnimationSampler sampler;
+		float zeroWeightError = 0.0f;
+		float selfBlendError = 0.0f;
+		float oppositeError = 0.0f;
+		for (UINT s = 0; s <= 100; ++s)
+		{
+			float timePos = endTime * s / 100;
+			model.GetFinalTransforms(clip, timePos, expected, sampler);
+
+			AnimationBlend blend;
+			blend.AddLayer(clip, timePos, 1.0f);
+			blend.AddLayer(clip, endTime - timePos, 0.0f);
+			blend.AddLayer(clip, endTime * 0.5f, 0.0f);
+			model.GetFinalTransforms(blend, blended);
+			zeroWeightError = max(zeroWeightError, MaxPaletteError(expected, blended));
+
+			blend.SetWeight(1, 0.7f);
+			blend.GetLayer(1).TimePos = timePos;
+			blend.SetWeight(0, 0.3f);
+			model.GetFinalTransforms(blend, blended);
+			selfBlendError = max(selfBlendError, MaxPaletteError(expected, blended));
+
+			// q and -q are the same rotation; without the hemisphere check
+			// their average would be 0.
+			std::vector<BoneTransform> pose(model.BoneCount());
+			std::vector<BoneTransform> opposite(model.BoneCount());
+			std::vector<BoneTransform> result(model.BoneCount());
+			model.GetClip(clip).Interpolate(timePos, pose);
+			for (UINT i = 0; i < model.BoneCount(); ++i)
+			{
+				opposite[i] = pose[i];
+				XMStoreFloat4(&opposite[i].Rotation, XMVectorNegate(XMLoadFloat4(&pose[i].Rotation)));
+			}
+			const std::vector<BoneTransform>* poses[] = { &pose, &opposite };
+			const float weights[] = { 0.5f, 0.5f };
+			BlendPoses(poses, weights, 2, result);
+			NormalizePose(result);
+			for (UINT i = 0; i < model.BoneCount(); ++i)
+			{
+				XMVECTOR difference = XMVectorSubtract(XMLoadFloat4(&result[i].Rotation), XMLoadFloat4(&pose[i].Rotation));
+				oppositeError = max(oppositeError, XMVectorGetX(XMVector4Length(difference)));
+			}
+		}
+
+		ModelInstance fading;
+		fading.ModelInfo = &model;
+		fading.FinalTransforms.resize(model.BoneCount());
+		fading.Clip = clip;
+		fading.TimePos = endTime * 0.5f;
+		fading.CrossfadeTo(model.GetClipName(clip), 0.25f);
+		UINT fadeFrames = 0;
+		while (fading.Blend.LayerCount() != 0 && fadeFrames < frames)
+		{
+			fading.UpdateSkinnedAnimation(dt);
+			++fadeFrames;
+		}
+
+		std::cout << "Zero-weight layers error " << zeroWeightError << ", self blend error " << selfBlendError <<
+			", opposite hemisphere error " << oppositeError << "\n";
+		std::cout << "A 0.25 s crossfade ended after " << fadeFrames << " frames\n";
+		if (zeroWeightError > tolerance || selfBlendError > tolerance || oppositeError > tolerance)
+		{
+			std::cerr << "Blend does not match single clip playback\n";
+			return 1;
+		}
+		if (fading.Blend.LayerCount() != 0 || fadeFrames > 16)
+		{
+			std::cerr << "The crossfade did not end\n";
+			return 1;
+		}
+
+		std::cout << "\n" << instanceCount << " instances\n";
+		std::cout << std::setw(24) << "Mode" << std::setw(16) << "ms per frame" << std::setw(10) << "Cost" << "\n";
+		const char* modes[] = { "Single clip", "Crossfade", "Crossfade + idle layer" };
+		double singleMilliseconds = 0.0;
+		for (int mode = 0; mode < 3; ++mode)
+		{
+			std::vector<ModelInstance> instances(instanceCount);
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ModelInstance& instance = instances[i];
+				instance.ModelInfo = &model;
+				instance.FinalTransforms.resize(model.BoneCount());
+				instance.Clip = i % model.ClipCount();
+				instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+				if (mode != 0)
+				{
+					// Long enough to stay halfway through the fade while timing.
+					instance.CrossfadeTo(model.GetClipName((i + 1) % model.ClipCount()), 1000.0f);
+					instance.Blend.SetWeight(0, 0.5f);
+					instance.Blend.SetWeight(1, 0.5f);
+				}
+				if (mode == 2)
+				{
+					instance.Blend.AddLayer(instance.Clip, 0.0f, 0.0f);
+				}
+				instance.UpdateSkinnedAnimation(dt);
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				for (auto& instance : instances)
+				{
+					instance.UpdateSkinnedAnimation(dt);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			double milliseconds = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+			if (mode == 0)
+			{
+				singleMilliseconds = milliseconds;
+			}
+			std::cout << std::setw(24) << modes[mode] << std::setw(16) << milliseconds <<
+				std::setw(10) << milliseconds / singleMilliseconds << "\n";
+		}
+		return 0;
+	}
+
+	// Builds a mask of the subtrees of the given bones and checks that partial
+	// evaluation writes exactly the final transforms of the masked bones and
+	// their ancestors, and that an overlay on the mask leaves the other bones
+	// alone. Then times both against evaluating every bone.
+	int Mask(int argc, char** argv)
+	{
+		if (argc < 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		const UINT instanceCount = 1024;
+		const UINT frames = 60;
+		const float dt = 1.0f / 60.0f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+
+		std::vector<UINT> rootBones;
+		for (int i = 3; i < argc; ++i)
+		{
+			UINT bone = (UINT)atoi(argv[i]);
+			if (bone >= model.BoneCount())
+			{
+				std::cerr << "The model has " << model.BoneCount() << " bones\n";
+				return 1;
+			}
+			rootBones.push_back(bone);
+		}
+		BoneMaskId maskId = model.CreateBoneMask("Mask", rootBones);
+		const BoneMask& mask = model.GetBoneMask(maskId);
+		std::cout << mask.Bones.Bones.size() << " masked bones, " << mask.Evaluated.Bones.size() <<
+			" with their ancestors, out of " << model.BoneCount() << "\n";
+
+		ClipId clip = 0;
+		float endTime = model.GetClipEndTime(clip);
+		std::vector<XMFLOAT3X4> expected(model.BoneCount());
+		std::vector<XMFLOAT3X4> partial(model.BoneCount());
+		std::vector<XMFLOAT3X4> overlay(model.BoneCount());
+		AnimationSampler sampler;
+		float partialError = 0.0f;
+		UINT untouchedBones = 0;
+		float overlayError = 0.0f;
+		for (UINT s = 0; s <= 100; ++s)
+		{
+			float timePos = endTime * s / 100;
+			model.GetFinalTransforms(clip, timePos, expected, sampler);
+
+			XMFLOAT3X4 marker;
+			XMStoreFloat3x4(&marker, XMMatrixScaling(-1.0f, -1.0f, -1.0f));
+			std::fill(partial.begin(), partial.end(), marker);
+			model.GetFinalTransforms(clip, timePos, maskId, partial, sampler);
+
+			AnimationBlend blend;
+			blend.AddLayer(clip, timePos, 1.0f);
+			blend.AddLayer(clip, endTime - timePos, 1.0f, maskId);
+			model.GetFinalTransforms(blend, overlay);
+
+			for (UINT i = 0; i < model.BoneCount(); ++i)
+			{
+				if (mask.Evaluated.Contains(i))
+				{
+					partialError = max(partialError, MaxElementError(expected[i], partial[i]));
+				}
+				else
+				{
+					untouchedBones += MaxElementError(marker, partial[i]) == 0.0f ? 1 : 0;
+				}
+				if (!mask.Bones.Contains(i))
+				{
+					overlayError = max(overlayError, MaxElementError(expected[i], overlay[i]));
+				}
+			}
+		}
+
+		UINT otherBones = model.BoneCount() - (UINT)mask.Evaluated.Bones.size();
+		std::cout << "Partial evaluation error " << partialError << ", " << untouchedBones / 101 << " of " <<
+			otherBones << " other bones untouched, overlay error outside the mask " << overlayError << "\n";
+		if (partialError > 1e-4f || untouchedBones != otherBones * 101 || overlayError > 1e-4f)
+		{
+			std::cerr << "The mask touched bones outside of it\n";
+			return 1;
+		}
+
+		std::cout << "\n" << instanceCount << " instances\n";
+		std::cout << std::setw(24) << "Mode" << std::setw(16) << "ms per frame" << std::setw(10) << "Cost" << "\n";
+		const char* modes[] = { "Every bone", "Masked bones", "Single clip", "Overlay", "Full-body layer" };
+		double baseMilliseconds = 0.0;
+		for (int mode = 0; mode < 5; ++mode)
+		{
+			std::vector<ModelInstance> instances(instanceCount);
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ModelInstance& instance = instances[i];
+				instance.ModelInfo = &model;
+				instance.FinalTransforms.resize(model.BoneCount());
+				instance.Clip = i % model.ClipCount();
+				instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+				if (mode == 3)
+				{
+					instance.AddOverlay(model.GetClipName(instance.Clip), "Mask", 0.5f);
+				}
+				else if (mode == 4)
+				{
+					instance.BeginBlend();
+					instance.Blend.AddLayer(instance.Clip, 0.0f, 0.5f);
+				}
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				for (auto& instance : instances)
+				{
+					if (mode == 1)
+					{
+						instance.AdvanceTime(dt);
+						model.GetFinalTransforms(instance.Clip, instance.TimePos, maskId, instance.FinalTransforms,
+							instance.Sampler);
+					}
+					else
+					{
+						instance.UpdateSkinnedAnimation(dt);
+					}
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			double milliseconds = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+			if (mode == 0 || mode == 2)
+			{
+				baseMilliseconds = milliseconds;
+			}
+			std::cout << std::setw(24) << modes[mode] << std::setw(16) << milliseconds <<
+				std::setw(10) << milliseconds / baseMilliseconds << "\n";
+		}
+		return 0;
+	}
+
+	// Writes a library of clipCount copies of the clips of the model to an
+	// archive, then streams it into a model loaded without clips while a crowd
+	// moves through working sets of budgetClips clips, under a budget of that
+	// many clips. Until a clip is resident its instances show the fallback
+	// pose; afterwards they must match the library exactly, and the resident
+	// clips must stay within the budget.
+	int Archive(int argc, char** argv)
+	{
+		if (argc < 4 || argc > 6)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT clipCount = argc >= 5 ? (UINT)atoi(argv[4]) : 32;
+		UINT budgetClips = max(1u, argc >= 6 ? (UINT)atoi(argv[5]) : 4u);
+		const UINT instanceCount = 64;
+		const UINT framesPerSet = 60;
+		const float dt = 1.0f / 60.0f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices) || model.ClipCount() == 0)
+		{
+			return 1;
+		}
+
+		std::unordered_map<std::string, AnimationClip> animations;
+		for (UINT c = 0; c < clipCount; ++c)
+		{
+			ClipId source = c % model.ClipCount();
+			std::string name = model.GetClipName(source) + "_" + std::to_string(c / 10) + std::to_string(c % 10);
+			animations[name] = model.GetClip(source);
+		}
+		std::vector<int> boneHierarchy = model.GetBoneHierarchy();
+		std::vector<XMFLOAT4X4> boneOffsets = model.GetBoneOffsets();
+		Model library;
+		library.Set(boneHierarchy, boneOffsets, animations);
+
+		if (!AnimationArchive::Write(argv[3], library))
+		{
+			std::cerr << "Failed to write " << argv[3] << "\n";
+			return 1;
+		}
+
+		Model skeleton;
+		M3DLoader skeletonLoader;
+		skeletonLoader.LoadAnimationClips = false;
+		if (!LoadModel(skeletonLoader, argv[2], skeleton, vertices))
+		{
+			return 1;
+		}
+		AnimationArchive archive;
+		if (!archive.Open(argv[3], skeleton))
+		{
+			std::cerr << "Failed to open " << argv[3] << "\n";
+			return 1;
+		}
+		size_t clipBytes = archive.GetClipSizeInBytes(0);
+		archive.SetMemoryBudget(budgetClips * clipBytes);
+
+		std::ifstream file(argv[3], std::ios::binary | std::ios::ate);
+		std::cout << clipCount << " clips, " << (size_t)file.tellg() << " bytes on disk, " <<
+			clipBytes << " bytes per resident clip, budget " << archive.MemoryBudget() << " bytes\n";
+
+		// The fallback pose is the first frame of the clip.
+		std::vector<XMFLOAT3X4> expected(skeleton.BoneCount());
+		std::vector<XMFLOAT3X4> streamed(skeleton.BoneCount());
+		AnimationSampler sampler;
+		float fallbackError = 0.0f;
+		for (ClipId clip = 0; clip < archive.ClipCount(); ++clip)
+		{
+			library.GetFinalTransforms(clip, library.GetClipStartTime(clip), expected, sampler);
+			skeleton.GetFinalTransforms(archive.GetFallbackPose(clip), streamed.data(), sampler);
+			fallbackError = max(fallbackError, MaxPaletteError(expected, streamed));
+		}
+
+		std::vector<ModelInstance> instances(instanceCount);
+		for (auto& instance : instances)
+		{
+			instance.ModelInfo = &skeleton;
+			instance.Archive = &archive;
+			instance.FinalTransforms.resize(skeleton.BoneCount());
+		}
+
+		UINT setCount = (clipCount + budgetClips - 1) / budgetClips;
+		float residentError = 0.0f;
+		size_t maxResidentBytes = 0;
+		UINT64 fallbackFrames = 0;
+		for (UINT set = 0; set < setCount; ++set)
+		{
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				instances[i].SetClip(archive.GetClipName(min(set * budgetClips + i % budgetClips, clipCount - 1)));
+			}
+
+			for (UINT frame = 0; frame < framesPerSet; ++frame)
+			{
+				for (auto& instance : instances)
+				{
+					instance.UpdateSkinnedAnimation(dt);
+					if (instance.UsingFallbackPose)
+					{
+						++fallbackFrames;
+						continue;
+					}
+					library.GetFinalTransforms(library.FindClip(archive.GetClipName(instance.Clip)), instance.TimePos,
+						expected, sampler);
+					residentError = max(residentError, MaxPaletteError(expected, instance.FinalTransforms));
+				}
+				maxResidentBytes = max(maxResidentBytes, archive.ResidentBytes());
+			}
+		}
+		archive.WaitForLoads();
+
+		std::cout << setCount << " working sets of " << budgetClips << " clips: " << archive.Loads() << " loads, " <<
+			archive.Evictions() << " evictions, " << fallbackFrames << " fallback updates, peak resident " <<
+			maxResidentBytes << " bytes\n";
+		std::cout << "Max error: fallback pose " << fallbackError << ", resident clips " << residentError << "\n";
+
+		if (maxResidentBytes > archive.MemoryBudget())
+		{
+			std::cerr << "The resident clips exceeded the budget\n";
+			return 1;
+		}
+		if (residentError != 0.0f || fallbackError > 1e-5f)
+		{
+			std::cerr << "Streamed clips do not match the library\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	// Headless model of the Update/Draw split of the app. Each frame animates
+	// the crowd into the palettes of its frame resource, then "draws": reads
+	// every palette, spins for recordMicroseconds of command recording and
+	// sleeps for presentMicroseconds blocked in Present. Serially, animation
+	// and drawing alternate; pipelined, the animation of frame N+1 runs on the
+	// JobSystem while frame N draws, and frame N+1 waits for it before drawing.
+	// Both must draw the same palettes every frame.
+	int Pipeline(int argc, char** argv)
+	{
+		if (argc < 3 || argc > 6)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		UINT instanceCount = argc >= 4 ? (UINT)atoi(argv[3]) : 256;
+		UINT recordMicroseconds = argc >= 5 ? (UINT)atoi(argv[4]) : 1000;
+		UINT presentMicroseconds = argc >= 6 ? (UINT)atoi(argv[5]) : 2000;
+		const UINT frameResourceCount = 3;
+		const UINT frames = 120;
+		const float dt = 1.0f / 60.0f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, vertices))
+		{
+			return 1;
+		}
+		UINT boneCount = model.BoneCount();
+
+		// At least one worker, for the pipelined animation to run on.
+		JobSystem jobSystem(max(1u, JobSystem::DefaultWorkerCount()));
+		std::cout << instanceCount << " instances, " << jobSystem.WorkerCount() + 1 << " threads, " <<
+			recordMicroseconds << " us recording and " << presentMicroseconds << " us in Present per frame\n";
+
+		std::vector<UINT64> drawnPalettes[2];
+		double frameTimes[2] = {};
+		double animationTime = 0.0;
+		for (int pipelined = 0; pipelined < 2; ++pipelined)
+		{
+			struct SimulatedFrameResource
+			{
+				std::vector<XMFLOAT3X4> Palettes;
+				std::vector<UINT64> PoseVersions;
+				JobHandle AnimationJob;
+			};
+			std::vector<SimulatedFrameResource> frameResources(frameResourceCount);
+			for (auto& frameResource : frameResources)
+			{
+				frameResource.Palettes.resize(instanceCount * boneCount);
+				frameResource.PoseVersions.assign(instanceCount, 0);
+			}
+
+			std::vector<ModelInstance> instances(instanceCount);
+			for (UINT i = 0; i < instanceCount; ++i)
+			{
+				ModelInstance& instance = instances[i];
+				instance.ModelInfo = &model;
+				instance.FinalTransforms.resize(boneCount);
+				instance.Clip = i % model.ClipCount();
+				instance.TimePos = model.GetClipEndTime(instance.Clip) * i / instanceCount;
+			}
+
+			auto animate = [&](SimulatedFrameResource* frameResource)
+			{
+				return jobSystem.ScheduleParallelFor(instanceCount, 16, [&, frameResource](size_t begin, size_t end)
+				{
+					PaletteUploadStats stats;
+					for (size_t i = begin; i < end; ++i)
+					{
+						instances[i].AdvanceTime(dt);
+						instances[i].UploadPalette(&frameResource->Palettes[i * boneCount],
+							frameResource->PoseVersions[i], stats);
+					}
+				});
+			};
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT frame = 0; frame < frames; ++frame)
+			{
+				SimulatedFrameResource& frameResource = frameResources[frame % frameResourceCount];
+
+				// Update
+				auto animationStart = std::chrono::high_resolution_clock::now();
+				if (frameResource.AnimationJob == nullptr)
+				{
+					frameResource.AnimationJob = animate(&frameResource);
+				}
+				jobSystem.Wait(frameResource.AnimationJob);
+				frameResource.AnimationJob = nullptr;
+				if (!pipelined)
+				{
+					animationTime += std::chrono::duration<double, std::milli>(
+						std::chrono::high_resolution_clock::now() - animationStart).count();
+				}
+				else
+				{
+					SimulatedFrameResource& next = frameResources[(frame + 1) % frameResourceCount];
+					next.AnimationJob = animate(&next);
+				}
+
+				// Draw
+				UINT64 hash = 14695981039346656037ull;
+				const BYTE* bytes = reinterpret_cast<const BYTE*>(frameResource.Palettes.data());
+				for (size_t b = 0; b < frameResource.Palettes.size() * sizeof(XMFLOAT3X4); ++b)
+				{
+					hash = (hash ^ bytes[b]) * 1099511628211ull;
+				}
+				drawnPalettes[pipelined].push_back(hash);
+				auto recordEnd = std::chrono::high_resolution_clock::now() + std::chrono::microseconds(recordMicroseconds);
+				while (std::chrono::high_resolution_clock::now() < recordEnd)
+				{
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(presentMicroseconds));
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			frameTimes[pipelined] = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+
+			for (auto& frameResource : frameResources)
+			{
+				if (frameResource.AnimationJob != nullptr)
+				{
+					jobSystem.Wait(frameResource.AnimationJob);
+				}
+			}
+		}
+
+		std::cout << "Animation: " << animationTime / frames << " ms per frame\n";
+		std::cout << "Serial:    " << frameTimes[0] << " ms per frame\n";
+		std::cout << "Pipelined: " << frameTimes[1] << " ms per frame, " <<
+			100.0 * (1.0 - frameTimes[1] / frameTimes[0]) << "% less\n";
+
+		if (drawnPalettes[0] != drawnPalettes[1])
+		{
+			std::cerr << "The pipelined frames drew different palettes\n";
+			return 1;
+		}
+		std::cout << "Every frame drew the same complete palettes\n";
+		return 0;
+	}
+
+	// Skins the model and a synthetic mesh of random vertices, bound to random
+	// bones of the model, with SkinVertices on one thread and on a JobSystem
+	// with more and more threads, once per skinning kernel the CPU supports,
+	// and reports vertices skinned per second. SkinVertexLinear, one vertex at
+	// a time, is the baseline, and every run must match it.
+	int SkinBench(int argc, char** argv)
+	{
+		if (argc < 3 || argc > 5)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		size_t syntheticVertexCount = argc >= 4 ? (size_t)atoi(argv[3]) : 1 << 20;
+		UINT maxThreadCount = argc == 5 ? (UINT)atoi(argv[4]) : JobSystem::DefaultWorkerCount() + 1;
+
+		Model model;
+		std::vector<SkinnedVertex> modelVertices;
+		M3DLoader m3dLoader;
+		if (!LoadModel(m3dLoader, argv[2], model, modelVertices))
+		{
+			return 1;
+		}
+
+		std::vector<XMFLOAT3X4> finalTransforms(model.BoneCount());
+		model.GetFinalTransforms(model.GetClipName(0), 0.5f * (model.GetClipStartTime(0) + model.GetClipEndTime(0)),
+			finalTransforms);
+
+		std::vector<SkinnedVertex> syntheticVertices(syntheticVertexCount);
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::uniform_int_distribution<UINT> bone(0, model.BoneCount() - 1);
+		for (auto& v : syntheticVertices)
+		{
+			v = SkinnedVertex();
+			v.Pos = XMFLOAT3(unit(random), unit(random), unit(random));
+			XMStoreFloat3(&v.Normal, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+			XMStoreFloat3(&v.TangentU, XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f)));
+			float w[4] = { fabsf(unit(random)), fabsf(unit(random)), fabsf(unit(random)), fabsf(unit(random)) + 0.01f };
+			float sum = w[0] + w[1] + w[2] + w[3];
+			v.BoneWeights = XMFLOAT3(w[0] / sum, w[1] / sum, w[2] / sum);
+			for (UINT i = 0; i < 4; ++i)
+			{
+				v.BoneIndices[i] = (BYTE)bone(random);
+			}
+		}
+
+		struct Mesh
+		{
+			const char* Name;
+			const std::vector<SkinnedVertex>* Vertices;
+		};
+		const Mesh meshes[] = { { argv[2], &modelVertices }, { "Synthetic", &syntheticVertices } };
+		const char* kernelNames[SkinningKernelCount] = { "SSE", "AVX2" };
+		SkinningKernel defaultKernel = GetSkinningKernel();
+
+		for (const Mesh& mesh : meshes)
+		{
+			const std::vector<SkinnedVertex>& vertices = *mesh.Vertices;
+			// Enough passes for about 8 million vertices.
+			UINT passes = (UINT)max<size_t>(4, (8 << 20) / max<size_t>(1, vertices.size()));
+
+			std::vector<XMFLOAT3> referencePositions(vertices.size());
+			std::vector<XMFLOAT3> referenceNormals(vertices.size());
+			auto start = std::chrono::high_resolution_clock::now();
+			for (UINT pass = 0; pass < passes; ++pass)
+			{
+				for (size_t v = 0; v < vertices.size(); ++v)
+				{
+					SkinVertexLinear(vertices[v], finalTransforms, referencePositions[v], referenceNormals[v]);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			double referenceRate = (double)vertices.size() * passes /
+				std::chrono::duration<double>(end - start).count();
+
+			// Tolerance relative to the size of the skinned mesh, which the bone
+			// translations can move far from the origin.
+			float extent = 0.0f;
+			for (const auto& p : referencePositions)
+			{
+				extent = max(extent, max(fabsf(p.x), max(fabsf(p.y), fabsf(p.z))));
+			}
+			float tolerance = 1e-5f * max(extent, 1.0f);
+
+			std::cout << "\n" << mesh.Name << ", " << vertices.size() << " vertices\n";
+			std::cout << std::setw(24) << "" << std::setw(10) << "Threads" << std::setw(16) << "Mvertices/s" <<
+				std::setw(10) << "Speedup" << "\n";
+			std::cout << std::setw(24) << "SkinVertexLinear" << std::setw(10) << 1 <<
+				std::setw(16) << referenceRate * 1e-6 << std::setw(10) << 1.0 << "\n";
+
+			SkinnedVertexStreams streams;
+			streams.Resize(vertices.size());
+			for (UINT kernel = 0; kernel < SkinningKernelCount; ++kernel)
+			{
+				std::string name = std::string("SkinVertices ") + kernelNames[kernel];
+				if (!SetSkinningKernel((SkinningKernel)kernel))
+				{
+					std::cout << std::setw(24) << name << "  not supported by this CPU\n";
+					continue;
+				}
+				for (UINT threadCount = 0; threadCount <= maxThreadCount; threadCount = max(2 * threadCount, 1u))
+				{
+					// 0 threads runs SkinVertices directly, without a JobSystem.
+					JobSystem jobSystem(max(threadCount, 1u) - 1);
+					std::fill(streams.Positions.begin(), streams.Positions.end(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+
+					start = std::chrono::high_resolution_clock::now();
+					for (UINT pass = 0; pass < passes; ++pass)
+					{
+						if (threadCount == 0)
+						{
+							SkinVertices(vertices, finalTransforms.data(), streams, 0, vertices.size());
+						}
+						else
+						{
+							SkinVertices(jobSystem, vertices, finalTransforms.data(), streams);
+						}
+					}
+					end = std::chrono::high_resolution_clock::now();
+					double rate = (double)vertices.size() * passes / std::chrono::duration<double>(end - start).count();
+
+					std::cout << std::setw(24) << (threadCount == 0 ? name : name + ", jobs") <<
+						std::setw(10) << max(threadCount, 1u) << std::setw(16) << rate * 1e-6 <<
+						std::setw(10) << rate / referenceRate << "\n";
+
+					float maxPositionError = 0.0f;
+					float maxNormalError = 0.0f;
+					for (size_t v = 0; v < vertices.size(); ++v)
+					{
+						maxPositionError = max(maxPositionError, XMVectorGetX(XMVector3Length(XMVectorSubtract(
+							XMLoadFloat3(&streams.Positions[v]), XMLoadFloat3(&referencePositions[v])))));
+						maxNormalError = max(maxNormalError, XMVectorGetX(XMVector3Length(XMVectorSubtract(
+							XMLoadFloat3(&streams.Normals[v]), XMLoadFloat3(&referenceNormals[v])))));
+					}
+					if (maxPositionError > tolerance || maxNormalError > 1e-5f)
+					{
+						std::cerr << name << " does not match SkinVertexLinear: position error " <<
+							maxPositionError << ", normal error " << maxNormalError << "\n";
+						return 1;
+					}
+				}
+			}
+		}
+		SetSkinningKernel(defaultKernel);
+		std::cout << "\nEvery run matched SkinVertexLinear\n";
+		return 0;
+	}
+
+	// Buckets the vertices of the model by influence count, once keeping every
+	// weight and once pruning weights below weightThreshold, and reports the
+	// buckets and the average influences per vertex. Every triangle must still
+	// reference the same vertices, the bucketed kernels must match the four
+	// bone SkinVertexLinear on the bucketed mesh, and without pruning they
+	// must match it on the original mesh. Then times SkinVertices on the whole
+	// mesh against the bucketed ranges.
+	int Influences(int argc, char** argv)
+	{
+		if (argc != 3 && argc != 4)
+		{
+			PrintUsage();
+			return 1;
+		}
+
+		float weightThreshold = argc == 4 ? (float)atof(argv[3]) : 0.01f;
+
+		Model model;
+		std::vector<SkinnedVertex> vertices;
+		std::vector<USHORT> indices;
+		std::vector<M3DLoader::Subset> subsets;
+		std::vector<M3DLoader::M3dMaterial> mats;
+		M3DLoader m3dLoader;
+		if (!m3dLoader.LoadM3d(argv[2], vertices, indices, subsets, mats, model))
+		{
+			std::cerr << "Failed to load " << argv[2] << "\n";
+			return 1;
+		}
+
+		std::vector<XMFLOAT3X4> finalTransforms(model.BoneCount());
+		model.GetFinalTransforms(model.GetClipName(0), 0.5f * (model.GetClipStartTime(0) + model.GetClipEndTime(0)),
+			finalTransforms);
+
+		float extent = 0.0f;
+		std::vector<XMFLOAT3> referencePositions(vertices.size());
+		std::vector<XMFLOAT3> referenceNormals(vertices.size());
+		for (size_t v = 0; v < vertices.size(); ++v)
+		{
+			const XMFLOAT3& p = vertices[v].Pos;
+			extent = max(extent, max(fabsf(p.x), max(fabsf(p.y), fabsf(p.z))));
+			SkinVertexLinear(vertices[v], finalTransforms, referencePositions[v], referenceNormals[v]);
+		}
+		float tolerance = 1e-5f * max(extent, 1.0f);
+
+		const float thresholds[] = { 0.0f, weightThreshold };
+		std::vector<SkinnedVertex> bucketed;
+		std::vector<InfluenceRange> ranges;
+		for (float threshold : thresholds)
+		{
+			bucketed = vertices;
+			std::vector<USHORT> bucketedIndices = indices;
+			ranges.clear();
+			InfluenceBucketReport report = BucketInfluences(bucketed, bucketedIndices, subsets, threshold, ranges);
+
+			std::cout << "Weight threshold " << threshold << ": " << report.PrunedWeights << " weights pruned, " <<
+				ranges.size() << " ranges in " << subsets.size() << " subsets\n";
+			std::cout << std::setw(12) << "Influences" << std::setw(10) << "Vertices" << "\n";
+			for (UINT b = 0; b < 4; ++b)
+			{
+				std::cout << std::setw(12) << b + 1 << std::setw(10) << report.VertexCounts[b] << "\n";
+			}
+			std::cout << "Average influences per vertex: " << report.AverageInfluencesBefore << " -> " <<
+				report.AverageInfluencesAfter << "\n";
+
+			SkinnedVertexStreams streams;
+			streams.Resize(bucketed.size());
+			for (const auto& range : ranges)
+			{
+				SkinVertices(bucketed, finalTransforms.data(), streams, range);
+			}
+
+			float maxKernelError = 0.0f;
+			float maxPruningError = 0.0f;
+			for (size_t i = 0; i < indices.size(); ++i)
+			{
+				const SkinnedVertex& before = vertices[indices[i]];
+				const SkinnedVertex& after = bucketed[bucketedIndices[i]];
+				if (memcmp(&before.Pos, &after.Pos, sizeof(XMFLOAT3)) != 0 ||
+					memcmp(&before.TexC, &after.TexC, sizeof(XMFLOAT2)) != 0)
+				{
+					std::cerr << "Index " << i << " no longer references the same vertex\n";
+					return 1;
+				}
+
+				XMFLOAT3 pos, normal;
+				SkinVertexLinear(after, finalTransforms, pos, normal);
+				XMVECTOR bucketedPos = XMLoadFloat3(&streams.Positions[bucketedIndices[i]]);
+				maxKernelError = max(maxKernelError, XMVectorGetX(XMVector3Length(
+					XMVectorSubtract(bucketedPos, XMLoadFloat3(&pos)))));
+				maxPruningError = max(maxPruningError, XMVectorGetX(XMVector3Length(
+					XMVectorSubtract(bucketedPos, XMLoadFloat3(&referencePositions[indices[i]])))));
+			}
+			std::cout << "Max position change " << maxPruningError << " (mesh size " << extent << ")\n\n";
+
+			if (maxKernelError > tolerance)
+			{
+				std::cerr << "The bucketed kernels do not match SkinVertexLinear: " << maxKernelError << "\n";
+				return 1;
+			}
+			if (threshold == 0.0f && maxPruningError > tolerance)
+			{
+				std::cerr << "Bucketing without pruning changed the skinned mesh: " << maxPruningError << "\n";
+				return 1;
+			}
+		}
+
+		// Enough passes for about 8 million vertices.
+		UINT passes = (UINT)max<size_t>(4, (8 << 20) / max<size_t>(1, vertices.size()));
+		SkinnedVertexStreams streams;
+		streams.Resize(vertices.size());
+		auto start = std::chrono::high_resolution_clock::now();
+		for (UINT pass = 0; pass < passes; ++pass)
+		{
+			SkinVertices(vertices, finalTransforms.data(), streams, 0, vertices.size());
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		double fourBoneRate = (double)vertices.size() * passes / std::chrono::duration<double>(end - start).count();
+
+		start = std::chrono::high_resolution_clock::now();
+		for (UINT pass = 0; pass < passes; ++pass)
+		{
+			for (const auto& range : ranges)
+			{
+				SkinVertices(bucketed, finalTransforms.data(), streams, range);
+			}
+		}
+		end = std::chrono::high_resolution_clock::now();
+		double bucketedRate = (double)vertices.size() * passes / std::chrono::duration<double>(end - start).count();
+
+		std::cout << "Four bones:  " << fourBoneRate * 1e-6 << " Mvertices/s\n";
+		std::cout << "Bucketed:    " << bucketedRate * 1e-6 << " Mvertices/s, " << bucketedRate / fourBoneRate << "x\n";
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && std::string(argv[1]) == "reduce")
+	{
+		return Reduce(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "bench")
+	{
+		return Bench(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "keysearch")
+	{
+		return KeySearch(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "skin")
+	{
+		return Skin(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "palette")
+	{
+		return Palette(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "crowd")
+	{
+		return Crowd(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "lod")
+	{
+		return Lod(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "posecache")
+	{
+		return PoseCacheBench(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "bake")
+	{
+		return Bake(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "blend")
+	{
+		return Blend(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "mask")
+	{
+		return Mask(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "channels")
+	{
+		return Channels(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "compress")
+	{
+		return Compress(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "upload")
+	{
+		return Upload(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "archive")
+	{
+		return Archive(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "pipeline")
+	{
+		return Pipeline(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "skinbench")
+	{
+		return SkinBench(argc, argv);
+	}
+	if (argc >= 2 && std::string(argv[1]) == "influences")
+	{
+		return Influences(argc, argv);
+	}
+
+	PrintUsage();
+	return 1;
+}